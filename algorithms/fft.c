@@ -35,66 +35,57 @@
 
 // Functions
 
-static void _fft(complex double *v, int n) {
-    if (n > 1) {
-        complex double tmp[n];
-        complex double *ve = &tmp[0];
-        complex double *vo = &tmp[n / 2];
-
-        for (int k = 0; k < n / 2; k++) {
-            int even = 2 * k;  // calculate once
-
-            ve[k] = v[even];
-            vo[k] = v[even + 1];
-        }
+/*
+ * In place iterative radix-2, so there is no scratch
+ * array at each level of recursion. sign is -1.0 for
+ * the forward transform and 1.0 for the inverse.
+ */
+static void _transform(complex double *v, int n, double sign) {
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
 
-        _fft(ve, n / 2);
-        _fft(vo, n / 2);
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
 
-        for (int m = 0; m < (n / 2); m++) {
-            complex double w = (cos(TAU * (double)m / (double)n)) +
-                                   (-sin(TAU * (double)m / (double)n)) * I;
-            complex double z = (creal(w) * creal(vo[m]) - cimag(w) * cimag(vo[m])) +
-                                   (creal(w) * cimag(vo[m]) + cimag(w) * creal(vo[m])) * I;
+        j ^= bit;
 
-            v[m] = (creal(ve[m]) + creal(z)) +
-                               (cimag(ve[m]) + cimag(z)) * I;
-            v[m + n / 2] = (creal(ve[m]) - creal(z)) +
-                               (cimag(ve[m]) - cimag(z)) * I; 
+        if (i < j) {
+            complex double tmp = v[i];
+            v[i] = v[j];
+            v[j] = tmp;
         }
     }
-}
-
-static void _ifft(complex double *v, int n) {
-    if (n > 1) {
-        complex double tmp[n];
-        complex double *ve = &tmp[0];
-        complex double *vo = &tmp[n / 2];
-
-        for (int k = 0; k < n / 2; k++) {
-            int even = 2 * k;  // calculate once
 
-            ve[k] = v[even];
-            vo[k] = v[even + 1];
-        }
+    for (int len = 2; len <= n; len <<= 1) {
+        int half = len / 2;
 
-        _ifft(ve, n / 2);
-        _ifft(vo, n / 2);
+        for (int m = 0; m < half; m++) {
+            complex double w = (cos(TAU * (double)m / (double)len)) +
+                                   (sign * sin(TAU * (double)m / (double)len)) * I;
 
-        for (int m = 0; m < (n / 2); m++) {
-            complex double w = (cos(TAU * (double)m / (double)n)) +
-                                   (sin(TAU * (double)m / (double)n)) * I; // conjugate
-            complex double z = (creal(w) * creal(vo[m]) - cimag(w) * cimag(vo[m])) +
-                                   (creal(w) * cimag(vo[m]) + cimag(w) * creal(vo[m])) * I;
+            for (int k = 0; k < n; k += len) {
+                complex double e = v[k + m];
+                complex double o = v[k + m + half];
+                complex double z = (creal(w) * creal(o) - cimag(w) * cimag(o)) +
+                                       (creal(w) * cimag(o) + cimag(w) * creal(o)) * I;
 
-            v[m] = (creal(ve[m]) + creal(z)) +
-                               (cimag(ve[m]) + cimag(z)) * I;
-            v[m + n / 2] = (creal(ve[m]) - creal(z)) +
-                               (cimag(ve[m]) - cimag(z)) * I; 
+                v[k + m] = (creal(e) + creal(z)) +
+                               (cimag(e) + cimag(z)) * I;
+                v[k + m + half] = (creal(e) - creal(z)) +
+                               (cimag(e) - cimag(z)) * I;
+            }
         }
     }
 }
 
+static void _fft(complex double *v, int n) {
+    _transform(v, n, -1.0);
+}
+
+static void _ifft(complex double *v, int n) {
+    _transform(v, n, 1.0); // conjugate
+}
+
 void fft(complex double *in, complex double *out) {
     for (int i = 0; i < NFFT; i++) {
         out[i] = in[i];
@@ -135,3 +126,113 @@ void ifftn(complex double *in, complex double *out, int n) {
     _ifft(out, n);
 }
 
+
+/*
+ * Plan based FFT
+ *
+ * Iterative radix-2 decimation in time, done in place
+ * in single precision, with the twiddles computed once
+ * at plan time rather than at every butterfly.
+ *
+ * Returns NULL on error, or if n is not a power of two
+ */
+struct fft_plan *fft_plan_create(int n) {
+    int log2n = 0;
+
+    if (n < 1 || (n & (n - 1)) != 0)
+        return NULL;
+
+    while ((1 << log2n) < n)
+        log2n++;
+
+    struct fft_plan *plan = calloc(1, sizeof (struct fft_plan));
+
+    if (plan == NULL)
+        return NULL;
+
+    plan->n = n;
+    plan->log2n = log2n;
+    plan->bitrev = malloc(n * sizeof (int));
+    plan->twiddle = malloc(((n / 2) + 1) * sizeof (complex float));
+
+    if (plan->bitrev == NULL || plan->twiddle == NULL) {
+        fft_plan_destroy(plan);
+        return NULL;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int r = 0;
+
+        for (int b = 0; b < log2n; b++) {
+            r |= ((i >> b) & 0x1) << (log2n - 1 - b);
+        }
+
+        plan->bitrev[i] = r;
+    }
+
+    for (int m = 0; m <= (n / 2); m++) {
+        plan->twiddle[m] = (float) cos(TAU * (double)m / (double)n) +
+                           (float) -sin(TAU * (double)m / (double)n) * I;
+    }
+
+    return plan;
+}
+
+void fft_plan_destroy(struct fft_plan *plan) {
+    if (plan == NULL)
+        return;
+
+    free(plan->bitrev);
+    free(plan->twiddle);
+    free(plan);
+}
+
+static void _execute(const struct fft_plan *plan, complex float *v, int inverse) {
+    int n = plan->n;
+
+    for (int i = 0; i < n; i++) {
+        int r = plan->bitrev[i];
+
+        if (r > i) {
+            complex float tmp = v[i];
+            v[i] = v[r];
+            v[r] = tmp;
+        }
+    }
+
+    for (int len = 2; len <= n; len <<= 1) {
+        int half = len / 2;
+        int stride = n / len;
+
+        for (int k = 0; k < n; k += len) {
+            for (int m = 0; m < half; m++) {
+                complex float w = plan->twiddle[m * stride];
+                complex float o = v[k + m + half];
+                complex float e = v[k + m];
+
+                float wr = crealf(w);
+                float wi = inverse ? -cimagf(w) : cimagf(w); // conjugate
+
+                float zr = wr * crealf(o) - wi * cimagf(o);
+                float zi = wr * cimagf(o) + wi * crealf(o);
+
+                v[k + m] = (crealf(e) + zr) + (cimagf(e) + zi) * I;
+                v[k + m + half] = (crealf(e) - zr) + (cimagf(e) - zi) * I;
+            }
+        }
+    }
+}
+
+/*
+ * Forward transform in place, not normalized
+ */
+void fft_execute(const struct fft_plan *plan, complex float *inout) {
+    _execute(plan, inout, 0);
+}
+
+/*
+ * Inverse transform in place, not normalized
+ */
+void ifft_execute(const struct fft_plan *plan, complex float *inout) {
+    _execute(plan, inout, 1);
+}
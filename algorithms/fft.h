@@ -43,6 +43,23 @@ extern "C"
 #define TAU             (2.0 * M_PI)
 #define NFFT		512
 
+/*
+ * A plan holds the bit reversal and twiddle tables for
+ * one power of two size. Once created it is read-only,
+ * so one plan may be shared by any number of threads.
+ */
+struct fft_plan {
+    int n;
+    int log2n;
+    int *bitrev;
+    complex float *twiddle;
+};
+
+struct fft_plan *fft_plan_create(int);
+void fft_plan_destroy(struct fft_plan *);
+void fft_execute(const struct fft_plan *, complex float *);
+void ifft_execute(const struct fft_plan *, complex float *);
+
 void fft(complex double *, complex double *);
 void fftn(complex double *, complex double *, int);
 void ifft(complex double *, complex double *);
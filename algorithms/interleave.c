@@ -40,9 +40,11 @@ static const uint16_t primes[] = {
     283, 293, 307, 311, 313, 317, 331, 337, 347
 };
 
-void interleave(uint8_t *inout, int nbytes, int dir) {
-    uint8_t out[nbytes];
-
+/*
+ * The work buffer must hold nbytes, so the
+ * frame never has to be copied on the stack
+ */
+void interleave(uint8_t *inout, uint8_t *out, int nbytes, int dir) {
     memset(out, 0, nbytes);
 
     uint16_t imax = sizeof (primes) / sizeof (uint16_t);
@@ -103,13 +105,14 @@ void printData(char *str, uint8_t val[]) {
  */
 int main(int argc, char **argv) {
     uint8_t data[DATLEN] = { 0b10101010, 0b10101010, 0b10101010, 0b10101010, 0, 0, 0, 0 };
+    uint8_t work[DATLEN];
 
     printData("Original Data:      ", data);
 
-    interleave(data, DATLEN, INTERLEAVE);
+    interleave(data, work, DATLEN, INTERLEAVE);
     printData("Interleaved Data:   ", data);
 
-    interleave(data, DATLEN, DEINTERLEAVE);
+    interleave(data, work, DATLEN, DEINTERLEAVE);
     printData("Deinterleaved Data: ", data);
 }
 #endif
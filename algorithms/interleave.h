@@ -10,7 +10,7 @@ extern "C"
 #define INTERLEAVE   0
 #define DEINTERLEAVE 1
 
-void interleave(uint8_t *, int, int);
+void interleave(uint8_t *, uint8_t *, int, int);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,639 @@
+/*
+ * viterbi.c
+ *
+ * K=7 Rate 1/2 Convolutional Code, with 2/3 and 3/4
+ * puncturing, and a soft decision Viterbi decoder.
+ *
+ * The two polynomials both tap the newest and oldest
+ * bits, so the states pair up into butterflies: new
+ * states 2i and 2i+1 both come from old states i and
+ * i+32, with one branch metric and its complement.
+ * That lets the Add-Compare-Select of all 64 states
+ * run at once as 16 bit lanes, in four SSE2 or NEON
+ * registers, or two AVX2 registers.
+ *
+ * Path metrics are renormalized every step, so the
+ * spread always fits in 16 bits, and every variant
+ * makes the same decisions as the scalar one.
+ *
+ * The variant is picked through dispatch.c. Make the
+ * throughput benchmark with:
+ *
+ *    make bench_viterbi
+ */
+
+#ifdef BENCH
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VITERBI_X86
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VITERBI_NEON
+#endif
+
+#include "viterbi.h"
+#include "../dispatch.h"
+
+#define BM_MAX  510     // two soft bits both wrong
+
+/*
+ * Puncture patterns over (c1, c2) pairs, 1 is sent
+ */
+static const uint8_t puncture_1_2[] = { 1, 1 };
+static const uint8_t puncture_2_3[] = { 1, 1, 1, 0 };
+static const uint8_t puncture_3_4[] = { 1, 1, 1, 0, 0, 1 };
+
+static const struct {
+    const uint8_t *pattern;
+    int length;
+} punctures[FEC_RATES] = {
+    [FEC_1_2] = { puncture_1_2, 2 },
+    [FEC_2_3] = { puncture_2_3, 4 },
+    [FEC_3_4] = { puncture_3_4, 6 }
+};
+
+/*
+ * Expected outputs of old state i with input 0,
+ * as 0 or 255 so a soft bit XOR gives the distance
+ */
+static int16_t expect1[CONV_STATES / 2];
+static int16_t expect2[CONV_STATES / 2];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static int parity(unsigned int x) {
+    x ^= x >> 4;
+    x ^= x >> 2;
+    x ^= x >> 1;
+
+    return x & 0x1;
+}
+
+static void tables_make(void) {
+    for (int i = 0; i < (CONV_STATES / 2); i++) {
+        unsigned int reg = (unsigned int) i << 1;
+
+        expect1[i] = parity(reg & CONV_POLY1) ? 255 : 0;
+        expect2[i] = parity(reg & CONV_POLY2) ? 255 : 0;
+    }
+}
+
+/*
+ * Transmitted bits for nbytes of data plus the tail
+ */
+int conv_coded_bits(int nbytes, CodeRate rate) {
+    const uint8_t *pattern = punctures[rate].pattern;
+    int length = punctures[rate].length;
+    int mother = ((nbytes * 8) + CONV_TAIL) * 2;
+    int count = 0;
+
+    for (int i = 0; i < mother; i++) {
+        count += pattern[i % length];
+    }
+
+    return count;
+}
+
+/*
+ * Encode nbytes, most significant bit first, and the
+ * zero tail. The output is one bit per byte.
+ *
+ * Returns the number of coded bits
+ */
+int conv_encode(const uint8_t *in, int nbytes, uint8_t *out, CodeRate rate) {
+    const uint8_t *pattern = punctures[rate].pattern;
+    int length = punctures[rate].length;
+    int nbits = (nbytes * 8) + CONV_TAIL;
+    unsigned int sr = 0;
+    int count = 0;
+    int p = 0;
+
+    for (int i = 0; i < nbits; i++) {
+        int bit = (i < (nbytes * 8)) ? (in[i / 8] >> (7 - (i % 8))) & 0x1 : 0;
+
+        sr = ((sr << 1) | bit) & 0x7f;
+
+        if (pattern[p])
+            out[count++] = (uint8_t) parity(sr & CONV_POLY1);
+
+        p = (p + 1) % length;
+
+        if (pattern[p])
+            out[count++] = (uint8_t) parity(sr & CONV_POLY2);
+
+        p = (p + 1) % length;
+    }
+
+    return count;
+}
+
+/*
+ * Put the punctured soft bits back at the rate 1/2
+ * positions, as erasures, for nbytes of data
+ *
+ * Returns the number of rate 1/2 soft bits
+ */
+int conv_depuncture(const uint8_t *in, int nbytes, uint8_t *out, CodeRate rate) {
+    const uint8_t *pattern = punctures[rate].pattern;
+    int length = punctures[rate].length;
+    int mother = ((nbytes * 8) + CONV_TAIL) * 2;
+
+    for (int i = 0, j = 0; i < mother; i++) {
+        out[i] = pattern[i % length] ? in[j++] : SOFT_ERASE;
+    }
+
+    return mother;
+}
+
+// Add-Compare-Select, one variant per instruction set
+
+static void acs_scalar(struct viterbi *v, const uint8_t *soft, int steps) {
+    int16_t metric[CONV_STATES] = { 0 };
+    int16_t next[CONV_STATES];
+
+    /*
+     * Start in state 0
+     */
+    for (int s = 1; s < CONV_STATES; s++) {
+        metric[s] = 1000;
+    }
+
+    for (int t = 0; t < steps; t++) {
+        int16_t s1 = soft[(t * 2)];
+        int16_t s2 = soft[(t * 2) + 1];
+        uint64_t d = 0;
+
+        for (int i = 0; i < (CONV_STATES / 2); i++) {
+            int16_t bm = (int16_t) ((s1 ^ expect1[i]) + (s2 ^ expect2[i]));
+            int16_t cbm = (int16_t) (BM_MAX - bm);
+
+            int16_t m0 = (int16_t) (metric[i] + bm);
+            int16_t m1 = (int16_t) (metric[i + 32] + cbm);
+            int16_t m2 = (int16_t) (metric[i] + cbm);
+            int16_t m3 = (int16_t) (metric[i + 32] + bm);
+
+            next[(i * 2)] = (m0 > m1) ? m1 : m0;
+            next[(i * 2) + 1] = (m2 > m3) ? m3 : m2;
+
+            d |= (uint64_t) (m0 > m1) << (i * 2);
+            d |= (uint64_t) (m2 > m3) << ((i * 2) + 1);
+        }
+
+        int16_t norm = next[0];
+
+        for (int s = 0; s < CONV_STATES; s++) {
+            metric[s] = (int16_t) (next[s] - norm);
+        }
+
+        v->decisions[t] = d;
+    }
+}
+
+#ifdef VITERBI_X86
+
+__attribute__((target("sse2")))
+static void acs_sse2(struct viterbi *v, const uint8_t *soft, int steps) {
+    __m128i metric[8];
+    __m128i e1[4], e2[4];
+    const __m128i max = _mm_set1_epi16(BM_MAX);
+
+    for (int r = 0; r < 4; r++) {
+        e1[r] = _mm_loadu_si128((const __m128i *) &expect1[r * 8]);
+        e2[r] = _mm_loadu_si128((const __m128i *) &expect2[r * 8]);
+    }
+
+    metric[0] = _mm_set_epi16(1000, 1000, 1000, 1000, 1000, 1000, 1000, 0);
+
+    for (int r = 1; r < 8; r++) {
+        metric[r] = _mm_set1_epi16(1000);
+    }
+
+    for (int t = 0; t < steps; t++) {
+        __m128i s1 = _mm_set1_epi16(soft[(t * 2)]);
+        __m128i s2 = _mm_set1_epi16(soft[(t * 2) + 1]);
+        __m128i next[8];
+        uint64_t d = 0;
+
+        for (int r = 0; r < 4; r++) {
+            __m128i bm = _mm_add_epi16(_mm_xor_si128(s1, e1[r]), _mm_xor_si128(s2, e2[r]));
+            __m128i cbm = _mm_sub_epi16(max, bm);
+
+            __m128i m0 = _mm_add_epi16(metric[r], bm);
+            __m128i m1 = _mm_add_epi16(metric[r + 4], cbm);
+            __m128i m2 = _mm_add_epi16(metric[r], cbm);
+            __m128i m3 = _mm_add_epi16(metric[r + 4], bm);
+
+            __m128i even = _mm_min_epi16(m0, m1);
+            __m128i odd = _mm_min_epi16(m2, m3);
+            __m128i de = _mm_cmpgt_epi16(m0, m1);
+            __m128i dodd = _mm_cmpgt_epi16(m2, m3);
+
+            next[(r * 2)] = _mm_unpacklo_epi16(even, odd);
+            next[(r * 2) + 1] = _mm_unpackhi_epi16(even, odd);
+
+            __m128i dec = _mm_packs_epi16(_mm_unpacklo_epi16(de, dodd),
+                                          _mm_unpackhi_epi16(de, dodd));
+
+            d |= (uint64_t) (uint16_t) _mm_movemask_epi8(dec) << (r * 16);
+        }
+
+        __m128i norm = _mm_shufflelo_epi16(next[0], 0);
+        norm = _mm_unpacklo_epi64(norm, norm);
+
+        for (int r = 0; r < 8; r++) {
+            metric[r] = _mm_sub_epi16(next[r], norm);
+        }
+
+        v->decisions[t] = d;
+    }
+}
+
+__attribute__((target("avx2")))
+static void acs_avx2(struct viterbi *v, const uint8_t *soft, int steps) {
+    __m256i metric[4];
+    __m256i e1[2], e2[2];
+    const __m256i max = _mm256_set1_epi16(BM_MAX);
+
+    for (int r = 0; r < 2; r++) {
+        e1[r] = _mm256_loadu_si256((const __m256i *) &expect1[r * 16]);
+        e2[r] = _mm256_loadu_si256((const __m256i *) &expect2[r * 16]);
+    }
+
+    metric[0] = _mm256_insert_epi16(_mm256_set1_epi16(1000), 0, 0);
+
+    for (int r = 1; r < 4; r++) {
+        metric[r] = _mm256_set1_epi16(1000);
+    }
+
+    for (int t = 0; t < steps; t++) {
+        __m256i s1 = _mm256_set1_epi16(soft[(t * 2)]);
+        __m256i s2 = _mm256_set1_epi16(soft[(t * 2) + 1]);
+        __m256i next[4];
+        uint64_t d = 0;
+
+        for (int r = 0; r < 2; r++) {
+            __m256i bm = _mm256_add_epi16(_mm256_xor_si256(s1, e1[r]), _mm256_xor_si256(s2, e2[r]));
+            __m256i cbm = _mm256_sub_epi16(max, bm);
+
+            __m256i m0 = _mm256_add_epi16(metric[r], bm);
+            __m256i m1 = _mm256_add_epi16(metric[r + 2], cbm);
+            __m256i m2 = _mm256_add_epi16(metric[r], cbm);
+            __m256i m3 = _mm256_add_epi16(metric[r + 2], bm);
+
+            __m256i even = _mm256_min_epi16(m0, m1);
+            __m256i odd = _mm256_min_epi16(m2, m3);
+            __m256i de = _mm256_cmpgt_epi16(m0, m1);
+            __m256i dodd = _mm256_cmpgt_epi16(m2, m3);
+
+            /*
+             * Unpack works within 128 bit lanes,
+             * so put the lanes back in state order
+             */
+            __m256i lo = _mm256_unpacklo_epi16(even, odd);
+            __m256i hi = _mm256_unpackhi_epi16(even, odd);
+
+            next[(r * 2)] = _mm256_permute2x128_si256(lo, hi, 0x20);
+            next[(r * 2) + 1] = _mm256_permute2x128_si256(lo, hi, 0x31);
+
+            lo = _mm256_unpacklo_epi16(de, dodd);
+            hi = _mm256_unpackhi_epi16(de, dodd);
+
+            __m256i d0 = _mm256_permute2x128_si256(lo, hi, 0x20);
+            __m256i d1 = _mm256_permute2x128_si256(lo, hi, 0x31);
+            __m256i dec = _mm256_permute4x64_epi64(_mm256_packs_epi16(d0, d1), 0xD8);
+
+            d |= (uint64_t) (uint32_t) _mm256_movemask_epi8(dec) << (r * 32);
+        }
+
+        __m256i norm = _mm256_broadcastw_epi16(_mm256_castsi256_si128(next[0]));
+
+        for (int r = 0; r < 4; r++) {
+            metric[r] = _mm256_sub_epi16(next[r], norm);
+        }
+
+        v->decisions[t] = d;
+    }
+}
+
+#endif
+
+#ifdef VITERBI_NEON
+
+static void acs_neon(struct viterbi *v, const uint8_t *soft, int steps) {
+    static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t w = vld1q_u8(weights);
+    const int16x8_t max = vdupq_n_s16(BM_MAX);
+    int16x8_t metric[8];
+    int16x8_t e1[4], e2[4];
+
+    for (int r = 0; r < 4; r++) {
+        e1[r] = vld1q_s16(&expect1[r * 8]);
+        e2[r] = vld1q_s16(&expect2[r * 8]);
+    }
+
+    metric[0] = vsetq_lane_s16(0, vdupq_n_s16(1000), 0);
+
+    for (int r = 1; r < 8; r++) {
+        metric[r] = vdupq_n_s16(1000);
+    }
+
+    for (int t = 0; t < steps; t++) {
+        int16x8_t s1 = vdupq_n_s16(soft[(t * 2)]);
+        int16x8_t s2 = vdupq_n_s16(soft[(t * 2) + 1]);
+        int16x8_t next[8];
+        uint64_t d = 0;
+
+        for (int r = 0; r < 4; r++) {
+            int16x8_t bm = vaddq_s16(veorq_s16(s1, e1[r]), veorq_s16(s2, e2[r]));
+            int16x8_t cbm = vsubq_s16(max, bm);
+
+            int16x8_t m0 = vaddq_s16(metric[r], bm);
+            int16x8_t m1 = vaddq_s16(metric[r + 4], cbm);
+            int16x8_t m2 = vaddq_s16(metric[r], cbm);
+            int16x8_t m3 = vaddq_s16(metric[r + 4], bm);
+
+            int16x8_t even = vminq_s16(m0, m1);
+            int16x8_t odd = vminq_s16(m2, m3);
+            uint16x8_t de = vcgtq_s16(m0, m1);
+            uint16x8_t dodd = vcgtq_s16(m2, m3);
+
+            next[(r * 2)] = vzip1q_s16(even, odd);
+            next[(r * 2) + 1] = vzip2q_s16(even, odd);
+
+            uint8x16_t dec = vcombine_u8(vmovn_u16(vzip1q_u16(de, dodd)),
+                                         vmovn_u16(vzip2q_u16(de, dodd)));
+
+            dec = vandq_u8(dec, w);
+
+            uint64_t bits = (uint64_t) vaddv_u8(vget_low_u8(dec)) |
+                            ((uint64_t) vaddv_u8(vget_high_u8(dec)) << 8);
+
+            d |= bits << (r * 16);
+        }
+
+        int16x8_t norm = vdupq_laneq_s16(next[0], 0);
+
+        for (int r = 0; r < 8; r++) {
+            metric[r] = vsubq_s16(next[r], norm);
+        }
+
+        v->decisions[t] = d;
+    }
+}
+
+#endif
+
+/*
+ * Scalar first, then in order of preference
+ */
+static const struct {
+    const char *name;
+    SimdLevel level;
+    void (*acs)(struct viterbi *, const uint8_t *, int);
+} variants[] = {
+    { "scalar", SIMD_SCALAR, acs_scalar },
+#if defined(VITERBI_X86)
+    { "sse2", SIMD_SSE2, acs_sse2 },
+    { "avx2", SIMD_AVX2, acs_avx2 },
+#elif defined(VITERBI_NEON)
+    { "neon", SIMD_NEON, acs_neon },
+#endif
+};
+
+#define VARIANTS    (int) (sizeof (variants) / sizeof (variants[0]))
+
+/*
+ * Returns NULL on error
+ */
+struct viterbi *viterbi_create(int max_bits) {
+    struct viterbi *v = calloc(1, sizeof (struct viterbi));
+
+    if (v == NULL)
+        return NULL;
+
+    v->max_bits = max_bits;
+
+    if ((v->decisions = calloc(max_bits + CONV_TAIL, sizeof (uint64_t))) == NULL) {
+        free(v);
+        return NULL;
+    }
+
+    /*
+     * Channels may be created on any thread
+     */
+    pthread_once(&tables_once, tables_make);
+
+    v->acs = variants[0].acs;
+
+    for (int i = 1; i < VARIANTS; i++) {
+        if (dispatch_has(variants[i].level))
+            v->acs = variants[i].acs;
+    }
+
+    return v;
+}
+
+void viterbi_destroy(struct viterbi *v) {
+    if (v == NULL)
+        return;
+
+    free(v->decisions);
+    free(v);
+}
+
+const char *viterbi_variant(const struct viterbi *v) {
+    for (int i = 0; i < VARIANTS; i++) {
+        if (v->acs == variants[i].acs)
+            return variants[i].name;
+    }
+
+    return "unknown";
+}
+
+/*
+ * Decode nbits of data, from the rate 1/2 soft bits of
+ * the data and tail, into bytes most significant bit first
+ *
+ * Returns -1 on error
+ */
+int viterbi_decode(struct viterbi *v, const uint8_t *soft, int nbits, uint8_t *out) {
+    int steps = nbits + CONV_TAIL;
+    int state = 0; // the tail brings the encoder back to 0
+
+    if (nbits > v->max_bits)
+        return -1;
+
+    v->acs(v, soft, steps);
+
+    memset(out, 0, (nbits + 7) / 8);
+
+    for (int t = steps - 1; t >= 0; t--) {
+        int bit = state & 0x1;
+        int d = (v->decisions[t] >> state) & 0x1;
+
+        if (t < nbits)
+            out[t / 8] |= (uint8_t) (bit << (7 - (t % 8)));
+
+        state = (state >> 1) | (d << 5);
+    }
+
+    v->end_state = state;
+
+    return 0;
+}
+
+#define TEST_BYTES  64
+#define TEST_SEED   12345u
+
+/*
+ * Check every variant the CPU can run, whatever the override,
+ * against the scalar one on noisy soft bits at each rate. They
+ * must make the same decisions, so decode the same bits.
+ *
+ * Returns the number of variants that differ
+ */
+int viterbi_selftest(void) {
+    uint8_t data[TEST_BYTES], ref[TEST_BYTES], out[TEST_BYTES];
+    uint8_t coded[(TEST_BYTES * 8 + CONV_TAIL) * 2];
+    uint8_t soft[(TEST_BYTES * 8 + CONV_TAIL) * 2];
+    uint32_t state = TEST_SEED;
+    int failed = 0;
+
+    struct viterbi *v = viterbi_create(TEST_BYTES * 8);
+
+    if (v == NULL)
+        return 1;
+
+    for (int i = 0; i < TEST_BYTES; i++) {
+        state = (state * 1664525u) + 1013904223u;
+        data[i] = (uint8_t) (state >> 24);
+    }
+
+    for (int vi = 1; vi < VARIANTS; vi++) {
+        int differ = 0;
+
+        if (!dispatch_cpu(variants[vi].level))
+            continue;
+
+        for (int rate = FEC_1_2; rate < FEC_RATES; rate++) {
+            int n = conv_encode(data, TEST_BYTES, coded, (CodeRate) rate);
+
+            for (int i = 0; i < n; i++) {
+                state = (state * 1664525u) + 1013904223u;
+
+                int s = (coded[i] ? 200 : 55) + (int) ((state >> 16) % 121) - 60;
+
+                soft[i] = (uint8_t) (((state >> 8) % 40) ? s : (255 - s));
+            }
+
+            conv_depuncture(soft, TEST_BYTES, coded, (CodeRate) rate);
+
+            v->acs = variants[0].acs;
+            viterbi_decode(v, coded, TEST_BYTES * 8, ref);
+            int end = v->end_state;
+
+            v->acs = variants[vi].acs;
+            viterbi_decode(v, coded, TEST_BYTES * 8, out);
+
+            differ += (memcmp(ref, out, TEST_BYTES) != 0) || (end != v->end_state);
+        }
+
+        printf("viterbi  %-8s %s\n", variants[vi].name, (differ == 0) ? "ok" : "FAILED");
+
+        failed += (differ != 0);
+    }
+
+    viterbi_destroy(v);
+
+    return failed;
+}
+
+#ifdef BENCH
+#include <time.h>
+
+#define BENCH_BYTES 1024
+#define BENCH_RUNS  200
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(struct viterbi *v, void (*acs)(struct viterbi *, const uint8_t *, int),
+        const char *name, const uint8_t *soft, const uint8_t *data) {
+    uint8_t out[BENCH_BYTES];
+    int errors = 0;
+
+    v->acs = acs;
+
+    double start = now();
+
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        viterbi_decode(v, soft, BENCH_BYTES * 8, out);
+    }
+
+    double elapsed = now() - start;
+
+    for (int i = 0; i < BENCH_BYTES; i++) {
+        errors += __builtin_popcount(out[i] ^ data[i]);
+    }
+
+    /*
+     * A 2400 baud QPSK channel at rate 1/2 is 2400 bit/s
+     */
+    double rate = (BENCH_RUNS * BENCH_BYTES * 8.0) / elapsed;
+
+    printf("%-8s %8.2f Mbit/s  %6.0f channels/core  %d bit errors\n",
+           name, rate / 1e6, rate / 2400.0, errors);
+}
+
+int main(int argc, char **argv) {
+    uint8_t data[BENCH_BYTES];
+    uint8_t coded[(BENCH_BYTES * 8 + CONV_TAIL) * 2];
+    uint8_t soft[(BENCH_BYTES * 8 + CONV_TAIL) * 2];
+
+    srand(1);
+
+    for (int i = 0; i < BENCH_BYTES; i++) {
+        data[i] = (uint8_t) rand();
+    }
+
+    int n = conv_encode(data, BENCH_BYTES, coded, FEC_1_2);
+
+    /*
+     * Noisy soft bits, with some hard errors
+     */
+    for (int i = 0; i < n; i++) {
+        int s = (coded[i] ? 200 : 55) + (rand() % 81) - 40;
+
+        if ((rand() % 50) == 0)
+            s = 255 - s;
+
+        soft[i] = (uint8_t) s;
+    }
+
+    struct viterbi *v = viterbi_create(BENCH_BYTES * 8);
+
+    printf("Best variant: %s\n", viterbi_variant(v));
+
+    for (int i = 0; i < VARIANTS; i++) {
+        if (dispatch_cpu(variants[i].level))
+            bench(v, variants[i].acs, variants[i].name, soft, data);
+    }
+
+    viterbi_destroy(v);
+
+    return 0;
+}
+#endif
@@ -0,0 +1,52 @@
+/*
+ * viterbi.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+#define CONV_K          7
+#define CONV_STATES     64
+#define CONV_POLY1      0171    // NASA standard, octal
+#define CONV_POLY2      0133
+#define CONV_TAIL       (CONV_K - 1)
+
+#define SOFT_ERASE      128     // soft value of a punctured bit
+
+typedef enum {
+    FEC_1_2,
+    FEC_2_3,
+    FEC_3_4,
+    FEC_RATES
+} CodeRate;
+
+/*
+ * Decoder with room for max_bits (including tail) per
+ * frame. Soft bits are 0 (sure of 0) to 255 (sure of 1).
+ */
+struct viterbi {
+    int max_bits;
+    uint64_t *decisions;    // one bit per state per step
+    void (*acs)(struct viterbi *, const uint8_t *, int);
+    int end_state;
+};
+
+int conv_coded_bits(int, CodeRate);
+int conv_encode(const uint8_t *, int, uint8_t *, CodeRate);
+int conv_depuncture(const uint8_t *, int, uint8_t *, CodeRate);
+
+struct viterbi *viterbi_create(int);
+void viterbi_destroy(struct viterbi *);
+int viterbi_decode(struct viterbi *, const uint8_t *, int, uint8_t *);
+const char *viterbi_variant(const struct viterbi *);
+int viterbi_selftest(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,104 @@
+/*
+ * arena.c
+ *
+ * Arena allocator
+ *
+ * All of a context's memory, including the scratch the
+ * DSP used to put on the stack, comes from one 64 byte
+ * aligned block sized when the context is created. The
+ * hot path then does no allocation at all, and is safe
+ * on the small stacks of worker threads.
+ *
+ * Scratch is taken with a mark and given back with a
+ * reset, and the arena remembers its high water mark.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/*
+ * Returns -1 on error
+ */
+int arena_init(struct arena *a, size_t size) {
+    memset(a, 0, sizeof (struct arena));
+
+    size = arena_round(size);
+
+    if (size == 0)
+        return -1;
+
+    if ((a->base = aligned_alloc(ARENA_ALIGN, size)) == NULL)
+        return -1;
+
+    memset(a->base, 0, size);
+
+    a->size = size;
+    a->owner = 1;
+
+    return 0;
+}
+
+/*
+ * Make child an arena of size bytes taken from parent
+ *
+ * Returns -1 on error
+ */
+int arena_carve(struct arena *parent, struct arena *child, size_t size) {
+    memset(child, 0, sizeof (struct arena));
+
+    size = arena_round(size);
+
+    if ((child->base = arena_alloc(parent, size)) == NULL)
+        return -1;
+
+    child->size = size;
+
+    return 0;
+}
+
+void arena_free(struct arena *a) {
+    if (a->owner)
+        free(a->base);
+
+    memset(a, 0, sizeof (struct arena));
+}
+
+/*
+ * Memory aligned to ARENA_ALIGN, which is only
+ * zero the first time it is handed out
+ *
+ * Returns NULL if the arena is used up
+ */
+void *arena_alloc(struct arena *a, size_t bytes) {
+    bytes = arena_round(bytes);
+
+    if (bytes > (a->size - a->used))
+        return NULL;
+
+    void *p = &a->base[a->used];
+
+    a->used += bytes;
+
+    if (a->used > a->peak)
+        a->peak = a->used;
+
+    return p;
+}
+
+size_t arena_mark(const struct arena *a) {
+    return a->used;
+}
+
+/*
+ * Give back everything allocated since the mark
+ */
+void arena_reset(struct arena *a, size_t mark) {
+    if (mark <= a->used)
+        a->used = mark;
+}
+
+size_t arena_peak(const struct arena *a) {
+    return a->peak;
+}
@@ -0,0 +1,43 @@
+/*
+ * arena.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_ALIGN     64  // cache line, and widest vector
+
+/*
+ * Bump allocator over one block sized at creation.
+ * Allocation never falls back to the heap, it just
+ * returns NULL when the block is used up.
+ */
+struct arena {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    size_t peak;
+    int owner;          // base was allocated by this arena
+};
+
+int arena_init(struct arena *, size_t);
+int arena_carve(struct arena *, struct arena *, size_t);
+void arena_free(struct arena *);
+
+void *arena_alloc(struct arena *, size_t);
+size_t arena_mark(const struct arena *);
+void arena_reset(struct arena *, size_t);
+size_t arena_peak(const struct arena *);
+
+#define arena_round(bytes) ((((size_t) (bytes)) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,65 @@
+/*
+ * capinfo.c
+ *
+ * Describe a capture file, and list its events
+ *
+ * Usage: capinfo file.cap [frame]
+ *
+ * Given a frame, only the events from there on
+ * are listed, found through the index.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "capture.h"
+
+static const char *formats[] = {
+    [CAP_PCM16] = "pcm16",
+    [CAP_IQ16] = "iq16"
+};
+
+static const char *events[] = {
+    [CAP_EVENT_PACKET] = "packet",
+    [CAP_EVENT_SYNC] = "sync"
+};
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s file.cap [frame]\n", argv[0]);
+        return (EXIT_FAILURE);
+    }
+
+    struct capture_reader *rd = capture_open(argv[1]);
+
+    if (rd == NULL) {
+        fprintf(stderr, "%s is not a capture file\n", argv[1]);
+        return (EXIT_FAILURE);
+    }
+
+    const struct capture_header *h = rd->header;
+
+    printf("format %s, %u channels, fs %.1f, rs %.1f, center %.1f\n",
+           (h->format <= CAP_IQ16) ? formats[h->format] : "unknown",
+           h->channels, h->fs, h->rs, h->center);
+    printf("start %" PRId64 ".%09" PRId64 ", %" PRIu64 " frames, %.1f seconds\n",
+           h->start_ns / 1000000000, h->start_ns % 1000000000, rd->frames, rd->frames / h->fs);
+    printf("%" PRIu64 " chunks of %u frames, %" PRIu64 " events%s\n",
+           rd->chunks, h->chunk_frames, rd->nevents,
+           (h->index_offset == 0) ? ", not closed, index rebuilt" : "");
+
+    uint64_t from = (argc > 2) ? strtoull(argv[2], NULL, 0) : 0;
+    long first = capture_event_find(rd, from);
+
+    for (uint64_t i = (first < 0) ? rd->nevents : (uint64_t) first; i < rd->nevents; i++) {
+        const struct capture_event *e = &rd->events[i];
+
+        printf("%12" PRIu64 " %10.4f %-6s %g\n", e->frame, e->frame / h->fs,
+               (e->type <= CAP_EVENT_SYNC) ? events[e->type] : "?", e->value);
+    }
+
+    capture_reader_close(rd);
+
+    return (EXIT_SUCCESS);
+}
@@ -0,0 +1,459 @@
+/*
+ * capture.c
+ *
+ * Chunked capture files
+ *
+ * A capture is a header giving the rates and sample
+ * format, then fixed size chunks of samples, then an
+ * index of the chunk offsets and of events such as
+ * packets. The chunks being fixed size, a reader can
+ * find any frame without the index, so a capture cut
+ * short by a crash is still readable.
+ *
+ * The reader maps the file, so a tool can jump to an
+ * event hours in and touch only the pages it reads.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+
+/*
+ * Returns NULL on error
+ */
+struct capture *capture_create(const char *filename, const struct capture_info *info) {
+    if (info->channels < 1 || info->chunk_frames < 0)
+        return NULL;
+
+    struct capture *cap = calloc(1, sizeof (struct capture));
+
+    if (cap == NULL)
+        return NULL;
+
+    struct capture_header *h = &cap->header;
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    memcpy(h->magic, CAPTURE_MAGIC, sizeof (h->magic));
+    h->version = CAPTURE_VERSION;
+    h->format = info->format;
+    h->channels = info->channels;
+    h->chunk_frames = (info->chunk_frames > 0) ? info->chunk_frames : CAPTURE_CHUNK;
+    h->fs = info->fs;
+    h->rs = info->rs;
+    h->center = info->center;
+    h->start_ns = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+    cap->chunk = calloc((size_t) h->chunk_frames * h->channels, sizeof (int16_t));
+
+    if (cap->chunk == NULL || (cap->fout = fopen(filename, "wb")) == NULL) {
+        free(cap->chunk);
+        free(cap);
+        return NULL;
+    }
+
+    if (fwrite(h, sizeof (struct capture_header), 1, cap->fout) != 1) {
+        fclose(cap->fout);
+        free(cap->chunk);
+        free(cap);
+        return NULL;
+    }
+
+    return cap;
+}
+
+static int chunk_flush(struct capture *cap) {
+    const struct capture_header *h = &cap->header;
+
+    if (cap->fill == 0)
+        return 0;
+
+    if (cap->chunks == cap->max_chunks) {
+        uint64_t max = (cap->max_chunks == 0) ? 64 : (cap->max_chunks * 2);
+        uint64_t *offsets = realloc(cap->offsets, max * sizeof (uint64_t));
+
+        if (offsets == NULL)
+            return -1;
+
+        cap->offsets = offsets;
+        cap->max_chunks = max;
+    }
+
+    struct capture_chunk c = {
+        .magic = CHUNK_MAGIC,
+        .frames = (uint32_t) cap->fill,
+        .first = cap->chunks * h->chunk_frames
+    };
+
+    size_t values = (size_t) h->chunk_frames * h->channels;
+
+    memset(&cap->chunk[(size_t) cap->fill * h->channels], 0,
+            (values - ((size_t) cap->fill * h->channels)) * sizeof (int16_t));
+
+    cap->offsets[cap->chunks] = (uint64_t) ftell(cap->fout);
+
+    if (fwrite(&c, sizeof (struct capture_chunk), 1, cap->fout) != 1 ||
+            fwrite(cap->chunk, sizeof (int16_t), values, cap->fout) != values)
+        return -1;
+
+    cap->chunks++;
+    cap->fill = 0;
+
+    return 0;
+}
+
+/*
+ * Append frames, each of channels int16 values
+ *
+ * Returns -1 on error
+ */
+int capture_write(struct capture *cap, const int16_t samples[], int frames) {
+    const int channels = cap->header.channels;
+    const int chunk_frames = cap->header.chunk_frames;
+
+    while (frames > 0) {
+        int count = chunk_frames - cap->fill;
+
+        if (count > frames)
+            count = frames;
+
+        memcpy(&cap->chunk[(size_t) cap->fill * channels], samples,
+                (size_t) count * channels * sizeof (int16_t));
+
+        cap->fill += count;
+        cap->header.frames += count;
+        samples += (size_t) count * channels;
+        frames -= count;
+
+        if (cap->fill == chunk_frames && chunk_flush(cap) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Note an event at a frame, in any order
+ *
+ * Returns -1 on error
+ */
+int capture_mark(struct capture *cap, uint64_t frame, CaptureEvent type, float value) {
+    if (cap->nevents == cap->max_events) {
+        uint64_t max = (cap->max_events == 0) ? 64 : (cap->max_events * 2);
+        struct capture_event *events = realloc(cap->events, max * sizeof (struct capture_event));
+
+        if (events == NULL)
+            return -1;
+
+        cap->events = events;
+        cap->max_events = max;
+    }
+
+    cap->events[cap->nevents].frame = frame;
+    cap->events[cap->nevents].type = type;
+    cap->events[cap->nevents].value = value;
+    cap->nevents++;
+
+    return 0;
+}
+
+static int event_compare(const void *a, const void *b) {
+    const struct capture_event *ea = a;
+    const struct capture_event *eb = b;
+
+    return (ea->frame > eb->frame) - (ea->frame < eb->frame);
+}
+
+/*
+ * Write the last chunk and the index, then fill in the header
+ *
+ * Returns -1 on error
+ */
+int capture_close(struct capture *cap) {
+    int status = 0;
+
+    if (cap == NULL)
+        return -1;
+
+    if (chunk_flush(cap) != 0)
+        status = -1;
+
+    qsort(cap->events, cap->nevents, sizeof (struct capture_event), event_compare);
+
+    struct capture_index index = {
+        .chunks = cap->chunks,
+        .events = cap->nevents
+    };
+
+    memcpy(index.magic, INDEX_MAGIC, sizeof (index.magic));
+
+    /*
+     * Keep the index arrays aligned in the map
+     */
+    static const uint8_t pad[8];
+    long at = ftell(cap->fout);
+
+    if (status == 0 && (at % 8) != 0 && fwrite(pad, 1, 8 - (at % 8), cap->fout) != (size_t) (8 - (at % 8)))
+        status = -1;
+
+    if (status == 0) {
+        cap->header.index_offset = (uint64_t) ftell(cap->fout);
+
+        if (fwrite(&index, sizeof (struct capture_index), 1, cap->fout) != 1 ||
+                fwrite(cap->offsets, sizeof (uint64_t), cap->chunks, cap->fout) != cap->chunks ||
+                fwrite(cap->events, sizeof (struct capture_event), cap->nevents, cap->fout) != cap->nevents ||
+                fseek(cap->fout, 0L, SEEK_SET) != 0 ||
+                fwrite(&cap->header, sizeof (struct capture_header), 1, cap->fout) != 1)
+            status = -1;
+    }
+
+    if (fclose(cap->fout) != 0)
+        status = -1;
+
+    free(cap->chunk);
+    free(cap->offsets);
+    free(cap->events);
+    free(cap);
+
+    return status;
+}
+
+/*
+ * Take the chunks and events from the index at, once every
+ * count is bounded by the file and every chunk it points
+ * to is whole, with no more than chunk_frames frames
+ *
+ * Returns -1 if the index cannot be used
+ */
+static int index_load(struct capture_reader *rd, uint64_t at) {
+    const struct capture_header *h = rd->header;
+
+    if ((at % 8) != 0 || at < sizeof (struct capture_header) || at > rd->size ||
+            (rd->size - at) < sizeof (struct capture_index))
+        return -1;
+
+    const struct capture_index *index = (const struct capture_index *) &rd->map[at];
+    uint64_t room = rd->size - at - sizeof (struct capture_index);
+
+    if (memcmp(index->magic, INDEX_MAGIC, sizeof (index->magic)) != 0 ||
+            index->chunks > (room / sizeof (uint64_t)))
+        return -1;
+
+    room -= index->chunks * sizeof (uint64_t);
+
+    if (index->events > (room / sizeof (struct capture_event)))
+        return -1;
+
+    const uint64_t *offsets = (const uint64_t *) &rd->map[at + sizeof (struct capture_index)];
+    uint64_t frames = 0;
+
+    for (uint64_t n = 0; n < index->chunks; n++) {
+        if (offsets[n] < sizeof (struct capture_header) || offsets[n] > rd->size ||
+                (rd->size - offsets[n]) < rd->chunk_size)
+            return -1;
+
+        const struct capture_chunk *c = (const struct capture_chunk *) &rd->map[offsets[n]];
+
+        if (c->magic != CHUNK_MAGIC || c->frames > h->chunk_frames)
+            return -1;
+
+        frames += c->frames;
+    }
+
+    if ((rd->offsets = malloc((index->chunks + 1) * sizeof (uint64_t))) == NULL)
+        return -1;
+
+    memcpy(rd->offsets, offsets, index->chunks * sizeof (uint64_t));
+
+    rd->chunks = index->chunks;
+    rd->frames = frames;
+    rd->events = (const struct capture_event *) &offsets[index->chunks];
+    rd->nevents = index->events;
+
+    return 0;
+}
+
+/*
+ * Find the chunks and events, from the index when the
+ * capture was closed and the index holds up, or by
+ * walking the chunk headers
+ */
+static int reader_index(struct capture_reader *rd) {
+    const struct capture_header *h = rd->header;
+
+    if (h->index_offset != 0 && index_load(rd, h->index_offset) == 0)
+        return 0;
+
+    uint64_t max = (rd->size - sizeof (struct capture_header)) / rd->chunk_size;
+    uint64_t at = sizeof (struct capture_header);
+
+    if ((rd->offsets = malloc((max + 1) * sizeof (uint64_t))) == NULL)
+        return -1;
+
+    while ((rd->size - at) >= rd->chunk_size) {
+        const struct capture_chunk *c = (const struct capture_chunk *) &rd->map[at];
+
+        if (c->magic != CHUNK_MAGIC || c->frames > h->chunk_frames)
+            break;
+
+        rd->offsets[rd->chunks++] = at;
+        rd->frames += c->frames;
+        at += rd->chunk_size;
+    }
+
+    return 0;
+}
+
+/*
+ * Returns NULL on error
+ */
+struct capture_reader *capture_open(const char *filename) {
+    struct capture_reader *rd = calloc(1, sizeof (struct capture_reader));
+    struct stat st;
+    int fd;
+
+    if (rd == NULL)
+        return NULL;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) {
+        free(rd);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof (struct capture_header)) {
+        close(fd);
+        free(rd);
+        return NULL;
+    }
+
+    rd->size = (size_t) st.st_size;
+    rd->map = mmap(NULL, rd->size, PROT_READ, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (rd->map == MAP_FAILED) {
+        free(rd);
+        return NULL;
+    }
+
+    rd->header = (const struct capture_header *) rd->map;
+
+    /*
+     * A chunk too big to size in memory cannot be in the file
+     */
+    const uint64_t values = (uint64_t) rd->header->chunk_frames * rd->header->channels;
+
+    if (memcmp(rd->header->magic, CAPTURE_MAGIC, sizeof (rd->header->magic)) != 0 ||
+            rd->header->version != CAPTURE_VERSION ||
+            rd->header->channels < 1 || rd->header->chunk_frames < 1 ||
+            values > ((SIZE_MAX - sizeof (struct capture_chunk)) / sizeof (int16_t))) {
+        capture_reader_close(rd);
+        return NULL;
+    }
+
+    rd->chunk_size = sizeof (struct capture_chunk) + (size_t) values * sizeof (int16_t);
+
+    if (reader_index(rd) != 0) {
+        capture_reader_close(rd);
+        return NULL;
+    }
+
+    return rd;
+}
+
+void capture_reader_close(struct capture_reader *rd) {
+    if (rd == NULL)
+        return;
+
+    if (rd->map != NULL && rd->map != MAP_FAILED)
+        munmap((void *) rd->map, rd->size);
+
+    free(rd->offsets);
+    free(rd);
+}
+
+/*
+ * The samples of chunk n, in place in the map, and
+ * the number of frames in it, which the reader has
+ * checked are within the file
+ *
+ * Returns NULL past the end
+ */
+const int16_t *capture_chunk(const struct capture_reader *rd, uint64_t n, int *frames) {
+    if (n >= rd->chunks)
+        return NULL;
+
+    const struct capture_chunk *c = (const struct capture_chunk *) &rd->map[rd->offsets[n]];
+
+    *frames = (int) c->frames;
+
+    return (const int16_t *) &c[1];
+}
+
+/*
+ * Copy up to count frames starting at frame first
+ *
+ * Returns the number of frames copied, 0 at the end
+ */
+long capture_read(const struct capture_reader *rd, uint64_t first, int16_t out[], int count) {
+    const uint64_t chunk_frames = rd->header->chunk_frames;
+    const int channels = rd->header->channels;
+    long done = 0;
+
+    while (done < count) {
+        uint64_t frame = first + done;
+        int frames;
+        const int16_t *samples = capture_chunk(rd, frame / chunk_frames, &frames);
+
+        if (samples == NULL)
+            break;
+
+        int at = (int) (frame % chunk_frames);
+
+        if (at >= frames)
+            break;
+
+        int n = frames - at;
+
+        if (n > (count - done))
+            n = count - done;
+
+        memcpy(&out[(size_t) done * channels], &samples[(size_t) at * channels],
+                (size_t) n * channels * sizeof (int16_t));
+
+        done += n;
+    }
+
+    return done;
+}
+
+/*
+ * Returns the first event at or after frame,
+ * or -1 if there is none
+ */
+long capture_event_find(const struct capture_reader *rd, uint64_t frame) {
+    uint64_t lo = 0;
+    uint64_t hi = rd->nevents;
+
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+
+        if (rd->events[mid].frame < frame)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return (lo < rd->nevents) ? (long) lo : -1;
+}
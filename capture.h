@@ -0,0 +1,133 @@
+/*
+ * capture.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CAPTURE_MAGIC   "QPSKCAP1"
+#define CHUNK_MAGIC     0x4B4E4843  // "CHNK"
+#define INDEX_MAGIC     "QPSKIDX1"
+#define CAPTURE_VERSION 1
+#define CAPTURE_CHUNK   65536       // default frames per chunk
+
+typedef enum {
+    CAP_PCM16,          // int16 audio, channels interleaved
+    CAP_IQ16            // int16 I/Q pairs at baseband
+} CaptureFormat;
+
+typedef enum {
+    CAP_EVENT_PACKET,   // a packet was sent here
+    CAP_EVENT_SYNC      // a sync word was detected here
+} CaptureEvent;
+
+/*
+ * File header, little endian as written. index_offset
+ * is 0 until the capture is closed, and a reader then
+ * rebuilds the index from the chunk headers.
+ */
+struct capture_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t format;        // CaptureFormat
+    uint32_t channels;      // int16 values per frame
+    uint32_t chunk_frames;
+    float fs;
+    float rs;
+    float center;
+    uint32_t reserved;
+    int64_t start_ns;       // wall clock of the first frame
+    uint64_t frames;        // total
+    uint64_t index_offset;
+};
+
+/*
+ * Each chunk is this, then chunk_frames frames,
+ * the last one padded with zero
+ */
+struct capture_chunk {
+    uint32_t magic;
+    uint32_t frames;        // valid frames
+    uint64_t first;         // frame number of the first
+};
+
+struct capture_event {
+    uint64_t frame;
+    uint32_t type;          // CaptureEvent
+    float value;            // such as the sync strength
+};
+
+/*
+ * The index follows the last chunk, then the
+ * chunk offsets and the events
+ */
+struct capture_index {
+    char magic[8];
+    uint64_t chunks;
+    uint64_t events;
+};
+
+struct capture_info {
+    CaptureFormat format;
+    int channels;
+    int chunk_frames;       // 0 for CAPTURE_CHUNK
+    float fs;
+    float rs;
+    float center;
+};
+
+struct capture {
+    FILE *fout;
+    struct capture_header header;
+
+    int16_t *chunk;
+    int fill;               // frames in the chunk
+
+    uint64_t *offsets;
+    uint64_t chunks;
+    uint64_t max_chunks;
+
+    struct capture_event *events;
+    uint64_t nevents;
+    uint64_t max_events;
+};
+
+/*
+ * The reader maps the whole file
+ */
+struct capture_reader {
+    const uint8_t *map;
+    size_t size;
+
+    const struct capture_header *header;
+    size_t chunk_size;      // bytes including its header
+
+    uint64_t *offsets;
+    uint64_t chunks;
+    uint64_t frames;
+
+    const struct capture_event *events;
+    uint64_t nevents;
+};
+
+struct capture *capture_create(const char *, const struct capture_info *);
+int capture_write(struct capture *, const int16_t [], int);
+int capture_mark(struct capture *, uint64_t, CaptureEvent, float);
+int capture_close(struct capture *);
+
+struct capture_reader *capture_open(const char *);
+void capture_reader_close(struct capture_reader *);
+const int16_t *capture_chunk(const struct capture_reader *, uint64_t, int *);
+long capture_read(const struct capture_reader *, uint64_t, int16_t [], int);
+long capture_event_find(const struct capture_reader *, uint64_t);
+
+#ifdef __cplusplus
+}
+#endif
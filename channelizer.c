@@ -0,0 +1,210 @@
+/*
+ * channelizer.c
+ *
+ * Polyphase FFT Channelizer
+ *
+ * A wideband SDR stream carrying many narrowband channels
+ * is split with one shared prototype low pass filter and
+ * one FFT per output sample time. Rather than a mixer and
+ * a full rate filter for every channel, the cost per
+ * channel per output sample is the CHANNELIZER_TAPS
+ * multiplies and the O(log M) of the FFT.
+ *
+ * Each output is already at baseband, at fs / decim,
+ * which must be the sample rate of the channel profile.
+ *
+ * Reference:
+ *
+ * "Multirate Signal Processing for Communication
+ * Systems", fredric j. harris
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "qpsk.h"
+#include "channelizer.h"
+
+/*
+ * Hamming windowed sinc, cut off at half the
+ * channel spacing, with unity gain at DC
+ */
+static void prototype_make(float coeffs[], int length, int nchan) {
+    float scale = 0.0f;
+    float fc = 0.5f / nchan;
+
+    for (int i = 0; i < length; i++) {
+        float x = i - (length - 1) / 2.0f;
+        float h = (x == 0.0f) ? (2.0f * fc) : sinf(TAU * fc * x) / (M_PI * x);
+
+        h *= 0.54f - 0.46f * cosf(TAU * i / (length - 1));
+
+        coeffs[length - 1 - i] = h; // time reversed
+        scale += h;
+    }
+
+    for (int i = 0; i < length; i++) {
+        coeffs[i] /= scale;
+    }
+}
+
+/*
+ * nchan must be a power of two, and decim either
+ * nchan (critically sampled) or nchan / 2 (oversampled)
+ *
+ * Returns NULL on error
+ */
+struct channelizer *channelizer_create(float fs, int nchan, int decim) {
+    if (nchan < 2 || (decim != nchan && decim != (nchan / 2)))
+        return NULL;
+
+    struct channelizer *chz = calloc(1, sizeof (struct channelizer));
+
+    if (chz == NULL)
+        return NULL;
+
+    chz->fs = fs;
+    chz->nchan = nchan;
+    chz->decim = decim;
+    chz->length = nchan * CHANNELIZER_TAPS;
+
+    chz->plan = fft_plan_create(nchan);
+    chz->coeffs = malloc(chz->length * sizeof (float));
+    chz->history = calloc(chz->length * 2, sizeof (complex float));
+    chz->branch = calloc(nchan, sizeof (complex float));
+    chz->acc = calloc(nchan, sizeof (complex float));
+    chz->chans = calloc(nchan, sizeof (struct channel *));
+    chz->frames = calloc(nchan, sizeof (complex float *));
+    chz->fill = calloc(nchan, sizeof (int));
+
+    if (chz->plan == NULL || chz->coeffs == NULL || chz->history == NULL ||
+            chz->branch == NULL || chz->acc == NULL || chz->chans == NULL ||
+            chz->frames == NULL || chz->fill == NULL) {
+        channelizer_destroy(chz);
+        return NULL;
+    }
+
+    prototype_make(chz->coeffs, chz->length, nchan);
+
+    return chz;
+}
+
+/*
+ * The channels are owned by the caller
+ */
+void channelizer_destroy(struct channelizer *chz) {
+    if (chz == NULL)
+        return;
+
+    if (chz->frames != NULL) {
+        for (int m = 0; m < chz->nchan; m++) {
+            free(chz->frames[m]);
+        }
+    }
+
+    fft_plan_destroy(chz->plan);
+    free(chz->coeffs);
+    free(chz->history);
+    free(chz->branch);
+    free(chz->acc);
+    free(chz->chans);
+    free(chz->frames);
+    free(chz->fill);
+    free(chz);
+}
+
+/*
+ * Feed output channel m into a demodulator, or
+ * detach it with NULL.
+ *
+ * Returns -1 on error
+ */
+int channelizer_attach(struct channelizer *chz, int m, struct channel *chan) {
+    if (m < 0 || m >= chz->nchan)
+        return -1;
+
+    free(chz->frames[m]);
+    chz->frames[m] = NULL;
+    chz->chans[m] = NULL;
+    chz->fill[m] = 0;
+
+    if (chan == NULL)
+        return 0;
+
+    if (fabsf(chan->profile->fs - (chz->fs / chz->decim)) > 0.5f)
+        return -1;
+
+    if ((chz->frames[m] = malloc(chan->profile->frame_size * sizeof (complex float))) == NULL)
+        return -1;
+
+    chz->chans[m] = chan;
+
+    return 0;
+}
+
+/*
+ * One output sample for every channel, from
+ * the latest length input samples
+ */
+static void channelizer_output(struct channelizer *chz) {
+    const int nchan = chz->nchan;
+    const complex float *win = &chz->history[chz->pos];
+    complex float *branch = chz->branch;
+    complex float *acc = chz->acc;
+
+    for (int i = 0; i < nchan; i++) {
+        acc[i] = 0.0f;
+    }
+
+    /*
+     * Polyphase partial sums, each branch taking
+     * every nchan'th tap of the prototype
+     */
+    for (int p = 0; p < chz->length; p += nchan) {
+        for (int i = 0; i < nchan; i++) {
+            acc[i] += win[p + i] * chz->coeffs[p + i];
+        }
+    }
+
+    /*
+     * The newest sample is at the end of the window, so
+     * branch k is acc[M - 1 - k]. Rotating by the input
+     * phase brings each channel down to baseband.
+     */
+    for (int k = 0; k < nchan; k++) {
+        branch[(k - chz->phase + nchan) % nchan] = acc[nchan - 1 - k];
+    }
+
+    ifft_execute(chz->plan, branch);
+
+    for (int m = 0; m < nchan; m++) {
+        struct channel *chan = chz->chans[m];
+
+        if (chan == NULL)
+            continue;
+
+        chz->frames[m][chz->fill[m]++] = branch[m];
+
+        if (chz->fill[m] == chan->profile->frame_size) {
+            rx_baseband_frame(chan, chz->frames[m]);
+            chz->fill[m] = 0;
+        }
+    }
+}
+
+void channelizer_process(struct channelizer *chz, const complex float in[], int length) {
+    for (int i = 0; i < length; i++) {
+        chz->history[chz->pos] = in[i];
+        chz->history[chz->pos + chz->length] = in[i];
+
+        chz->pos = (chz->pos + 1) % chz->length;
+
+        if (++chz->count == chz->decim) {
+            chz->count = 0;
+            channelizer_output(chz);
+        }
+
+        chz->phase = (chz->phase + 1) % chz->nchan;
+    }
+}
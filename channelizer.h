@@ -0,0 +1,54 @@
+/*
+ * channelizer.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <complex.h>
+
+#include "modem.h"
+#include "algorithms/fft.h"
+
+#define CHANNELIZER_TAPS    8   // prototype taps per polyphase branch
+
+/*
+ * Polyphase filter bank splitting one wideband complex
+ * stream into nchan channels spaced fs / nchan apart.
+ *
+ * Channel m is centered on m * fs / nchan, with the
+ * upper half of the bins being negative frequencies.
+ */
+struct channelizer {
+    float fs;               // wideband input sample rate
+    int nchan;              // M channels, the FFT size
+    int decim;              // M (critical) or M / 2 (2x oversampled)
+    int length;             // prototype length M * CHANNELIZER_TAPS
+
+    struct fft_plan *plan;
+    float *coeffs;          // prototype, time reversed
+
+    complex float *history; // mirrored delay line, 2 * length
+    complex float *branch;  // M polyphase branch sums
+    complex float *acc;
+    int pos;
+    int count;
+    int phase;              // input sample index modulo M
+
+    struct channel **chans; // demodulator per channel, or NULL
+    complex float **frames; // output frame per attached channel
+    int *fill;
+};
+
+struct channelizer *channelizer_create(float, int, int);
+void channelizer_destroy(struct channelizer *);
+int channelizer_attach(struct channelizer *, int, struct channel *);
+void channelizer_process(struct channelizer *, const complex float [], int);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,469 @@
+/*
+ * costas_bank.c
+ *
+ * Structure of Arrays Costas loop bank
+ *
+ * The loop recursion is serial in time, so a single
+ * channel can't be vectorized. Across channels though
+ * every loop is independent, so the phase detector, loop
+ * advance, phase wrap and frequency limit are done for
+ * 8 (AVX2) or 16 (AVX-512) channels per instruction.
+ *
+ * The wrap and limit are branchless, and the derotation
+ * uses a polynomial sin/cos so that every variant, scalar
+ * included, computes the same thing.
+ *
+ * It is the loop kernel alone, with the QPSK detector and
+ * fixed gains. The receivers keep to costas_loop.c, for the
+ * mapper detectors, lock detector and gear shift, which
+ * the bank does not have.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define COSTAS_X86
+#endif
+
+#include "qpsk.h"
+#include "costas_bank.h"
+#include "dispatch.h"
+
+// Cephes single precision sin/cos
+
+#define DP1     1.5703125f
+#define DP2     4.837512969970703125e-4f
+#define DP3     7.54978995489188216e-8f
+#define FOPI    0.63661977236758134f     // 2 / pi
+
+#define S1      -1.6666654611e-1f
+#define S2      8.3321608736e-3f
+#define S3      -1.9515295891e-4f
+
+#define C1      4.166664568298827e-2f
+#define C2      -1.388731625493765e-3f
+#define C3      2.443315711809948e-5f
+
+static float *lane_alloc(int width) {
+    float *p = aligned_alloc(64, width * sizeof (float));
+
+    if (p != NULL)
+        memset(p, 0, width * sizeof (float));
+
+    return p;
+}
+
+/*
+ * Quadrant reduced sin/cos, good to about 1e-7
+ * over the +/- 2 pi range the loop phase lives in
+ */
+static inline void sincos_poly(float x, float *sn, float *cs) {
+    float q = nearbyintf(x * FOPI);
+    int quad = (int) q;
+
+    float r = ((x - q * DP1) - q * DP2) - q * DP3;
+    float z = r * r;
+
+    float s = r + r * z * (S1 + z * (S2 + z * S3));
+    float c = 1.0f - 0.5f * z + z * z * (C1 + z * (C2 + z * C3));
+
+    float ts = (quad & 1) ? c : s;
+    float tc = (quad & 1) ? s : c;
+
+    *sn = (quad & 2) ? -ts : ts;
+    *cs = ((quad + 1) & 2) ? -tc : tc;
+}
+
+static void step_scalar(struct costas_bank *b) {
+    for (int i = 0; i < b->width; i++) {
+        float s, c;
+
+        sincos_poly(b->d_phase[i], &s, &c);
+
+        /*
+         * sample * cmplxconj(phase)
+         */
+        float yr = b->in_re[i] * c + b->in_im[i] * s;
+        float yi = b->in_im[i] * c - b->in_re[i] * s;
+
+        b->out_re[i] = yr;
+        b->out_im[i] = yi;
+
+        // phase_detector()
+
+        float error = (yr > 0.0f ? 1.0f : -1.0f) * yi -
+                      (yi > 0.0f ? 1.0f : -1.0f) * yr;
+
+        b->d_error[i] = error;
+
+        // advance_loop()
+
+        float freq = b->d_freq[i] + b->d_beta[i] * error;
+        float phase = b->d_phase[i] + freq + b->d_alpha[i] * error;
+
+        // phase_wrap()
+
+        phase -= (float) TAU * truncf(phase / (float) TAU);
+
+        // frequency_limit()
+
+        b->d_freq[i] = fminf(fmaxf(freq, b->d_min_freq[i]), b->d_max_freq[i]);
+        b->d_phase[i] = phase;
+    }
+}
+
+#ifdef COSTAS_X86
+
+__attribute__((target("avx2,fma")))
+static void step_avx2(struct costas_bank *b) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 mone = _mm256_set1_ps(-1.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 tau = _mm256_set1_ps((float) TAU);
+    const __m256 itau = _mm256_set1_ps((float) (1.0 / TAU));
+    const __m256i ione = _mm256_set1_epi32(1);
+    const __m256i itwo = _mm256_set1_epi32(2);
+
+    for (int i = 0; i < b->width; i += 8) {
+        __m256 phase = _mm256_load_ps(&b->d_phase[i]);
+
+        // sincos_poly()
+
+        __m256 q = _mm256_round_ps(_mm256_mul_ps(phase, _mm256_set1_ps(FOPI)),
+                                   _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256i quad = _mm256_cvtps_epi32(q);
+
+        __m256 r = _mm256_fnmadd_ps(q, _mm256_set1_ps(DP1), phase);
+        r = _mm256_fnmadd_ps(q, _mm256_set1_ps(DP2), r);
+        r = _mm256_fnmadd_ps(q, _mm256_set1_ps(DP3), r);
+
+        __m256 z = _mm256_mul_ps(r, r);
+
+        __m256 ps = _mm256_fmadd_ps(z, _mm256_set1_ps(S3), _mm256_set1_ps(S2));
+        ps = _mm256_fmadd_ps(z, ps, _mm256_set1_ps(S1));
+        __m256 s = _mm256_fmadd_ps(_mm256_mul_ps(r, z), ps, r);
+
+        __m256 pc = _mm256_fmadd_ps(z, _mm256_set1_ps(C3), _mm256_set1_ps(C2));
+        pc = _mm256_fmadd_ps(z, pc, _mm256_set1_ps(C1));
+        __m256 c = _mm256_fmadd_ps(_mm256_mul_ps(z, z), pc,
+                                   _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, one));
+
+        __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quad, ione), ione));
+        __m256 ts = _mm256_blendv_ps(s, c, swap);
+        __m256 tc = _mm256_blendv_ps(c, s, swap);
+
+        __m256 ssign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(quad, itwo), 30));
+        __m256 csign = _mm256_castsi256_ps(_mm256_slli_epi32(
+                           _mm256_and_si256(_mm256_add_epi32(quad, ione), itwo), 30));
+
+        s = _mm256_xor_ps(ts, ssign);
+        c = _mm256_xor_ps(tc, csign);
+
+        // sample * cmplxconj(phase)
+
+        __m256 re = _mm256_load_ps(&b->in_re[i]);
+        __m256 im = _mm256_load_ps(&b->in_im[i]);
+
+        __m256 yr = _mm256_fmadd_ps(re, c, _mm256_mul_ps(im, s));
+        __m256 yi = _mm256_fmsub_ps(im, c, _mm256_mul_ps(re, s));
+
+        _mm256_store_ps(&b->out_re[i], yr);
+        _mm256_store_ps(&b->out_im[i], yi);
+
+        // phase_detector()
+
+        __m256 sr = _mm256_blendv_ps(mone, one, _mm256_cmp_ps(yr, zero, _CMP_GT_OQ));
+        __m256 si = _mm256_blendv_ps(mone, one, _mm256_cmp_ps(yi, zero, _CMP_GT_OQ));
+        __m256 error = _mm256_fmsub_ps(sr, yi, _mm256_mul_ps(si, yr));
+
+        _mm256_store_ps(&b->d_error[i], error);
+
+        // advance_loop()
+
+        __m256 freq = _mm256_fmadd_ps(_mm256_load_ps(&b->d_beta[i]), error,
+                                      _mm256_load_ps(&b->d_freq[i]));
+        phase = _mm256_add_ps(phase, _mm256_fmadd_ps(_mm256_load_ps(&b->d_alpha[i]), error, freq));
+
+        // phase_wrap()
+
+        __m256 turns = _mm256_round_ps(_mm256_mul_ps(phase, itau),
+                                       _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        phase = _mm256_fnmadd_ps(tau, turns, phase);
+
+        // frequency_limit()
+
+        freq = _mm256_max_ps(freq, _mm256_load_ps(&b->d_min_freq[i]));
+        freq = _mm256_min_ps(freq, _mm256_load_ps(&b->d_max_freq[i]));
+
+        _mm256_store_ps(&b->d_freq[i], freq);
+        _mm256_store_ps(&b->d_phase[i], phase);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void step_avx512(struct costas_bank *b) {
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 mone = _mm512_set1_ps(-1.0f);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 tau = _mm512_set1_ps((float) TAU);
+    const __m512 itau = _mm512_set1_ps((float) (1.0 / TAU));
+    const __m512i ione = _mm512_set1_epi32(1);
+    const __m512i itwo = _mm512_set1_epi32(2);
+
+    for (int i = 0; i < b->width; i += 16) {
+        __m512 phase = _mm512_load_ps(&b->d_phase[i]);
+
+        // sincos_poly()
+
+        __m512 q = _mm512_roundscale_ps(_mm512_mul_ps(phase, _mm512_set1_ps(FOPI)),
+                                        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m512i quad = _mm512_cvtps_epi32(q);
+
+        __m512 r = _mm512_fnmadd_ps(q, _mm512_set1_ps(DP1), phase);
+        r = _mm512_fnmadd_ps(q, _mm512_set1_ps(DP2), r);
+        r = _mm512_fnmadd_ps(q, _mm512_set1_ps(DP3), r);
+
+        __m512 z = _mm512_mul_ps(r, r);
+
+        __m512 ps = _mm512_fmadd_ps(z, _mm512_set1_ps(S3), _mm512_set1_ps(S2));
+        ps = _mm512_fmadd_ps(z, ps, _mm512_set1_ps(S1));
+        __m512 s = _mm512_fmadd_ps(_mm512_mul_ps(r, z), ps, r);
+
+        __m512 pc = _mm512_fmadd_ps(z, _mm512_set1_ps(C3), _mm512_set1_ps(C2));
+        pc = _mm512_fmadd_ps(z, pc, _mm512_set1_ps(C1));
+        __m512 c = _mm512_fmadd_ps(_mm512_mul_ps(z, z), pc,
+                                   _mm512_fnmadd_ps(_mm512_set1_ps(0.5f), z, one));
+
+        __mmask16 swap = _mm512_test_epi32_mask(quad, ione);
+        __m512 ts = _mm512_mask_blend_ps(swap, s, c);
+        __m512 tc = _mm512_mask_blend_ps(swap, c, s);
+
+        __m512i ssign = _mm512_slli_epi32(_mm512_and_si512(quad, itwo), 30);
+        __m512i csign = _mm512_slli_epi32(_mm512_and_si512(_mm512_add_epi32(quad, ione), itwo), 30);
+
+        s = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(ts), ssign));
+        c = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(tc), csign));
+
+        // sample * cmplxconj(phase)
+
+        __m512 re = _mm512_load_ps(&b->in_re[i]);
+        __m512 im = _mm512_load_ps(&b->in_im[i]);
+
+        __m512 yr = _mm512_fmadd_ps(re, c, _mm512_mul_ps(im, s));
+        __m512 yi = _mm512_fmsub_ps(im, c, _mm512_mul_ps(re, s));
+
+        _mm512_store_ps(&b->out_re[i], yr);
+        _mm512_store_ps(&b->out_im[i], yi);
+
+        // phase_detector()
+
+        __m512 sr = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(yr, zero, _CMP_GT_OQ), mone, one);
+        __m512 si = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(yi, zero, _CMP_GT_OQ), mone, one);
+        __m512 error = _mm512_fmsub_ps(sr, yi, _mm512_mul_ps(si, yr));
+
+        _mm512_store_ps(&b->d_error[i], error);
+
+        // advance_loop()
+
+        __m512 freq = _mm512_fmadd_ps(_mm512_load_ps(&b->d_beta[i]), error,
+                                      _mm512_load_ps(&b->d_freq[i]));
+        phase = _mm512_add_ps(phase, _mm512_fmadd_ps(_mm512_load_ps(&b->d_alpha[i]), error, freq));
+
+        // phase_wrap()
+
+        __m512 turns = _mm512_roundscale_ps(_mm512_mul_ps(phase, itau),
+                                            _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+        phase = _mm512_fnmadd_ps(tau, turns, phase);
+
+        // frequency_limit()
+
+        freq = _mm512_max_ps(freq, _mm512_load_ps(&b->d_min_freq[i]));
+        freq = _mm512_min_ps(freq, _mm512_load_ps(&b->d_max_freq[i]));
+
+        _mm512_store_ps(&b->d_freq[i], freq);
+        _mm512_store_ps(&b->d_phase[i], phase);
+    }
+}
+
+#endif
+
+/*
+ * Scalar first, then in order of preference
+ */
+static const struct {
+    const char *name;
+    SimdLevel level;
+    void (*step)(struct costas_bank *);
+} variants[] = {
+    { "scalar", SIMD_SCALAR, step_scalar },
+#ifdef COSTAS_X86
+    { "avx2", SIMD_AVX2, step_avx2 },
+    { "avx512", SIMD_AVX512, step_avx512 },
+#endif
+};
+
+#define VARIANTS    (int) (sizeof (variants) / sizeof (variants[0]))
+
+/*
+ * Returns NULL on error
+ */
+struct costas_bank *costas_bank_create(int nchan) {
+    if (nchan < 1)
+        return NULL;
+
+    struct costas_bank *b = calloc(1, sizeof (struct costas_bank));
+
+    if (b == NULL)
+        return NULL;
+
+    b->nchan = nchan;
+    b->width = ((nchan + COSTAS_LANES - 1) / COSTAS_LANES) * COSTAS_LANES;
+
+    b->d_phase = lane_alloc(b->width);
+    b->d_freq = lane_alloc(b->width);
+    b->d_alpha = lane_alloc(b->width);
+    b->d_beta = lane_alloc(b->width);
+    b->d_max_freq = lane_alloc(b->width);
+    b->d_min_freq = lane_alloc(b->width);
+    b->d_error = lane_alloc(b->width);
+    b->in_re = lane_alloc(b->width);
+    b->in_im = lane_alloc(b->width);
+    b->out_re = lane_alloc(b->width);
+    b->out_im = lane_alloc(b->width);
+
+    if (b->d_phase == NULL || b->d_freq == NULL || b->d_alpha == NULL ||
+            b->d_beta == NULL || b->d_max_freq == NULL || b->d_min_freq == NULL ||
+            b->d_error == NULL || b->in_re == NULL || b->in_im == NULL ||
+            b->out_re == NULL || b->out_im == NULL) {
+        costas_bank_destroy(b);
+        return NULL;
+    }
+
+    b->step = variants[0].step;
+
+    for (int i = 1; i < VARIANTS; i++) {
+        if (dispatch_has(variants[i].level))
+            b->step = variants[i].step;
+    }
+
+    return b;
+}
+
+void costas_bank_destroy(struct costas_bank *b) {
+    if (b == NULL)
+        return;
+
+    free(b->d_phase);
+    free(b->d_freq);
+    free(b->d_alpha);
+    free(b->d_beta);
+    free(b->d_max_freq);
+    free(b->d_min_freq);
+    free(b->d_error);
+    free(b->in_re);
+    free(b->in_im);
+    free(b->out_re);
+    free(b->out_im);
+    free(b);
+}
+
+/*
+ * Load a lane from a scalar loop, which
+ * has already set its gains and limits
+ */
+void costas_bank_set(struct costas_bank *b, int ch, const struct costas_loop *cl) {
+    b->d_phase[ch] = get_phase(cl);
+    b->d_freq[ch] = get_frequency(cl);
+    b->d_alpha[ch] = get_alpha(cl);
+    b->d_beta[ch] = get_beta(cl);
+    b->d_max_freq[ch] = get_max_freq(cl);
+    b->d_min_freq[ch] = get_min_freq(cl);
+}
+
+/*
+ * One symbol through every loop, from in_re/in_im
+ * to the derotated out_re/out_im
+ */
+void costas_bank_step(struct costas_bank *b) {
+    b->step(b);
+}
+
+#define TEST_CHANNELS   37      // not a whole vector
+#define TEST_STEPS      500
+#define TEST_TOLERANCE  1e-4f   // FMA rounds the loop a little apart
+#define TEST_SEED       12345u
+
+static float test_random(uint32_t *state) {
+    *state = (*state * 1664525u) + 1013904223u;
+
+    return ((float) (*state >> 8) / 8388608.0f) - 1.0f;
+}
+
+/*
+ * Check every variant the CPU can run, whatever the override,
+ * against the scalar one, stepping loops with different
+ * phases and frequencies on the same symbols
+ *
+ * Returns the number of variants that differ
+ */
+int costas_bank_selftest(void) {
+    int failed = 0;
+
+    for (int v = 1; v < VARIANTS; v++) {
+        struct costas_bank *ref = costas_bank_create(TEST_CHANNELS);
+        struct costas_bank *b = costas_bank_create(TEST_CHANNELS);
+        uint32_t state = TEST_SEED;
+        float worst = 0.0f;
+
+        if (!dispatch_cpu(variants[v].level) || ref == NULL || b == NULL) {
+            failed += (ref == NULL || b == NULL);
+            costas_bank_destroy(ref);
+            costas_bank_destroy(b);
+            continue;
+        }
+
+        ref->step = variants[0].step;
+        b->step = variants[v].step;
+
+        for (int ch = 0; ch < TEST_CHANNELS; ch++) {
+            struct costas_loop cl;
+
+            create_control_loop(&cl, (TAU / 100.0f), -1.0f, 1.0f);
+            cl.d_phase = test_random(&state) * M_PI;
+            cl.d_freq = test_random(&state) * 0.1f;
+
+            costas_bank_set(ref, ch, &cl);
+            costas_bank_set(b, ch, &cl);
+        }
+
+        for (int i = 0; i < TEST_STEPS; i++) {
+            for (int ch = 0; ch < TEST_CHANNELS; ch++) {
+                ref->in_re[ch] = b->in_re[ch] = test_random(&state);
+                ref->in_im[ch] = b->in_im[ch] = test_random(&state);
+            }
+
+            costas_bank_step(ref);
+            costas_bank_step(b);
+
+            for (int ch = 0; ch < TEST_CHANNELS; ch++) {
+                worst = fmaxf(worst, fabsf(ref->out_re[ch] - b->out_re[ch]));
+                worst = fmaxf(worst, fabsf(ref->out_im[ch] - b->out_im[ch]));
+                worst = fmaxf(worst, fabsf(ref->d_freq[ch] - b->d_freq[ch]));
+            }
+        }
+
+        printf("costas   %-8s %s\n", variants[v].name, (worst <= TEST_TOLERANCE) ? "ok" : "FAILED");
+
+        failed += (worst > TEST_TOLERANCE);
+
+        costas_bank_destroy(ref);
+        costas_bank_destroy(b);
+    }
+
+    return failed;
+}
@@ -0,0 +1,51 @@
+/*
+ * costas_bank.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "costas_loop.h"
+
+#define COSTAS_LANES    16  // widest vector, AVX-512 floats
+
+/*
+ * Loop state for many channels, stored as arrays
+ * so one vector instruction steps a lane per channel.
+ * All arrays are 64 byte aligned, padded to COSTAS_LANES.
+ */
+struct costas_bank {
+    int nchan;
+    int width;          // nchan rounded up to COSTAS_LANES
+
+    float *d_phase;
+    float *d_freq;
+    float *d_alpha;
+    float *d_beta;
+    float *d_max_freq;
+    float *d_min_freq;
+    float *d_error;
+
+    float *in_re;       // one sample per channel in
+    float *in_im;
+    float *out_re;      // derotated sample per channel out
+    float *out_im;
+
+    void (*step)(struct costas_bank *);
+};
+
+struct costas_bank *costas_bank_create(int);
+void costas_bank_destroy(struct costas_bank *);
+
+void costas_bank_set(struct costas_bank *, int, const struct costas_loop *);
+
+void costas_bank_step(struct costas_bank *);
+int costas_bank_selftest(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -10,35 +10,40 @@
 #include "qpsk.h"
 #include "costas_loop.h"
 
-static float d_phase;
-static float d_freq;
-
-static float d_max_freq;
-static float d_min_freq;
-
-static float d_damping;
-static float d_loop_bw;
-
-static float d_alpha;
-static float d_beta;
-
 /*
  * A Costas loop carrier recovery algorithm.
  *
  * The Costas loop locks to the center frequency of a signal and
  * downconverts signal to baseband.
+ *
+ * Each channel owns its own loop state, so any
+ * number of loops may run side by side.
  */
-void create_control_loop(float loop_bw, float min_freq, float max_freq) {
-    set_phase(0.0f);
-    set_frequency(0.0f);
+void create_control_loop(struct costas_loop *cl, float loop_bw, float min_freq, float max_freq) {
+    set_phase(cl, 0.0f);
 
-    set_max_freq(max_freq);
-    set_min_freq(min_freq);
+    set_max_freq(cl, max_freq);
+    set_min_freq(cl, min_freq);
 
-    set_damping_factor(sqrtf(2.0f) / 2.0f);
+    set_frequency(cl, 0.0f);
+
+    cl->d_damping = 0.0f;
+    cl->d_loop_bw = 0.0f;
+
+    set_damping_factor(cl, sqrtf(2.0f) / 2.0f);
 
     // Calls update_gains() which sets alpha and beta
-    set_loop_bandwidth(loop_bw);
+    set_loop_bandwidth(cl, loop_bw);
+
+    // No gear shift until asked for
+
+    cl->d_lock = 0.0f;
+    cl->d_err_mean = 0.0f;
+    cl->d_err_var = 0.0f;
+    cl->d_locked = false;
+
+    cl->d_wide_bw = loop_bw;
+    cl->d_narrow_bw = loop_bw;
 }
 
 float phase_detector(complex float sample) {
@@ -46,110 +51,174 @@ float phase_detector(complex float sample) {
             (cimagf(sample) > 0.0f ? 1.0f : -1.0f) * crealf(sample));
 }
 
-void update_gains() {
-    float denom = ((1.0f + (2.0f * d_damping * d_loop_bw)) + (d_loop_bw * d_loop_bw));
+void update_gains(struct costas_loop *cl) {
+    float denom = ((1.0f + (2.0f * cl->d_damping * cl->d_loop_bw)) + (cl->d_loop_bw * cl->d_loop_bw));
 
-    d_alpha = (4.0f * d_damping * d_loop_bw) / denom;
-    d_beta = (4.0f * d_loop_bw * d_loop_bw) / denom;
+    cl->d_alpha = (4.0f * cl->d_damping * cl->d_loop_bw) / denom;
+    cl->d_beta = (4.0f * cl->d_loop_bw * cl->d_loop_bw) / denom;
 }
 
-void advance_loop(float error) {
-    d_freq = d_freq + d_beta * error;
-    d_phase = d_phase + d_freq + d_alpha * error;
+void advance_loop(struct costas_loop *cl, float error) {
+    cl->d_freq = cl->d_freq + cl->d_beta * error;
+    cl->d_phase = cl->d_phase + cl->d_freq + cl->d_alpha * error;
 }
 
-void phase_wrap() {
-    while (d_phase > TAU)
-        d_phase -= TAU;
+void phase_wrap(struct costas_loop *cl) {
+    while (cl->d_phase > TAU)
+        cl->d_phase -= TAU;
 
-    while (d_phase < -TAU)
-        d_phase += TAU;
+    while (cl->d_phase < -TAU)
+        cl->d_phase += TAU;
 }
 
-void frequency_limit() {
-    if (d_freq > d_max_freq)
-        d_freq = d_max_freq;
-    else if (d_freq < d_min_freq)
-        d_freq = d_min_freq;
+void frequency_limit(struct costas_loop *cl) {
+    if (cl->d_freq > cl->d_max_freq)
+        cl->d_freq = cl->d_max_freq;
+    else if (cl->d_freq < cl->d_min_freq)
+        cl->d_freq = cl->d_min_freq;
 }
 
+/*
+ * Lock detector, called once per symbol after the loop
+ * has been advanced, with the derotated sample and the
+ * phase detector error.
+ *
+ * The phase detector settles the constellation on the
+ * diagonals, where the 4th power of a symbol is a negative
+ * real. So -Re(y^4) / |y|^4 is the cosine of four times the
+ * phase error, near 1 when locked and averaging 0 when the
+ * loop is slipping. It needs no trig and ignores amplitude.
+ *
+ * With hysteresis on the filtered metric, the loop is
+ * shifted to the narrow bandwidth on lock for low jitter,
+ * and back to the wide one for fast pull in on loss.
+ */
+void lock_detect(struct costas_loop *cl, complex float sample, float error) {
+    float re = crealf(sample);
+    float im = cimagf(sample);
+
+    float re2 = re * re;
+    float im2 = im * im;
+    float mag2 = re2 + im2;
+
+    if (mag2 > 0.0f) {
+        float y4 = (re2 - im2) * (re2 - im2) - 4.0f * re2 * im2; // Re(y^4)
+
+        cl->d_lock += LOCK_GAIN * ((-y4 / (mag2 * mag2)) - cl->d_lock);
+    }
+
+    float delta = error - cl->d_err_mean;
+
+    cl->d_err_mean += LOCK_GAIN * delta;
+    cl->d_err_var += LOCK_GAIN * ((delta * delta) - cl->d_err_var);
+
+    if (cl->d_locked == false && cl->d_lock > LOCK_ON) {
+        cl->d_locked = true;
+
+        if (cl->d_loop_bw != cl->d_narrow_bw)
+            set_loop_bandwidth(cl, cl->d_narrow_bw);
+    } else if (cl->d_locked == true && cl->d_lock < LOCK_OFF) {
+        cl->d_locked = false;
+
+        if (cl->d_loop_bw != cl->d_wide_bw)
+            set_loop_bandwidth(cl, cl->d_wide_bw);
+    }
+}
 
 // Setters
 
-void set_loop_bandwidth(float bw)
+void set_loop_bandwidth(struct costas_loop *cl, float bw)
 {
     if (bw < 0.0f) {
-        d_loop_bw = 0.0f;
+        cl->d_loop_bw = 0.0f;
     }
 
-    d_loop_bw = bw;
-    update_gains();
+    cl->d_loop_bw = bw;
+    update_gains(cl);
 }
 
-void set_damping_factor(float df)
+void set_damping_factor(struct costas_loop *cl, float df)
 {
     if (df <= 0.0f) {
-        d_damping = 0.0f;
+        cl->d_damping = 0.0f;
     }
 
-    d_damping = df;
-    update_gains();
+    cl->d_damping = df;
+    update_gains(cl);
 }
 
-void set_alpha(float alpha)
+void set_alpha(struct costas_loop *cl, float alpha)
 {
     if (alpha < 0.0f || alpha > 1.0f) {
-        d_alpha = 0.0f;
+        cl->d_alpha = 0.0f;
     }
 
-    d_alpha = alpha;
+    cl->d_alpha = alpha;
 }
 
-void set_beta(float beta)
+void set_beta(struct costas_loop *cl, float beta)
 {
     if (beta < 0.0f || beta > 1.0f) {
-        d_beta = 0.0f;
+        cl->d_beta = 0.0f;
     }
 
-    d_beta = beta;
+    cl->d_beta = beta;
 }
 
-void set_frequency(float freq)
+void set_frequency(struct costas_loop *cl, float freq)
 {
-    if (freq > d_max_freq)
-        d_freq = d_max_freq;
-    else if (freq < d_min_freq)
-        d_freq = d_min_freq;
+    if (freq > cl->d_max_freq)
+        cl->d_freq = cl->d_max_freq;
+    else if (freq < cl->d_min_freq)
+        cl->d_freq = cl->d_min_freq;
     else
-        d_freq = freq;
+        cl->d_freq = freq;
 }
 
-void set_phase(float phase)
+void set_phase(struct costas_loop *cl, float phase)
 {
-    d_phase = phase;
+    cl->d_phase = phase;
 
-    phase_wrap();
+    phase_wrap(cl);
 }
 
-void set_max_freq(float freq) { d_max_freq = freq; }
+void set_max_freq(struct costas_loop *cl, float freq) { cl->d_max_freq = freq; }
 
-void set_min_freq(float freq) { d_min_freq = freq; }
+void set_min_freq(struct costas_loop *cl, float freq) { cl->d_min_freq = freq; }
+
+/*
+ * Acquire with the wide loop bandwidth, and
+ * track with the narrow one once locked
+ */
+void set_gear_shift(struct costas_loop *cl, float wide_bw, float narrow_bw)
+{
+    cl->d_wide_bw = wide_bw;
+    cl->d_narrow_bw = narrow_bw;
+
+    set_loop_bandwidth(cl, cl->d_locked ? narrow_bw : wide_bw);
+}
 
 // Getters
 
-float get_loop_bandwidth() { return d_loop_bw; }
+float get_loop_bandwidth(const struct costas_loop *cl) { return cl->d_loop_bw; }
+
+float get_damping_factor(const struct costas_loop *cl) { return cl->d_damping; }
+
+float get_alpha(const struct costas_loop *cl) { return cl->d_alpha; }
+
+float get_beta(const struct costas_loop *cl) { return cl->d_beta; }
 
-float get_damping_factor() { return d_damping; }
+float get_frequency(const struct costas_loop *cl) { return cl->d_freq; }
 
-float get_alpha() { return d_alpha; }
+float get_phase(const struct costas_loop *cl) { return cl->d_phase; }
 
-float get_beta() { return d_beta; }
+float get_max_freq(const struct costas_loop *cl) { return cl->d_max_freq; }
 
-float get_frequency() { return d_freq; }
+float get_min_freq(const struct costas_loop *cl) { return cl->d_min_freq; }
 
-float get_phase() { return d_phase; }
+float get_lock_metric(const struct costas_loop *cl) { return cl->d_lock; }
 
-float get_max_freq() { return d_max_freq; }
+float get_error_variance(const struct costas_loop *cl) { return cl->d_err_var; }
 
-float get_min_freq() { return d_min_freq; }
+bool get_locked(const struct costas_loop *cl) { return cl->d_locked; }
 
@@ -12,35 +12,72 @@ extern "C"
 #endif
 
 #include <complex.h>
+#include <stdbool.h>
 
-void create_control_loop(float, float, float);
+#define LOCK_GAIN       0.01f   // lock metric filter, about 100 symbols
+#define LOCK_ON         0.75f   // metric to declare lock
+#define LOCK_OFF        0.40f   // metric to declare loss of lock
+
+/*
+ * Per-channel loop state
+ */
+struct costas_loop {
+    float d_phase;
+    float d_freq;
+
+    float d_max_freq;
+    float d_min_freq;
+
+    float d_damping;
+    float d_loop_bw;
+
+    float d_alpha;
+    float d_beta;
+
+    // Lock detector
+
+    float d_lock;       // filtered 4th power phase agreement, -1 to 1
+    float d_err_mean;
+    float d_err_var;    // filtered phase detector variance
+    bool d_locked;
+
+    float d_wide_bw;    // loop bandwidth while acquiring
+    float d_narrow_bw;  // loop bandwidth once locked
+};
+
+void create_control_loop(struct costas_loop *, float, float, float);
 float phase_detector(complex float);
-void update_gains(void);
-void advance_loop(float);
-void phase_wrap(void);
-void frequency_limit(void);
+void update_gains(struct costas_loop *);
+void advance_loop(struct costas_loop *, float);
+void phase_wrap(struct costas_loop *);
+void frequency_limit(struct costas_loop *);
+void lock_detect(struct costas_loop *, complex float, float);
 
 // Setters
 
-void set_loop_bandwidth(float);
-void set_damping_factor(float);
-void set_alpha(float);
-void set_beta(float);
-void set_frequency(float);
-void set_phase(float);
-void set_max_freq(float);
-void set_min_freq(float);
+void set_loop_bandwidth(struct costas_loop *, float);
+void set_damping_factor(struct costas_loop *, float);
+void set_alpha(struct costas_loop *, float);
+void set_beta(struct costas_loop *, float);
+void set_frequency(struct costas_loop *, float);
+void set_phase(struct costas_loop *, float);
+void set_max_freq(struct costas_loop *, float);
+void set_min_freq(struct costas_loop *, float);
+void set_gear_shift(struct costas_loop *, float, float);
 
 // Getters
 
-float get_loop_bandwidth(void);
-float get_damping_factor(void);
-float get_alpha(void);
-float get_beta(void);
-float get_frequency(void);
-float get_phase(void);
-float get_max_freq(void);
-float get_min_freq(void);
+float get_loop_bandwidth(const struct costas_loop *);
+float get_damping_factor(const struct costas_loop *);
+float get_alpha(const struct costas_loop *);
+float get_beta(const struct costas_loop *);
+float get_frequency(const struct costas_loop *);
+float get_phase(const struct costas_loop *);
+float get_max_freq(const struct costas_loop *);
+float get_min_freq(const struct costas_loop *);
+float get_lock_metric(const struct costas_loop *);
+float get_error_variance(const struct costas_loop *);
+bool get_locked(const struct costas_loop *);
 
 #ifdef __cplusplus
 }
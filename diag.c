@@ -0,0 +1,180 @@
+/*
+ * diag.c
+ *
+ * Asynchronous binary diagnostics tap
+ *
+ * Replaces the fprintf() of every symbol in the Costas
+ * loop. The receiver copies 24 byte records into a
+ * lock-free ring, decimated per signal, and a background
+ * thread writes them to a binary file in batches. If the
+ * writer falls behind, records are dropped and counted
+ * rather than stalling the receiver.
+ *
+ * Use diag2txt to turn the file back into text.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "diag.h"
+
+/*
+ * The ring of each signal, by the stage that produces it
+ */
+static const int rings[DIAG_TYPES] = {
+    [DIAG_CONSTELLATION] = 0,
+    [DIAG_PHASE_ERROR] = 0,
+    [DIAG_FREQUENCY] = 0,
+    [DIAG_TIMING] = 1,
+    [DIAG_HISTOGRAM] = 1
+};
+
+/*
+ * Returns the number of records written
+ */
+static size_t diag_drain(struct diag_tap *tap) {
+    struct diag_record batch[DIAG_BATCH];
+    size_t count, total = 0;
+
+    for (int k = 0; k < DIAG_RINGS; k++) {
+        while ((count = ringbuf_count(tap->ring[k])) > 0) {
+            if (count > DIAG_BATCH)
+                count = DIAG_BATCH;
+
+            ringbuf_read(tap->ring[k], batch, count);
+            fwrite(batch, sizeof (struct diag_record), count, tap->fout);
+            atomic_fetch_add(&tap->written, count);
+
+            total += count;
+        }
+    }
+
+    return total;
+}
+
+static void *diag_thread(void *arg) {
+    struct diag_tap *tap = arg;
+    struct timespec idle = { 0, 10000000 };   // 10 ms
+
+    while (atomic_load(&tap->running)) {
+        if (diag_drain(tap) == 0)
+            nanosleep(&idle, NULL);
+    }
+
+    diag_drain(tap);
+    fflush(tap->fout);
+
+    return NULL;
+}
+
+static void diag_free(struct diag_tap *tap) {
+    if (tap->fout != NULL)
+        fclose(tap->fout);
+
+    for (int k = 0; k < DIAG_RINGS; k++) {
+        ringbuf_destroy(tap->ring[k]);
+    }
+
+    free(tap);
+}
+
+/*
+ * Every signal starts off, except the constellation
+ * which is on at full rate.
+ *
+ * Returns NULL on error
+ */
+struct diag_tap *diag_create(const char *filename, float fs, float rs) {
+    struct diag_tap *tap = calloc(1, sizeof (struct diag_tap));
+
+    if (tap == NULL)
+        return NULL;
+
+    for (int k = 0; k < DIAG_RINGS; k++) {
+        if ((tap->ring[k] = ringbuf_create(DIAG_RECORDS, sizeof (struct diag_record))) == NULL) {
+            diag_free(tap);
+            return NULL;
+        }
+    }
+
+    if ((tap->fout = fopen(filename, "wb")) == NULL) {
+        diag_free(tap);
+        return NULL;
+    }
+
+    struct diag_header header;
+
+    memset(&header, 0, sizeof (struct diag_header));
+    memcpy(header.magic, DIAG_MAGIC, sizeof (header.magic));
+    header.version = DIAG_VERSION;
+    header.record_size = sizeof (struct diag_record);
+    header.fs = fs;
+    header.rs = rs;
+
+    fwrite(&header, sizeof (struct diag_header), 1, tap->fout);
+
+    tap->decimation[DIAG_CONSTELLATION] = 1;
+
+    atomic_init(&tap->running, true);
+    atomic_init(&tap->written, 0);
+
+    if (pthread_create(&tap->thread, NULL, diag_thread, tap) != 0) {
+        diag_free(tap);
+        return NULL;
+    }
+
+    return tap;
+}
+
+/*
+ * Writes out whatever is left
+ */
+void diag_destroy(struct diag_tap *tap) {
+    if (tap == NULL)
+        return;
+
+    atomic_store(&tap->running, false);
+    pthread_join(tap->thread, NULL);
+
+    diag_free(tap);
+}
+
+/*
+ * Keep one record in every decimation,
+ * or none with a decimation of 0
+ */
+void diag_set_decimation(struct diag_tap *tap, DiagType type, uint32_t decimation) {
+    if (type < DIAG_TYPES)
+        tap->decimation[type] = decimation;
+}
+
+unsigned long diag_dropped(struct diag_tap *tap) {
+    unsigned long dropped = 0;
+
+    for (int k = 0; k < DIAG_RINGS; k++) {
+        dropped += atomic_load(&tap->ring[k]->overruns);
+    }
+
+    return dropped;
+}
+
+/*
+ * Queue a record after diag_want() said yes. The
+ * value is up to 16 bytes of the record union.
+ */
+void diag_put(struct diag_tap *tap, DiagType type, int channel, const void *value, size_t bytes) {
+    struct diag_record r;
+
+    r.type = (uint8_t) type;
+    r.channel = (uint8_t) channel;
+    r.reserved = 0;
+    r.sequence = tap->sequence[type] - 1;
+
+    memset(&r.v, 0, sizeof (r.v));
+    memcpy(&r.v, value, (bytes < sizeof (r.v)) ? bytes : sizeof (r.v));
+
+    ringbuf_write(tap->ring[rings[type]], &r, 1);
+}
@@ -0,0 +1,106 @@
+/*
+ * diag.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "ringbuf.h"
+
+#define DIAG_MAGIC      "QPSKDIAG"
+#define DIAG_VERSION    2
+#define DIAG_RECORDS    8192    // ring size in records
+#define DIAG_BATCH      256     // records per write
+#define DIAG_RINGS      2       // one per producing stage
+
+/*
+ * Signals that can be tapped
+ */
+typedef enum {
+    DIAG_CONSTELLATION,     // f[0] I, f[1] Q, after the Costas loop
+    DIAG_PHASE_ERROR,       // f[0] phase detector error
+    DIAG_FREQUENCY,         // f[0] loop frequency, Hz
+    DIAG_TIMING,            // f[0] timing offset, samples
+    DIAG_HISTOGRAM,         // h[0..7] symbol power across the symbol
+    DIAG_TYPES
+} DiagType;
+
+/*
+ * Fixed size binary record, 24 bytes
+ */
+struct diag_record {
+    uint8_t type;
+    uint8_t channel;
+    uint16_t reserved;
+    uint32_t sequence;      // per type count before decimation
+
+    union {
+        float f[4];
+        int32_t i[4];
+        uint16_t h[8];
+    } v;
+};
+
+/*
+ * File header, followed by records
+ */
+struct diag_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    float fs;
+    float rs;
+};
+
+/*
+ * The receiver only copies records into a ring, and a
+ * background thread writes them out, so nothing formatted
+ * or blocking happens in the receive loop.
+ *
+ * The pipeline runs the timing and Costas stages on
+ * separate threads, so the timing and histogram signals
+ * have a ring of their own. Each ring, and each type's
+ * sequence, then has the one producer.
+ */
+struct diag_tap {
+    struct ringbuf *ring[DIAG_RINGS];
+    FILE *fout;
+
+    uint32_t decimation[DIAG_TYPES];    // keep one in N, 0 is off
+    uint32_t sequence[DIAG_TYPES];
+
+    pthread_t thread;
+    atomic_bool running;
+    atomic_ulong written;
+};
+
+struct diag_tap *diag_create(const char *, float, float);
+void diag_destroy(struct diag_tap *);
+void diag_set_decimation(struct diag_tap *, DiagType, uint32_t);
+unsigned long diag_dropped(struct diag_tap *);
+
+void diag_put(struct diag_tap *, DiagType, int, const void *, size_t);
+
+/*
+ * The cheap test, inline, before building a record
+ */
+static inline bool diag_want(struct diag_tap *tap, DiagType type) {
+    if (tap == NULL || tap->decimation[type] == 0)
+        return false;
+
+    return (tap->sequence[type]++ % tap->decimation[type]) == 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
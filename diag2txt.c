@@ -0,0 +1,97 @@
+/*
+ * diag2txt.c
+ *
+ * Convert a binary diagnostics file to text
+ *
+ * Usage: diag2txt file.bin [constellation|phase|frequency|timing|histogram]
+ *
+ * The default constellation output is the "I Q" per
+ * line form that make test_scatter plots.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+
+static const char *names[DIAG_TYPES] = {
+    [DIAG_CONSTELLATION] = "constellation",
+    [DIAG_PHASE_ERROR] = "phase",
+    [DIAG_FREQUENCY] = "frequency",
+    [DIAG_TIMING] = "timing",
+    [DIAG_HISTOGRAM] = "histogram"
+};
+
+int main(int argc, char** argv) {
+    struct diag_header header;
+    struct diag_record r;
+    int type = DIAG_CONSTELLATION;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s file.bin [constellation|phase|frequency|timing|histogram]\n", argv[0]);
+        return (EXIT_FAILURE);
+    }
+
+    if (argc > 2) {
+        for (type = 0; type < DIAG_TYPES; type++) {
+            if (strcmp(argv[2], names[type]) == 0)
+                break;
+        }
+
+        if (type == DIAG_TYPES) {
+            fprintf(stderr, "Unknown signal %s\n", argv[2]);
+            return (EXIT_FAILURE);
+        }
+    }
+
+    FILE *fin = fopen(argv[1], "rb");
+
+    if (fin == NULL) {
+        perror(argv[1]);
+        return (EXIT_FAILURE);
+    }
+
+    if (fread(&header, sizeof (struct diag_header), 1, fin) != 1 ||
+            memcmp(header.magic, DIAG_MAGIC, sizeof (header.magic)) != 0 ||
+            header.record_size != sizeof (struct diag_record)) {
+        fprintf(stderr, "%s is not a diagnostics file\n", argv[1]);
+        fclose(fin);
+        return (EXIT_FAILURE);
+    }
+
+    if (header.version != DIAG_VERSION) {
+        fprintf(stderr, "%s is diagnostics version %u, not %d\n", argv[1], header.version, DIAG_VERSION);
+        fclose(fin);
+        return (EXIT_FAILURE);
+    }
+
+    while (fread(&r, sizeof (struct diag_record), 1, fin) == 1) {
+        if (r.type != type)
+            continue;
+
+        switch (type) {
+        case DIAG_CONSTELLATION:
+            printf("%f %f\n", r.v.f[0], r.v.f[1]);
+            break;
+        case DIAG_PHASE_ERROR:
+        case DIAG_FREQUENCY:
+        case DIAG_TIMING:
+            printf("%u %d %f\n", r.sequence, r.channel, r.v.f[0]);
+            break;
+        case DIAG_HISTOGRAM:
+            printf("%u %d", r.sequence, r.channel);
+
+            for (int k = 0; k < 8; k++) {
+                printf(" %u", r.v.h[k]);
+            }
+
+            printf("\n");
+            break;
+        }
+    }
+
+    fclose(fin);
+
+    return (EXIT_SUCCESS);
+}
@@ -0,0 +1,109 @@
+/*
+ * dispatch.c
+ *
+ * CPU feature detection for the kernels
+ *
+ * The features are read once, and every module picking a
+ * kernel asks here, so one binary runs its best code on
+ * any x86-64 or ARM64 host. Setting QPSK_SIMD to a level
+ * name, such as sse2 or scalar, holds every kernel at or
+ * below it, to compare against, or to work around a CPU.
+ *
+ * The levels of one architecture are in order, but the
+ * x86 ones and NEON are not comparable, so a level the CPU
+ * does not have is refused. The limit is then always one
+ * of the CPU's own, and below it means the same family.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "dispatch.h"
+
+static const char *names[SIMD_LEVELS] = {
+    [SIMD_SCALAR] = "scalar",
+    [SIMD_SSE2] = "sse2",
+    [SIMD_SSE41] = "sse4.1",
+    [SIMD_AVX] = "avx",
+    [SIMD_AVX2] = "avx2",
+    [SIMD_AVX512] = "avx512",
+    [SIMD_NEON] = "neon"
+};
+
+static bool detected[SIMD_LEVELS];
+static SimdLevel limit = (SIMD_LEVELS - 1);
+static pthread_once_t detect_once = PTHREAD_ONCE_INIT;
+
+static void detect(void) {
+    detected[SIMD_SCALAR] = true;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    detected[SIMD_SSE2] = __builtin_cpu_supports("sse2");
+    detected[SIMD_SSE41] = detected[SIMD_SSE2] && __builtin_cpu_supports("sse4.1");
+    detected[SIMD_AVX] = detected[SIMD_SSE41] && __builtin_cpu_supports("avx");
+    detected[SIMD_AVX2] = detected[SIMD_AVX] && __builtin_cpu_supports("avx2") &&
+            __builtin_cpu_supports("fma");
+    detected[SIMD_AVX512] = detected[SIMD_AVX2] && __builtin_cpu_supports("avx512f");
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    detected[SIMD_NEON] = true;
+#endif
+
+    const char *env = getenv(DISPATCH_ENV);
+
+    if (env == NULL || *env == '\0')
+        return;
+
+    for (int i = 0; i < SIMD_LEVELS; i++) {
+        if (strcmp(env, names[i]) != 0)
+            continue;
+
+        if (detected[i])
+            limit = (SimdLevel) i;
+        else
+            fprintf(stderr, "%s=%s is not on this CPU, ignored\n", DISPATCH_ENV, env);
+
+        return;
+    }
+
+    fprintf(stderr, "%s=%s is not a level, ignored\n", DISPATCH_ENV, env);
+}
+
+/*
+ * True when the CPU has the level, whatever the override,
+ * for testing every kernel the CPU can run
+ */
+bool dispatch_cpu(SimdLevel level) {
+    pthread_once(&detect_once, detect);
+
+    return (level >= 0 && level < SIMD_LEVELS) ? detected[level] : false;
+}
+
+/*
+ * True when kernels of the level may be used, the
+ * CPU having it, and the override allowing it
+ */
+bool dispatch_has(SimdLevel level) {
+    return dispatch_cpu(level) && (level <= limit);
+}
+
+/*
+ * The best level in use
+ */
+SimdLevel dispatch_level(void) {
+    SimdLevel best = SIMD_SCALAR;
+
+    for (int i = 0; i < SIMD_LEVELS; i++) {
+        if (dispatch_has((SimdLevel) i))
+            best = (SimdLevel) i;
+    }
+
+    return best;
+}
+
+const char *dispatch_name(SimdLevel level) {
+    return (level >= 0 && level < SIMD_LEVELS) ? names[level] : "unknown";
+}
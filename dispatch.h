@@ -0,0 +1,38 @@
+/*
+ * dispatch.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+
+#define DISPATCH_ENV    "QPSK_SIMD"     // highest level to use
+
+/*
+ * Instruction set levels, each x86 one taking in those
+ * below it. AVX2 includes FMA, which every AVX2 CPU has.
+ */
+typedef enum {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_SSE41,
+    SIMD_AVX,
+    SIMD_AVX2,
+    SIMD_AVX512,
+    SIMD_NEON,
+    SIMD_LEVELS
+} SimdLevel;
+
+bool dispatch_has(SimdLevel);
+bool dispatch_cpu(SimdLevel);
+SimdLevel dispatch_level(void);
+const char *dispatch_name(SimdLevel);
+
+#ifdef __cplusplus
+}
+#endif
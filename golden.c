@@ -0,0 +1,357 @@
+/*
+ * golden.c
+ *
+ * Reference outputs for the kernels
+ *
+ * Each selftest holds the SIMD kernels to the scalar one,
+ * which passes just as well if the scalar one is wrong. So
+ * here each kernel, through the same dispatch the modem
+ * uses, runs on fixed input and is held to outputs checked
+ * in below, taken from the scalar kernels. make check runs
+ * it at the best level and again with QPSK_SIMD=scalar.
+ *
+ * After a deliberate change to a kernel, qpsk golden
+ * with QPSK_SIMD=scalar prints the tables again, to
+ * paste over these.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <complex.h>
+#include <math.h>
+
+#include "qpsk.h"
+#include "golden.h"
+#include "dispatch.h"
+#include "pcm.h"
+#include "rrc_fir.h"
+#include "resample.h"
+#include "costas_loop.h"
+#include "costas_bank.h"
+#include "algorithms/viterbi.h"
+
+#define GOLDEN_SEED     24680u
+#define GOLDEN_LENGTH   512     // input samples
+#define GOLDEN_BYTES    32      // Viterbi message
+#define GOLDEN_LOOPS    8       // Costas bank channels, a phase and frequency each
+#define GOLDEN_STEPS    64
+#define GOLDEN_TOLERANCE 1e-5f  // relative, for the float kernels
+
+struct golden {
+    float rrc[GOLDEN_POINTS * 2];       // complex, interleaved
+    float mix[GOLDEN_POINTS * 2];
+    int16_t pcm[GOLDEN_POINTS];
+    int16_t resample[GOLDEN_POINTS];
+    uint8_t viterbi[GOLDEN_POINTS];
+    float costas[GOLDEN_LOOPS * 2];
+};
+
+// Scalar kernels
+
+static const float golden_rrc[GOLDEN_POINTS * 2] = {
+    0.000306283939f, 0.000353753538f, -0.00333756604f, -0.00229453342f,
+    0.690793097f, -1.02791238f, -0.233532622f, 0.406442165f,
+    -0.192478150f, -0.533979475f, -1.12458122f, 0.146101534f,
+    0.146224141f, -0.951559067f, -1.42452848f, -0.479727089f,
+    -0.287697226f, -0.293012589f, -1.14392972f, 2.13936472f,
+    -0.162917271f, -1.01099765f, 0.358910441f, 0.783334672f,
+    -1.85401428f, -0.949963927f, -1.52724743f, 0.955556571f,
+    -0.331299186f, -0.247158706f, -0.489772618f, -0.160613477f
+};
+
+static const float golden_mix[GOLDEN_POINTS * 2] = {
+    -0.660400391f, 0.00000000f, -0.0780252963f, 0.116773188f,
+    -0.763639629f, -1.84358573f, -1.70362389f, -0.338870168f,
+    0.194298744f, -0.194299236f, 0.162798852f, 0.818438232f,
+    -1.16934240f, -0.484354854f, 0.805180490f, -0.538007021f,
+    -3.47185755e-06f, -1.35449219f, -0.564328611f, -0.377069980f,
+    -0.0482690334f, 0.0199938696f, 0.125441909f, -0.630650640f,
+    -0.674222708f, -0.674217522f, 0.826938272f, -0.164491832f,
+    0.602654457f, -1.45495510f, 1.10365450f, 1.65171838f
+};
+
+static const int16_t golden_pcm[GOLDEN_POINTS] = {
+    25032, 32767, -17943, -29919, 14897, 18340, -31605, -32768,
+    -1587, -25403, 32767, 29547, -30225, -32768, -11286, -5711
+};
+
+static const int16_t golden_resample[GOLDEN_POINTS] = {
+    -29461, -15826, 7126, 25923, 29006, 14228, -8800, -26726,
+    -28434, -12833, 10698, 27418, 27821, 11205, -12241, -28111
+};
+
+static const uint8_t golden_viterbi[GOLDEN_POINTS] = {
+    167, 33, 87, 7, 190, 190, 143, 6,
+    119, 225, 12, 252, 168, 142, 125, 207
+};
+
+static const float golden_costas[GOLDEN_LOOPS * 2] = {
+    -3.82519579f, -0.0665162653f, 2.77568746f, 0.167482629f,
+    1.70876014f, -0.00359351281f, 3.03587246f, 0.0443941802f,
+    0.229675561f, -0.00170696503f, 6.19297647f, 0.0784708336f,
+    6.25732899f, 0.0779373571f, 2.91364193f, 0.0950473323f
+};
+
+static float next(uint32_t *state) {
+    *state = (*state * 1664525u) + 1013904223u;
+
+    return ((float) (*state >> 8) / 8388608.0f) - 1.0f;
+}
+
+/*
+ * Run every kernel on the same input
+ *
+ * Returns -1 on error
+ */
+static int golden_run(struct golden *g) {
+    static complex float x[GOLDEN_LENGTH];
+    static complex float memory[RRC_MEMORY(NTAPS)];
+    static float re[GOLDEN_LENGTH], im[GOLDEN_LENGTH], f[GOLDEN_LENGTH];
+    static int16_t pcm[GOLDEN_LENGTH * 5], out[GOLDEN_LENGTH * 2];
+    float half[RRC_HALF(NTAPS)];
+    uint32_t state = GOLDEN_SEED;
+
+    /*
+     * RRC filter, 2400 baud at 9600
+     */
+    for (int i = 0; i < GOLDEN_LENGTH; i++) {
+        float a = next(&state);
+
+        x[i] = a + next(&state) * I;
+    }
+
+    rrc_make(half, NTAPS, FS, RS, .35f);
+    memset(memory, 0, sizeof (memory));
+    rrc_fir(half, NTAPS, memory, x, GOLDEN_LENGTH);
+
+    for (int i = 0; i < GOLDEN_POINTS; i++) {
+        g->rrc[(i * 2)] = crealf(x[i * (GOLDEN_LENGTH / GOLDEN_POINTS)]);
+        g->rrc[(i * 2) + 1] = cimagf(x[i * (GOLDEN_LENGTH / GOLDEN_POINTS)]);
+    }
+
+    /*
+     * PCM down to baseband at the center, from the
+     * second of two channels, and back out, with the
+     * last of it past full scale
+     */
+    for (int i = 0; i < GOLDEN_LENGTH; i++) {
+        re[i] = cosf((float) (TAU * CENTER / FS) * i);
+        im[i] = sinf((float) (TAU * CENTER / FS) * i);
+        pcm[(i * 2)] = (int16_t) (32767.0f * next(&state));
+        pcm[(i * 2) + 1] = (int16_t) (32767.0f * next(&state));
+        f[i] = 2.5f * next(&state);
+    }
+
+    pcm_mix_down(pcm, 2, 1, re, im, x, GOLDEN_LENGTH, 1.0f / PCM_SCALE);
+    pcm_from_float(f, out, GOLDEN_LENGTH, PCM_SCALE);
+
+    for (int i = 0; i < GOLDEN_POINTS; i++) {
+        int k = (i * (GOLDEN_LENGTH / GOLDEN_POINTS)) + i;     // at every carrier phase
+
+        g->mix[(i * 2)] = crealf(x[k]);
+        g->mix[(i * 2) + 1] = cimagf(x[k]);
+        g->pcm[i] = out[k];
+    }
+
+    /*
+     * A sound card tone with some noise, 48000 to 9600
+     */
+    struct resampler *r = resampler_create(48000, 9600);
+
+    if (r == NULL)
+        return -1;
+
+    for (int i = 0; i < (GOLDEN_LENGTH * 5); i++) {
+        pcm[i] = (int16_t) (30000.0f * sinf(i * 0.02f) + 500.0f * next(&state));
+    }
+
+    int n = resampler_process(r, pcm, 1, 0, GOLDEN_LENGTH * 5, out);
+
+    resampler_destroy(r);
+
+    if (n < (GOLDEN_LENGTH / 2))
+        return -1;
+
+    for (int i = 0; i < GOLDEN_POINTS; i++) {
+        g->resample[i] = out[(GOLDEN_LENGTH / 4) + (i * (GOLDEN_LENGTH / 4 / GOLDEN_POINTS))];
+    }
+
+    /*
+     * Viterbi decoder at rate 3/4, with one in 40
+     * soft bits wrong, so it has errors to correct
+     */
+    uint8_t data[GOLDEN_BYTES], decoded[GOLDEN_BYTES];
+    uint8_t coded[(GOLDEN_BYTES * 8 + CONV_TAIL) * 2], soft[(GOLDEN_BYTES * 8 + CONV_TAIL) * 2];
+    struct viterbi *v = viterbi_create(GOLDEN_BYTES * 8);
+
+    if (v == NULL)
+        return -1;
+
+    for (int i = 0; i < GOLDEN_BYTES; i++) {
+        next(&state);
+        data[i] = (uint8_t) (state >> 24);
+    }
+
+    n = conv_encode(data, GOLDEN_BYTES, coded, FEC_3_4);
+
+    for (int i = 0; i < n; i++) {
+        int s = (coded[i] ? 190 : 65) + (int) (50.0f * next(&state));
+
+        soft[i] = (uint8_t) ((i % 40) ? s : (255 - s));
+    }
+
+    conv_depuncture(soft, GOLDEN_BYTES, coded, FEC_3_4);
+    viterbi_decode(v, coded, GOLDEN_BYTES * 8, decoded);
+    viterbi_destroy(v);
+
+    memcpy(g->viterbi, decoded, GOLDEN_POINTS);
+
+    /*
+     * Costas bank, loops at different phases
+     * and frequencies on noise
+     */
+    struct costas_bank *b = costas_bank_create(GOLDEN_LOOPS);
+
+    if (b == NULL)
+        return -1;
+
+    for (int ch = 0; ch < GOLDEN_LOOPS; ch++) {
+        struct costas_loop cl;
+
+        create_control_loop(&cl, (TAU / 100.0f), -1.0f, 1.0f);
+        cl.d_phase = next(&state) * M_PI;
+        cl.d_freq = next(&state) * 0.1f;
+
+        costas_bank_set(b, ch, &cl);
+    }
+
+    for (int i = 0; i < GOLDEN_STEPS; i++) {
+        for (int ch = 0; ch < GOLDEN_LOOPS; ch++) {
+            b->in_re[ch] = next(&state);
+            b->in_im[ch] = next(&state);
+        }
+
+        costas_bank_step(b);
+    }
+
+    for (int ch = 0; ch < GOLDEN_LOOPS; ch++) {
+        g->costas[(ch * 2)] = b->d_phase[ch];
+        g->costas[(ch * 2) + 1] = b->d_freq[ch];
+    }
+
+    costas_bank_destroy(b);
+
+    return 0;
+}
+
+static int differ_float(const float a[], const float b[], int length) {
+    for (int i = 0; i < length; i++) {
+        if (fabsf(a[i] - b[i]) > (GOLDEN_TOLERANCE * (1.0f + fabsf(b[i]))))
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * The resampler is allowed a count of rounding
+ */
+static int differ_int16(const int16_t a[], const int16_t b[], int length, int slack) {
+    for (int i = 0; i < length; i++) {
+        if (abs(a[i] - b[i]) > slack)
+            return 1;
+    }
+
+    return 0;
+}
+
+static void report(const char *name, int differ) {
+    printf("golden   %-8s %s\n", name, (differ == 0) ? "ok" : "FAILED");
+}
+
+/*
+ * Returns the number of kernels that differ
+ */
+int golden_selftest(void) {
+    struct golden g;
+
+    if (golden_run(&g) != 0) {
+        printf("golden   FAILED to run\n");
+        return 1;
+    }
+
+    int rrc = differ_float(g.rrc, golden_rrc, GOLDEN_POINTS * 2);
+    int mix = differ_float(g.mix, golden_mix, GOLDEN_POINTS * 2);
+    int pcm = differ_int16(g.pcm, golden_pcm, GOLDEN_POINTS, 0);
+    int resample = differ_int16(g.resample, golden_resample, GOLDEN_POINTS, 1);
+    int viterbi = memcmp(g.viterbi, golden_viterbi, GOLDEN_POINTS) != 0;
+    int costas = differ_float(g.costas, golden_costas, GOLDEN_LOOPS * 2);
+
+    report("rrc_fir", rrc);
+    report("mix", mix);
+    report("pcm", pcm);
+    report("resample", resample);
+    report("viterbi", viterbi);
+    report("costas", costas);
+
+    return rrc + mix + pcm + resample + viterbi + costas;
+}
+
+static void print_floats(const char *name, const char *size, const float x[], int length) {
+    printf("static const float golden_%s[%s] = {", name, size);
+
+    for (int i = 0; i < length; i++) {
+        printf("%s%#.9gf%s", (i % 4) ? " " : "\n    ", x[i], (i < (length - 1)) ? "," : "\n");
+    }
+
+    printf("};\n\n");
+}
+
+static void print_ints(const char *type, const char *name, const int x[], int length) {
+    printf("static const %s golden_%s[GOLDEN_POINTS] = {", type, name);
+
+    for (int i = 0; i < length; i++) {
+        printf("%s%d%s", (i % 8) ? " " : "\n    ", x[i], (i < (length - 1)) ? "," : "\n");
+    }
+
+    printf("};\n\n");
+}
+
+/*
+ * The tables of this build, in the form above
+ */
+void golden_print(void) {
+    struct golden g;
+    int values[GOLDEN_POINTS];
+
+    if (golden_run(&g) != 0) {
+        fprintf(stderr, "Unable to run the kernels\n");
+        return;
+    }
+
+    printf("// %s kernels\n\n", dispatch_name(dispatch_level()));
+
+    print_floats("rrc", "GOLDEN_POINTS * 2", g.rrc, GOLDEN_POINTS * 2);
+    print_floats("mix", "GOLDEN_POINTS * 2", g.mix, GOLDEN_POINTS * 2);
+
+    for (int i = 0; i < GOLDEN_POINTS; i++) {
+        values[i] = g.pcm[i];
+    }
+
+    print_ints("int16_t", "pcm", values, GOLDEN_POINTS);
+
+    for (int i = 0; i < GOLDEN_POINTS; i++) {
+        values[i] = g.resample[i];
+    }
+
+    print_ints("int16_t", "resample", values, GOLDEN_POINTS);
+
+    for (int i = 0; i < GOLDEN_POINTS; i++) {
+        values[i] = g.viterbi[i];
+    }
+
+    print_ints("uint8_t", "viterbi", values, GOLDEN_POINTS);
+    print_floats("costas", "GOLDEN_LOOPS * 2", g.costas, GOLDEN_LOOPS * 2);
+}
@@ -0,0 +1,19 @@
+/*
+ * golden.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define GOLDEN_POINTS   16      // outputs kept of each kernel
+
+int golden_selftest(void);
+void golden_print(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,252 @@
+/*
+ * mapper.c
+ *
+ * Table driven constellation mapper and demapper
+ *
+ * BPSK, QPSK, 8PSK and 16QAM all share one decision
+ * method. Each constellation has a grid over the I/Q
+ * plane, built the first time it is used, giving the
+ * nearest point for every cell. A decision is then two
+ * multiplies and a table lookup, whatever the shape.
+ *
+ * The 16QAM square is turned 45 degrees so its corners
+ * land on the QPSK points, which lets a receiver tracking
+ * 16QAM take QPSK and BPSK symbols without upset.
+ */
+
+#include <stdint.h>
+#include <complex.h>
+#include <math.h>
+#include <float.h>
+#include <pthread.h>
+
+#include "qpsk.h"
+#include "mapper.h"
+#include "costas_loop.h"
+
+static struct mapper mappers[MOD_MODES];
+static pthread_once_t mappers_once = PTHREAD_ONCE_INIT;
+
+/*
+ * 16QAM levels per axis, Gray coded
+ */
+static const float qam_levels[4] = { -3.0f, -1.0f, 3.0f, 1.0f };
+
+static void mapper_regions(struct mapper *m) {
+    const float cell = (2.0f * MAPPER_RANGE) / MAPPER_GRID;
+    float dmin = FLT_MAX;
+    float sum = 0.0f;
+
+    for (int i = 0; i < m->points; i++) {
+        sum += cabsf(m->constellation[i]);
+
+        for (int j = i + 1; j < m->points; j++) {
+            complex float d = m->constellation[i] - m->constellation[j];
+            float d2 = crealf(d) * crealf(d) + cimagf(d) * cimagf(d);
+
+            if (d2 < dmin)
+                dmin = d2;
+        }
+    }
+
+    m->mean = sum / m->points;
+
+    /*
+     * A symbol on a point has soft bits 64 either
+     * side of an erasure, as the QPSK demapper had
+     */
+    m->soft_scale = 64.0f / dmin;
+
+    for (int q = 0; q < MAPPER_GRID; q++) {
+        for (int i = 0; i < MAPPER_GRID; i++) {
+            float re = -MAPPER_RANGE + (i + 0.5f) * cell;
+            float im = -MAPPER_RANGE + (q + 0.5f) * cell;
+            float best = FLT_MAX;
+            int nearest = 0;
+
+            for (int p = 0; p < m->points; p++) {
+                float dr = re - crealf(m->constellation[p]);
+                float di = im - cimagf(m->constellation[p]);
+                float d2 = dr * dr + di * di;
+
+                if (d2 < best) {
+                    best = d2;
+                    nearest = p;
+                }
+            }
+
+            m->region[(q * MAPPER_GRID) + i] = (uint8_t) nearest;
+        }
+    }
+}
+
+static void mappers_make(void) {
+    struct mapper *m;
+
+    m = &mappers[MOD_BPSK];
+    m->mode = MOD_BPSK;
+    m->bits = 1;
+    m->points = 2;
+    m->constellation[0] = 1.0f;
+    m->constellation[1] = -1.0f;
+
+    /*
+     * The original QPSK mapping. Its loop uses the
+     * Costas phase detector, which holds the points
+     * on the diagonals.
+     */
+    m = &mappers[MOD_QPSK];
+    m->mode = MOD_QPSK;
+    m->bits = 2;
+    m->points = 4;
+    m->settle = ROTATE45;
+    m->constellation[0] = 1.0f;
+    m->constellation[1] = I;
+    m->constellation[2] = -I;
+    m->constellation[3] = -1.0f;
+
+    m = &mappers[MOD_8PSK];
+    m->mode = MOD_8PSK;
+    m->bits = 3;
+    m->points = 8;
+
+    for (int k = 0; k < 8; k++) {
+        m->constellation[k ^ (k >> 1)] = cmplx(k * (TAU / 8.0));
+    }
+
+    m = &mappers[MOD_16QAM];
+    m->mode = MOD_16QAM;
+    m->bits = 4;
+    m->points = 16;
+
+    for (int k = 0; k < 16; k++) {
+        complex float point = qam_levels[k >> 2] + qam_levels[k & 0x3] * I;
+
+        m->constellation[k] = point * cmplx(ROTATE45) / (3.0f * sqrtf(2.0f));
+    }
+
+    for (int i = 0; i < MOD_MODES; i++) {
+        mapper_regions(&mappers[i]);
+    }
+}
+
+/*
+ * Returns NULL on error
+ */
+const struct mapper *mapper_get(ModID mode) {
+    if (mode < 0 || mode >= MOD_MODES)
+        return NULL;
+
+    pthread_once(&mappers_once, mappers_make);
+
+    return &mappers[mode];
+}
+
+/*
+ * Map m->bits bits, first bit most significant
+ */
+complex float mapper_map(const struct mapper *m, const int bits[]) {
+    int label = 0;
+
+    for (int i = 0; i < m->bits; i++) {
+        label = (label << 1) | (bits[i] & 0x1);
+    }
+
+    return m->constellation[label];
+}
+
+/*
+ * Nearest point label for a symbol at unit peak amplitude
+ */
+int mapper_decide(const struct mapper *m, complex float symbol) {
+    const float scale = MAPPER_GRID / (2.0f * MAPPER_RANGE);
+
+    int i = (int) ((crealf(symbol) + MAPPER_RANGE) * scale);
+    int q = (int) ((cimagf(symbol) + MAPPER_RANGE) * scale);
+
+    i = (i < 0) ? 0 : ((i >= MAPPER_GRID) ? (MAPPER_GRID - 1) : i);
+    q = (q < 0) ? 0 : ((q >= MAPPER_GRID) ? (MAPPER_GRID - 1) : q);
+
+    return m->region[(q * MAPPER_GRID) + i];
+}
+
+void mapper_demap(const struct mapper *m, complex float symbol, int bits[]) {
+    int label = mapper_decide(m, symbol);
+
+    for (int i = 0; i < m->bits; i++) {
+        bits[i] = (label >> (m->bits - 1 - i)) & 0x1;
+    }
+}
+
+/*
+ * Soft bits, 0 (sure of 0) to 255 (sure of 1), from the
+ * difference of the nearest points with each bit value
+ */
+void mapper_soft(const struct mapper *m, complex float symbol, uint8_t soft[]) {
+    float d2[MAPPER_POINTS];
+
+    for (int p = 0; p < m->points; p++) {
+        float dr = crealf(symbol) - crealf(m->constellation[p]);
+        float di = cimagf(symbol) - cimagf(m->constellation[p]);
+
+        d2[p] = dr * dr + di * di;
+    }
+
+    for (int i = 0; i < m->bits; i++) {
+        int shift = m->bits - 1 - i;
+        float zero = FLT_MAX;
+        float one = FLT_MAX;
+
+        for (int p = 0; p < m->points; p++) {
+            if ((p >> shift) & 0x1) {
+                if (d2[p] < one)
+                    one = d2[p];
+            } else if (d2[p] < zero) {
+                zero = d2[p];
+            }
+        }
+
+        float value = 128.0f + (zero - one) * m->soft_scale;
+
+        soft[i] = (uint8_t) ((value < 0.0f) ? 0.0f : ((value > 255.0f) ? 255.0f : value));
+    }
+}
+
+/*
+ * Phase error for the Costas loop, from a symbol as the
+ * loop has it, and the scale to unit peak amplitude.
+ *
+ * QPSK keeps the Costas phase detector. The others are
+ * decision directed, the sine of the angle between the
+ * symbol and its decision, so BPSK is only good on BPSK
+ * symbols.
+ *
+ * The lock detector wants the points on the diagonals,
+ * so lock gets the residual turned 45 degrees.
+ */
+float mapper_phase_error(const struct mapper *m, complex float symbol, float scale, complex float *lock) {
+    float re = crealf(symbol);
+    float im = cimagf(symbol);
+    float mag2 = re * re + im * im;
+
+    if (m->mode == MOD_QPSK) {
+        *lock = symbol;
+
+        return phase_detector(symbol);
+    }
+
+    if (mag2 <= 0.0f) {
+        *lock = 0.0f;
+
+        return 0.0f;
+    }
+
+    complex float d = m->constellation[mapper_decide(m, symbol * scale)];
+    float dre = re * crealf(d) + im * cimagf(d);
+    float dim = im * crealf(d) - re * cimagf(d);
+    float norm = 1.0f / sqrtf(mag2 * (crealf(d) * crealf(d) + cimagf(d) * cimagf(d)));
+
+    *lock = (dre + dim * I) * norm * cmplx(ROTATE45);
+
+    return dim * norm;
+}
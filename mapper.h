@@ -0,0 +1,58 @@
+/*
+ * mapper.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <complex.h>
+
+#define MAPPER_POINTS   16      // largest constellation
+#define MAPPER_BITS     4       // most bits per symbol
+#define MAPPER_GRID     64      // decision cells per axis
+#define MAPPER_RANGE    1.5f    // grid covers +/- this
+
+typedef enum {
+    MOD_BPSK,
+    MOD_QPSK,
+    MOD_8PSK,
+    MOD_16QAM,
+    MOD_MODES
+} ModID;
+
+/*
+ * A constellation, indexed by its Gray coded bit label
+ * with the first bit most significant, and the nearest
+ * point for each cell of a grid over the I/Q plane.
+ *
+ * The peak amplitude is 1.0, and every constellation
+ * holds the points 1 and -1. The larger ones also hold
+ * j and -j, so the sync word is common to all of them.
+ */
+struct mapper {
+    ModID mode;
+    int bits;                   // per symbol
+    int points;
+    float mean;                 // mean amplitude of the points
+    float settle;               // radians, where the Costas loop holds the points
+    float soft_scale;           // soft bit steps per unit squared distance
+
+    complex float constellation[MAPPER_POINTS];
+    uint8_t region[MAPPER_GRID * MAPPER_GRID];
+};
+
+const struct mapper *mapper_get(ModID);
+complex float mapper_map(const struct mapper *, const int []);
+int mapper_decide(const struct mapper *, complex float);
+void mapper_demap(const struct mapper *, complex float, int []);
+void mapper_soft(const struct mapper *, complex float, uint8_t []);
+float mapper_phase_error(const struct mapper *, complex float, float, complex float *);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,260 @@
+/*
+ * mixer.c
+ *
+ * Carrier translation
+ *
+ * A recursive phasor makes every sample wait on the one
+ * before, and needs renormalizing as it drifts. When the
+ * carrier is a rational fraction of the sample rate the
+ * phasors repeat, 32 samples for 1500 Hz at 9600, so one
+ * period is tabled and the mix becomes a plain multiply
+ * of two arrays, which the compiler vectorizes.
+ *
+ * Other carriers use an NCO with a double precision phase.
+ * The phasors of a block are the exact phase at the start
+ * times a fixed table of steps, so there is no drift and
+ * no chain longer than one multiply.
+ *
+ * A frequency offset is a second, small NCO on top, so
+ * changing it never rebuilds the shared table.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "qpsk.h"
+#include "mixer.h"
+#include "pcm.h"
+
+/*
+ * Returns NULL if the carrier does not repeat
+ * within MIXER_PERIOD samples, or on error
+ */
+struct mixer_table *mixer_table_create(double freq, double fs) {
+    int period = 0;
+
+    for (int n = 1; n <= MIXER_PERIOD; n++) {
+        double cycles = freq * n / fs;
+
+        if (fabs(cycles - round(cycles)) < 1e-9) {
+            period = n;
+            break;
+        }
+    }
+
+    if (period == 0)
+        return NULL;
+
+    struct mixer_table *t = calloc(1, sizeof (struct mixer_table));
+
+    if (t == NULL)
+        return NULL;
+
+    t->period = period;
+    t->re = calloc(period + MIXER_BLOCK, sizeof (float));
+    t->im = calloc(period + MIXER_BLOCK, sizeof (float));
+
+    if (t->re == NULL || t->im == NULL) {
+        mixer_table_destroy(t);
+        return NULL;
+    }
+
+    for (int n = 0; n < (period + MIXER_BLOCK); n++) {
+        double theta = TAU * fmod(freq * n / fs, 1.0);
+
+        t->re[n] = (float) cos(theta);
+        t->im[n] = (float) sin(theta);
+    }
+
+    return t;
+}
+
+void mixer_table_destroy(struct mixer_table *t) {
+    if (t == NULL)
+        return;
+
+    free(t->re);
+    free(t->im);
+    free(t);
+}
+
+static void nco_init(struct nco *nco, double freq, double fs) {
+    nco->phase = 0.0;
+    nco->step = freq / fs;
+
+    for (int k = 0; k < MIXER_BLOCK; k++) {
+        double theta = TAU * fmod(nco->step * k, 1.0);
+
+        nco->re[k] = (float) cos(theta);
+        nco->im[k] = (float) sin(theta);
+    }
+}
+
+/*
+ * The next length phasors, at most MIXER_BLOCK
+ */
+static void nco_block(struct nco *nco, float re[], float im[], int length) {
+    const float br = (float) cos(TAU * nco->phase);
+    const float bi = (float) sin(TAU * nco->phase);
+
+    for (int k = 0; k < length; k++) {
+        re[k] = br * nco->re[k] - bi * nco->im[k];
+        im[k] = br * nco->im[k] + bi * nco->re[k];
+    }
+
+    nco->phase += nco->step * length;
+    nco->phase -= floor(nco->phase);
+}
+
+/*
+ * Retune a free standing NCO to hz, keeping its phase
+ */
+void nco_set(struct nco *nco, double hz, double fs) {
+    double phase = nco->phase;
+
+    nco_init(nco, hz, fs);
+
+    nco->phase = phase;
+}
+
+/*
+ * Move complex baseband down by the NCO frequency, in place
+ */
+void nco_shift(struct nco *nco, complex float x[], int length) {
+    float re[MIXER_BLOCK];
+    float im[MIXER_BLOCK];
+
+    for (int done = 0; done < length; done += MIXER_BLOCK) {
+        int count = ((length - done) < MIXER_BLOCK) ? (length - done) : MIXER_BLOCK;
+
+        nco_block(nco, re, im, count);
+
+        for (int k = 0; k < count; k++) {
+            x[done + k] *= (re[k] - im[k] * I);
+        }
+    }
+}
+
+/*
+ * The carrier comes from the table when there is one,
+ * else from the NCO at freq
+ */
+void mixer_init(struct mixer *m, const struct mixer_table *table, double freq, double fs) {
+    m->table = table;
+    m->index = 0;
+    m->offsetting = false;
+
+    nco_init(&m->carrier, freq, fs);
+    nco_init(&m->offset, 0.0, fs);
+}
+
+/*
+ * Move the carrier by hz, 0.0 for none
+ */
+void mixer_set_offset(struct mixer *m, double hz, double fs) {
+    nco_set(&m->offset, hz, fs);
+
+    m->offsetting = (hz != 0.0);
+}
+
+/*
+ * Fill m->re and m->im with the next length phasors
+ */
+static void mixer_block(struct mixer *m, int length) {
+    if (m->table != NULL) {
+        const float *tr = &m->table->re[m->index];
+        const float *ti = &m->table->im[m->index];
+
+        for (int k = 0; k < length; k++) {
+            m->re[k] = tr[k];
+            m->im[k] = ti[k];
+        }
+
+        m->index = (m->index + length) % m->table->period;
+    } else {
+        nco_block(&m->carrier, m->re, m->im, length);
+    }
+
+    if (m->offsetting) {
+        float ore[MIXER_BLOCK];
+        float oim[MIXER_BLOCK];
+
+        nco_block(&m->offset, ore, oim, length);
+
+        for (int k = 0; k < length; k++) {
+            float re = m->re[k] * ore[k] - m->im[k] * oim[k];
+            float im = m->re[k] * oim[k] + m->im[k] * ore[k];
+
+            m->re[k] = re;
+            m->im[k] = im;
+        }
+    }
+}
+
+/*
+ * Translate real PCM, one channel of channels interleaved,
+ * down from the carrier
+ */
+void mixer_down(struct mixer *m, const int16_t in[], int channels, int channel,
+        complex float out[], int length) {
+    for (int done = 0; done < length; done += MIXER_BLOCK) {
+        int count = ((length - done) < MIXER_BLOCK) ? (length - done) : MIXER_BLOCK;
+
+        mixer_block(m, count);
+
+        pcm_mix_down(&in[(done * channels)], channels, channel, m->re, m->im,
+                &out[done], count, (1.0f / PCM_SCALE));
+    }
+}
+
+/*
+ * As mixer_down(), from float samples in int16 units,
+ * such as the resampled sound card, so they are not
+ * rounded to int16 between the resampler and the mix
+ */
+void mixer_down_real(struct mixer *m, const float in[], complex float out[], int length) {
+    const float scale = (1.0f / PCM_SCALE);
+
+    for (int done = 0; done < length; done += MIXER_BLOCK) {
+        int count = ((length - done) < MIXER_BLOCK) ? (length - done) : MIXER_BLOCK;
+
+        mixer_block(m, count);
+
+        for (int k = 0; k < count; k++) {
+            float x = in[done + k] * scale;
+
+            out[done + k] = (x * m->re[k]) - (x * m->im[k]) * I;
+        }
+    }
+}
+
+/*
+ * Translate complex baseband up to the carrier,
+ * giving the real part as PCM
+ */
+void mixer_up(struct mixer *m, const complex float in[], int16_t out[], int length) {
+    for (int done = 0; done < length; done += MIXER_BLOCK) {
+        int count = ((length - done) < MIXER_BLOCK) ? (length - done) : MIXER_BLOCK;
+
+        mixer_block(m, count);
+
+        pcm_mix_up(&in[done], m->re, m->im, &out[done], count, PCM_SCALE);
+    }
+}
+
+/*
+ * As mixer_up(), but the real part is left as float in
+ * int16 units, unrounded and unclipped, for the sound
+ * card resampler to round once on the way out
+ */
+void mixer_up_real(struct mixer *m, const complex float in[], float out[], int length) {
+    for (int done = 0; done < length; done += MIXER_BLOCK) {
+        int count = ((length - done) < MIXER_BLOCK) ? (length - done) : MIXER_BLOCK;
+
+        mixer_block(m, count);
+
+        for (int k = 0; k < count; k++) {
+            out[done + k] = (crealf(in[done + k]) * m->re[k] - cimagf(in[done + k]) * m->im[k]) * PCM_SCALE;
+        }
+    }
+}
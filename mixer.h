@@ -0,0 +1,71 @@
+/*
+ * mixer.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <complex.h>
+
+#define MIXER_BLOCK     64      // samples per phasor block
+#define MIXER_PERIOD    4096    // longest periodic table
+
+/*
+ * One period of a carrier at a rational fraction of the
+ * sample rate, with a block more on the end so any block
+ * can be read without wrapping. Shared read-only.
+ */
+struct mixer_table {
+    int period;
+    float *re;
+    float *im;
+};
+
+/*
+ * Phase accumulator in cycles, with the phasor steps
+ * of one block, for carriers that are not periodic and
+ * for the frequency offset
+ */
+struct nco {
+    double phase;
+    double step;
+    float re[MIXER_BLOCK];
+    float im[MIXER_BLOCK];
+};
+
+/*
+ * Per-channel, per-direction carrier
+ */
+struct mixer {
+    const struct mixer_table *table;    // NULL to use the carrier NCO
+    int index;                          // position in the table period
+
+    struct nco carrier;
+    struct nco offset;
+    bool offsetting;
+
+    float re[MIXER_BLOCK];              // phasors of the current block
+    float im[MIXER_BLOCK];
+};
+
+struct mixer_table *mixer_table_create(double, double);
+void mixer_table_destroy(struct mixer_table *);
+
+void mixer_init(struct mixer *, const struct mixer_table *, double, double);
+void mixer_set_offset(struct mixer *, double, double);
+void nco_set(struct nco *, double, double);
+void nco_shift(struct nco *, complex float [], int);
+void mixer_down(struct mixer *, const int16_t [], int, int, complex float [], int);
+void mixer_down_real(struct mixer *, const float [], complex float [], int);
+void mixer_up(struct mixer *, const complex float [], int16_t [], int);
+void mixer_up_real(struct mixer *, const complex float [], float [], int);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,859 @@
+/*
+ * modem.c
+ *
+ * QPSK modem channel, January 2023
+ *
+ * The transmit and receive functions work on a channel,
+ * so any number of channels, at any mix of rate profiles,
+ * can run in one process.
+ */
+
+// Includes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <complex.h>
+#include <string.h>
+#include <math.h>
+
+#include "qpsk.h"
+#include "modem.h"
+#include "costas_loop.h"
+#include "rrc_fir.h"
+#include "arena.h"
+#include "mapper.h"
+#include "pcm.h"
+#include "timing.h"
+
+// Prototypes
+
+static void rx_process(struct channel *);
+static void tx_shape(struct channel *, complex float [], const complex float [], int);
+
+/*
+ * Create a channel using the shared tables
+ * for the given rate profile.
+ *
+ * Returns NULL on error
+ */
+struct channel *channel_create(const struct rate_profile *profile) {
+    struct channel *chan = calloc(1, sizeof (struct channel));
+
+    if (chan == NULL)
+        return NULL;
+
+    if ((chan->tables = profile_acquire(profile)) == NULL) {
+        free(chan);
+        return NULL;
+    }
+
+    chan->profile = &chan->tables->profile;
+
+    int ntaps = chan->profile->ntaps;
+    int frame_size = chan->profile->frame_size;
+    int symbols = frame_size / chan->profile->cycles;
+
+    /*
+     * The receive and transmit scratch are separate arenas,
+     * as the two sides may run on different threads.
+     * Transmit works a frame of symbols at a time, and
+     * tx_audio() a frame of carrier as well.
+     */
+    size_t rx_work = arena_round(symbols * sizeof (long));
+    size_t tx_work = arena_round(symbols * sizeof (complex float)) +
+                     arena_round(frame_size * sizeof (complex float)) +
+                     arena_round(frame_size * sizeof (float));
+
+    size_t size = arena_round(RRC_MEMORY(ntaps) * sizeof (complex float)) * 2 +
+                  arena_round(frame_size * sizeof (complex float)) +
+                  arena_round(symbols * PACKET_TIMINGS * sizeof (complex float)) +
+                  arena_round(symbols * MAPPER_BITS * sizeof (uint8_t)) +
+                  rx_work + tx_work;
+
+    if (arena_init(&chan->arena, size) != 0) {
+        profile_release(chan->tables);
+        free(chan);
+        return NULL;
+    }
+
+    chan->tx_filter = arena_alloc(&chan->arena, RRC_MEMORY(ntaps) * sizeof (complex float));
+    chan->rx_filter = arena_alloc(&chan->arena, RRC_MEMORY(ntaps) * sizeof (complex float));
+    chan->input_frame = arena_alloc(&chan->arena, frame_size * sizeof (complex float));
+    chan->costas_frame = arena_alloc(&chan->arena, symbols * PACKET_TIMINGS * sizeof (complex float));
+    chan->rx_bits = arena_alloc(&chan->arena, symbols * MAPPER_BITS * sizeof (uint8_t));
+
+    if (chan->tx_filter == NULL || chan->rx_filter == NULL ||
+            chan->input_frame == NULL ||
+            chan->costas_frame == NULL || chan->rx_bits == NULL ||
+            arena_carve(&chan->arena, &chan->rx_work, rx_work) != 0 ||
+            arena_carve(&chan->arena, &chan->tx_work, tx_work) != 0) {
+        channel_destroy(chan);
+        return NULL;
+    }
+
+    /*
+     * The loop terms are radians per symbol, from the
+     * profile's Hz. Pull in at the wide end, then narrow
+     * once locked.
+     *
+     * A quarter turn per symbol looks the same to the
+     * QPSK detector as none, so on its own the loop is
+     * held within an eighth of the symbol rate. When the
+     * profile has a pull-in, the frequency locked loop
+     * ahead of the filter takes the offset, and the loop
+     * is held to twice its bandwidth, so it cannot settle
+     * a turn of the constellation away while that pulls in.
+     */
+    const float radians = (float) (TAU / chan->profile->rs);
+    const float limit = ((chan->profile->pull > 0.0f) ? (2.0f * chan->profile->loop_wide) :
+            (chan->profile->rs / 8.0f)) * radians;
+
+    create_control_loop(&chan->costas, chan->profile->loop_wide * radians, -limit, limit);
+    set_gear_shift(&chan->costas, chan->profile->loop_wide * radians,
+            chan->profile->loop_narrow * radians);
+
+    nco_set(&chan->fll, 0.0, chan->profile->fs);
+    atomic_init(&chan->fll_hz, 0.0f);
+
+    mixer_init(&chan->tx_mixer, chan->tables->carrier, chan->profile->center, chan->profile->fs);
+    mixer_init(&chan->rx_mixer, chan->tables->carrier, chan->profile->center, chan->profile->fs);
+
+    if ((chan->timing = timing_create(chan->profile->cycles, frame_size)) == NULL) {
+        channel_destroy(chan);
+        return NULL;
+    }
+
+    telemetry_init(&chan->telemetry);
+
+    chan->pcm_channels = 1;
+    chan->pcm_channel = 0;
+
+    chan->fbb_offset_freq = chan->profile->center;
+
+    chan->mapper = mapper_get(MOD_QPSK);
+
+    return chan;
+}
+
+void channel_destroy(struct channel *chan) {
+    if (chan == NULL)
+        return;
+
+    arena_free(&chan->arena);
+
+    timing_destroy(chan->timing);
+    resampler_destroy(chan->rx_audio);
+    resampler_destroy(chan->tx_audio);
+    free(chan->audio_frame);
+    sync_detect_destroy(chan->sync);
+    packet_rx_destroy(chan->packets);
+    profile_release(chan->tables);
+
+    free(chan);
+}
+
+/*
+ * The last link quality snapshot, which any
+ * thread may take while the channel runs
+ */
+void channel_telemetry(struct channel *chan, struct link_stats *stats) {
+    telemetry_read(&chan->telemetry, stats);
+}
+
+/*
+ * Report the workspace size and high water marks
+ */
+void channel_workspace(const struct channel *chan, struct workspace *ws) {
+    ws->size = chan->arena.size;
+    ws->used = arena_peak(&chan->arena);
+    ws->rx_peak = arena_peak(&chan->rx_work);
+    ws->rx_size = chan->rx_work.size;
+    ws->tx_peak = arena_peak(&chan->tx_work);
+    ws->tx_size = chan->tx_work.size;
+}
+
+/*
+ * Look for a sync word in the received symbols, given
+ * as bit pairs in the order of qpsk_packet_mod(). The
+ * threshold is the CFAR ratio, 0.0 for the default.
+ *
+ * The QPSK Costas loop settles the constellation on the
+ * diagonals, so the word is rotated 45 degrees to match.
+ * The correlation ignores any other fixed rotation.
+ *
+ * Returns -1 on error
+ */
+int channel_set_sync(struct channel *chan, const int bits[], int length, float threshold) {
+    const struct mapper *qpsk = mapper_get(MOD_QPSK);
+    complex float *pattern = malloc(length * sizeof (complex float));
+
+    if (pattern == NULL)
+        return -1;
+
+    for (int i = 0; i < length; i++) {
+        pattern[i] = mapper_map(qpsk, &bits[(i * 2)]) * cmplx(qpsk->settle);
+    }
+
+    struct sync_detect *sd = sync_detect_create(pattern, length, threshold);
+
+    free(pattern);
+
+    if (sd == NULL)
+        return -1;
+
+    sync_detect_destroy(chan->sync);
+    chan->sync = sd;
+
+    return 0;
+}
+
+/*
+ * Receive coded packets at the given rate, which also
+ * sets the sync word. The payloads decoded in each frame
+ * are in chan->packets.
+ *
+ * Returns -1 on error
+ */
+int channel_set_packets(struct channel *chan, CodeRate rate) {
+    int bits[(PACKET_SYNC * 2)];
+    struct packet_rx *prx = packet_rx_create(rate, chan->hypotheses);
+
+    if (prx == NULL)
+        return -1;
+
+    if (channel_set_sync(chan, bits, packet_sync_bits(bits), 0.0f) != 0) {
+        packet_rx_destroy(prx);
+        return -1;
+    }
+
+    packet_rx_destroy(chan->packets);
+    chan->packets = prx;
+
+    return 0;
+}
+
+/*
+ * Move the transmit and receive carriers by a known
+ * frequency offset in Hz, such as a radio's error.
+ * The shared carrier tables are untouched.
+ */
+void channel_set_offset(struct channel *chan, double tx_hz, double rx_hz) {
+    mixer_set_offset(&chan->tx_mixer, tx_hz, chan->profile->fs);
+    mixer_set_offset(&chan->rx_mixer, rx_hz, chan->profile->fs);
+}
+
+/*
+ * Take the receive PCM as one channel of channels
+ * interleaved, such as the left or right of stereo.
+ * Each rx_frame() is then frame_size frames.
+ *
+ * Returns -1 on error
+ */
+int channel_set_input(struct channel *chan, int channels, int channel) {
+    if (channels < 1 || channel < 0 || channel >= channels)
+        return -1;
+
+    chan->pcm_channels = channels;
+    chan->pcm_channel = channel;
+
+    return 0;
+}
+
+/*
+ * Take the symbols between samples, at the fractional
+ * timing offset, or at the nearest sample
+ */
+void channel_set_timing(struct channel *chan, bool interpolate) {
+    chan->timing->interpolate = interpolate;
+}
+
+/*
+ * Decode packets under up to PACKET_TIMINGS timing
+ * hypotheses, and each phase ambiguity, when the first
+ * fails its header or CRC, or 0 for only the first.
+ * The packet decoder is restarted if there is one.
+ *
+ * Returns -1 on error
+ */
+int channel_set_hypotheses(struct channel *chan, int timings) {
+    if (timings < 0 || timings > PACKET_TIMINGS)
+        return -1;
+
+    int previous = chan->hypotheses;
+
+    chan->hypotheses = timings;
+
+    if (chan->packets != NULL && channel_set_packets(chan, chan->packets->rate) != 0) {
+        chan->hypotheses = previous;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Run the channel from a sound card at rate, such as
+ * 44100 or 48000, through rx_audio() and tx_audio(),
+ * which resample to and from the profile rate. The
+ * channels given to channel_set_input() are taken from
+ * the card. A rate of 0 turns it off.
+ *
+ * Returns -1 on error
+ */
+int channel_set_audio(struct channel *chan, int rate) {
+    const int fs = (int) chan->profile->fs;
+    struct resampler *rx = NULL, *tx = NULL;
+    float *frame = NULL;
+
+    if (rate < 0)
+        return -1;
+
+    if (rate > 0) {
+        rx = resampler_create(rate, fs);
+        tx = resampler_create(fs, rate);
+
+        if (rx != NULL) {
+            frame = malloc((chan->profile->frame_size + resampler_bound(rx, RESAMPLE_BLOCK)) *
+                    sizeof (float));
+        }
+
+        if (rx == NULL || tx == NULL || frame == NULL) {
+            resampler_destroy(rx);
+            resampler_destroy(tx);
+            free(frame);
+            return -1;
+        }
+    }
+
+    resampler_destroy(chan->rx_audio);
+    resampler_destroy(chan->tx_audio);
+    free(chan->audio_frame);
+
+    chan->rx_audio = rx;
+    chan->tx_audio = tx;
+    chan->audio_frame = frame;
+    chan->audio_count = 0;
+
+    return 0;
+}
+
+/*
+ * Use the constellation of the given mode for the
+ * loop phase detector and the received bits, which
+ * are then mode->bits per symbol.
+ *
+ * Packets in modes whose points all belong to this
+ * constellation can be received as well, so BPSK and
+ * QPSK packets need no change of mode.
+ *
+ * Returns -1 on error
+ */
+int channel_set_mode(struct channel *chan, ModID mode) {
+    const struct mapper *m = mapper_get(mode);
+
+    if (m == NULL)
+        return -1;
+
+    chan->mapper = m;
+
+    return 0;
+}
+
+/*
+ * Receive function
+ * 
+ * QPSK at the profile symbol and sample rates,
+ * 2400 baud at 9600 samples/sec by default.
+ */
+void rx_frame(struct channel *chan, int16_t in[]) {
+    rx_mix(chan, in, chan->input_frame);
+    rx_process(chan);
+}
+
+/*
+ * Receive function for complex samples
+ * already at baseband, such as from the channelizer
+ */
+void rx_baseband_frame(struct channel *chan, complex float in[]) {
+    memcpy(chan->input_frame, in, chan->profile->frame_size * sizeof (complex float));
+
+    rx_process(chan);
+}
+
+/*
+ * Receive function for interleaved int16 IQ pairs,
+ * already at baseband, such as from an SDR
+ */
+void rx_iq_frame(struct channel *chan, int16_t iq[]) {
+    pcm_iq_to_complex(iq, chan->input_frame, chan->profile->frame_size, (1.0f / PCM_SCALE));
+
+    rx_process(chan);
+}
+
+/*
+ * Receive function for sound card audio, at the rate of
+ * channel_set_audio(). Takes input until a whole frame is
+ * resampled, then receives it as rx_frame() and sets ready,
+ * so the caller can take the packets before calling again
+ * with the rest.
+ *
+ * Returns the number of input frames taken
+ */
+int rx_audio(struct channel *chan, const int16_t in[], int length, bool *ready) {
+    const int frame_size = chan->profile->frame_size;
+    int done = 0;
+
+    *ready = false;
+
+    while (chan->audio_count < frame_size && done < length) {
+        int n = ((length - done) < RESAMPLE_BLOCK) ? (length - done) : RESAMPLE_BLOCK;
+
+        chan->audio_count += resampler_to_float(chan->rx_audio, &in[(long) done * chan->pcm_channels],
+                chan->pcm_channels, chan->pcm_channel, n, &chan->audio_frame[chan->audio_count]);
+        done += n;
+    }
+
+    if (chan->audio_count >= frame_size) {
+        mixer_down_real(&chan->rx_mixer, chan->audio_frame, chan->input_frame, frame_size);
+        rx_process(chan);
+
+        chan->audio_count -= frame_size;
+        memmove(chan->audio_frame, &chan->audio_frame[frame_size], chan->audio_count * sizeof (float));
+
+        *ready = true;
+    }
+
+    return done;
+}
+
+/*
+ * Transmit function for the sound card, at the rate of
+ * channel_set_audio(). As tx_frame(), but the carrier is
+ * resampled as float, and only rounded to int16 at the
+ * sound card rate. out holds resampler_bound(chan->tx_audio,
+ * length times cycles).
+ *
+ * Returns the number of samples put out
+ */
+int tx_audio(struct channel *chan, complex float symbol[], int length, int16_t out[]) {
+    const struct rate_profile *p = chan->profile;
+    const int cycles = p->cycles;
+    const int chunk = (p->frame_size / cycles);
+    int produced = 0;
+
+    size_t mark = arena_mark(&chan->tx_work);
+    complex float *signal = arena_alloc(&chan->tx_work, p->frame_size * sizeof (complex float));
+    float *carrier = arena_alloc(&chan->tx_work, p->frame_size * sizeof (float));
+
+    for (int done = 0; done < length; done += chunk) {
+        int count = ((length - done) < chunk) ? (length - done) : chunk;
+
+        tx_shape(chan, signal, &symbol[done], count);
+        mixer_up_real(&chan->tx_mixer, signal, carrier, (count * cycles));
+
+        produced += resampler_from_float(chan->tx_audio, carrier, (count * cycles), &out[produced]);
+    }
+
+    arena_reset(&chan->tx_work, mark);
+
+    return produced;
+}
+
+/*
+ * Remove any frequency and timing offsets
+ */
+static void rx_process(struct channel *chan) {
+    long base;
+
+    rx_filter(chan, chan->input_frame);
+    base = rx_timing(chan, chan->input_frame, chan->costas_frame);
+    rx_costas(chan, chan->costas_frame, base, chan->rx_bits);
+}
+
+/*
+ * The receive stages, which the pipeline runs on
+ * separate cores. Each only touches its own part of
+ * the channel, so the stages may run concurrently
+ * on successive frames.
+ */
+
+/*
+ * Translate the PCM audio down from the carrier,
+ * converting to complex samples at the profile sample rate
+ */
+void rx_mix(struct channel *chan, int16_t in[], complex float out[]) {
+    mixer_down(&chan->rx_mixer, in, chan->pcm_channels, chan->pcm_channel,
+            out, chan->profile->frame_size);
+}
+
+/*
+ * Raised Root Cosine Filter, after taking out the
+ * coarse carrier offset, when the profile has one.
+ *
+ * The filtered signal times the sample before has the
+ * angle of the offset per sample, as the pulse and the
+ * noise have a real autocorrelation. It is unambiguous
+ * to half the sample rate, where the Costas loop is
+ * only good to an eighth of the symbol rate.
+ */
+void rx_filter(struct channel *chan, complex float samples[]) {
+    const struct rate_profile *p = chan->profile;
+
+    if (p->pull > 0.0f)
+        nco_shift(&chan->fll, samples, p->frame_size);
+
+    rrc_fir(chan->tables->coeffs, p->ntaps, chan->rx_filter, samples, p->frame_size);
+
+    if (p->pull <= 0.0f)
+        return;
+
+    complex float last = chan->fll_last;
+    complex float sum = 0.0f;
+
+    for (int i = 0; i < p->frame_size; i++) {
+        sum += samples[i] * conjf(last);
+        last = samples[i];
+    }
+
+    chan->fll_last = last;
+    chan->fll_line += FLL_SMOOTH * (sum - chan->fll_line);
+
+    if (chan->fll_line == 0.0f)
+        return;
+
+    /*
+     * The lag product of the data has a deal of self noise,
+     * and the angle of the line is as much that of its
+     * first frame as of a full line, so the gain comes in
+     * as the line fills, or a few frames at the start can
+     * throw the FLL past where the Costas loop holds
+     */
+    if (chan->fll_frames < (int) (1.0f / FLL_SMOOTH))
+        chan->fll_frames++;
+
+    float last_hz = atomic_load_explicit(&chan->fll_hz, memory_order_relaxed);
+    float hz = last_hz + (FLL_GAIN * FLL_SMOOTH * chan->fll_frames) * cargf(chan->fll_line) *
+               p->fs / (float) TAU;
+
+    hz = fminf(fmaxf(hz, -p->pull), p->pull);
+
+    /*
+     * The line holds the lag products from before the
+     * correction, so turn it by the correction too, or
+     * the loop goes on pulling on what it has taken out
+     * and overshoots, further than the Costas loop holds
+     */
+    chan->fll_line *= cexpf(-I * (float) TAU * (hz - last_hz) / p->fs);
+
+    atomic_store_explicit(&chan->fll_hz, hz, memory_order_relaxed);
+    nco_set(&chan->fll, hz, p->fs);
+}
+
+/*
+ * Find the timing offset and decimate to the symbol rate.
+ * The symbols returned are those of the previous frame,
+ * followed by a frame for each other timing hypothesis,
+ * alternately later and earlier by PACKET_SPREAD.
+ *
+ * Returns the sample offset of the first symbol, or -1
+ * if there was no previous frame
+ */
+long rx_timing(struct channel *chan, complex float input_frame[], complex float out[]) {
+    const struct rate_profile *p = chan->profile;
+    const int frame_size = p->frame_size;
+
+    float offset = timing_process(chan->timing, input_frame, out);
+
+    for (int k = 1; k < chan->hypotheses; k++) {
+        float spread = PACKET_SPREAD * p->cycles * ((k + 1) / 2);
+
+        timing_sample(chan->timing, offset + ((k & 0x1) ? spread : -spread),
+                &out[k * (frame_size / p->cycles)]);
+    }
+
+    /*
+     * The symbol power at eight points across the symbol,
+     * the peak at full scale
+     */
+    if (diag_want(chan->diag, DIAG_HISTOGRAM)) {
+        const float *power = chan->timing->power;
+        float peak = 0.0f;
+        uint16_t bins[8];
+
+        for (int i = 0; i < p->cycles; i++) {
+            peak = fmaxf(peak, power[i]);
+        }
+
+        for (int i = 0; i < 8; i++) {
+            bins[i] = (peak > 0.0f) ? (uint16_t) (65535.0f * power[(i * p->cycles) / 8] / peak) : 0;
+        }
+
+        diag_put(chan->diag, DIAG_HISTOGRAM, chan->diag_id, bins, sizeof (bins));
+    }
+
+    if (diag_want(chan->diag, DIAG_TIMING))
+        diag_put(chan->diag, DIAG_TIMING, chan->diag_id, &offset, sizeof (float));
+
+    telemetry_timing(&chan->telemetry, offset);
+
+    /*
+     * The output is the previous input frame,
+     * so find where it was sampled from
+     */
+    long base = chan->sample_count - frame_size + lrintf(offset);
+
+    chan->sample_count += frame_size;
+
+    return (chan->sample_count > frame_size) ? base : -1;
+}
+
+/*
+ * Costas Loop over the decimated frame, derotating
+ * the symbols in place, and demodulating a bit pair
+ * per symbol. base is the sample offset of the first.
+ * The frames of any other timing hypotheses are
+ * derotated alike, but not demodulated.
+ */
+void rx_costas(struct channel *chan, complex float costas_frame[], long base, uint8_t out[]) {
+    const struct rate_profile *p = chan->profile;
+    const struct mapper *m = chan->mapper;
+    const int cycles = p->cycles;
+    const int symbols = (p->frame_size / cycles);
+    const int timings = (chan->hypotheses > 0) ? chan->hypotheses : 1;
+    const complex float settle = cmplxconj(m->settle);
+    const struct mapper *qpsk = mapper_get(MOD_QPSK);
+    const complex float axes = cmplx(ROTATE45);
+
+    complex float lock;
+
+    /*
+     * BPSK decisions only hold on BPSK symbols, as a QPSK
+     * point on the imaginary axis pulls the other way. The
+     * idle, sync word and header are QPSK, so those have
+     * the Costas detector, turned to hold the points on the
+     * axes, and only a BPSK payload whose header is in has
+     * the BPSK decisions.
+     */
+    int payload = 0;
+
+    if (m->mode == MOD_BPSK && chan->packets != NULL) {
+        long until = packet_rx_payload(chan->packets, MOD_BPSK) - chan->packets->count;
+
+        payload = (until > symbols) ? symbols : (int) until;
+    }
+
+    for (int i = 0; i < symbols; i++) {
+        complex float derotate = cmplxconj(get_phase(&chan->costas));
+
+        for (int k = 0; k < timings; k++) {
+            costas_frame[(k * symbols) + i] *= derotate;
+        }
+
+        if (diag_want(chan->diag, DIAG_CONSTELLATION)) {
+            float iq[2] = { crealf(costas_frame[i]), cimagf(costas_frame[i]) };
+
+            diag_put(chan->diag, DIAG_CONSTELLATION, chan->diag_id, iq, sizeof (iq));
+        }
+
+        /*
+         * There is no AGC, so the decisions are scaled by
+         * the amplitude of a unit point, which is the ratio
+         * of each symbol to its decision. The mean amplitude
+         * would differ between the QPSK idle and a 16QAM
+         * payload, where every point of both is at the same
+         * scale. The largest recent symbol bounds it, so it
+         * cannot be left above a fall in level, taking the
+         * corners for inner points.
+         */
+        float level = cabsf(costas_frame[i]);
+
+        chan->rx_level = (chan->rx_level > 0.0f) ?
+                (chan->rx_level + LEVEL_GAIN * (level - chan->rx_level)) : level;
+        chan->rx_peak = fmaxf(level, chan->rx_peak * PEAK_DECAY);
+
+        if (chan->rx_gain <= 0.0f)
+            chan->rx_gain = level;
+
+        float scale = (chan->rx_gain > 0.0f) ? (1.0f / chan->rx_gain) : 0.0f;
+
+        const struct mapper *d = (m->mode == MOD_BPSK && i >= payload) ? qpsk : m;
+
+        if (d != m) {
+            chan->d_error = mapper_phase_error(qpsk, costas_frame[i] * axes, scale, &lock);
+        } else {
+            chan->d_error = mapper_phase_error(m, costas_frame[i], scale, &lock);
+        }
+
+        if (diag_want(chan->diag, DIAG_PHASE_ERROR))
+            diag_put(chan->diag, DIAG_PHASE_ERROR, chan->diag_id, &chan->d_error, sizeof (float));
+
+        advance_loop(&chan->costas, chan->d_error);
+        phase_wrap(&chan->costas);
+        frequency_limit(&chan->costas);
+        lock_detect(&chan->costas, lock, chan->d_error);
+
+        /*
+         * Pulled along while the FLL settles, the loop can
+         * hold a false lock, where the 4th power metric still
+         * passes but the decisions scatter. The FLL leaves the
+         * true offset near the center, so restart it there.
+         */
+        if (p->pull > 0.0f && get_error_variance(&chan->costas) > HUNT_VARIANCE) {
+            if (++chan->hunt > (long) (HUNT_TIME * p->rs)) {
+                set_frequency(&chan->costas, 0.0f);
+                chan->hunt = 0;
+            }
+        } else {
+            chan->hunt = 0;
+        }
+
+        complex float symbol = costas_frame[i] * scale * settle;
+        complex float point = d->constellation[mapper_decide(d, symbol)];
+        int label = mapper_decide(m, symbol);
+
+        chan->rx_gain = fminf(chan->rx_gain + LEVEL_GAIN * ((level / cabsf(point)) - chan->rx_gain),
+                chan->rx_peak);
+
+        telemetry_symbol(&chan->telemetry, symbol - point, point, chan->d_error);
+
+        for (int k = 0; k < m->bits; k++) {
+            out[(i * m->bits) + k] = (uint8_t) ((label >> (m->bits - 1 - k)) & 0x1);
+        }
+    }
+
+    /*
+     * Save the detected frequency error
+     */
+    chan->fbb_offset_freq = (get_frequency(&chan->costas) * p->rs / TAU) +	// convert radians to freq at symbol rate
+            atomic_load_explicit(&chan->fll_hz, memory_order_relaxed);
+
+    if (diag_want(chan->diag, DIAG_FREQUENCY))
+        diag_put(chan->diag, DIAG_FREQUENCY, chan->diag_id, &chan->fbb_offset_freq, sizeof (float));
+
+    chan->sync_count = 0;
+
+    if (chan->sync != NULL) {
+        size_t mark = arena_mark(&chan->rx_work);
+        long *position = arena_alloc(&chan->rx_work, symbols * sizeof (long));
+
+        for (int i = 0; i < symbols; i++) {
+            position[i] = (base < 0) ? -1 : (base + (long) i * cycles);
+        }
+
+        chan->sync_count = sync_detect_process(chan->sync, costas_frame, position,
+                symbols, chan->sync_events, SYNC_EVENTS);
+
+        if (chan->packets != NULL) {
+            struct packet_rx *prx = chan->packets;
+
+            packet_rx_process(prx, costas_frame, position, symbols,
+                    chan->sync_events, chan->sync_count);
+
+            telemetry_packets(&chan->telemetry, prx->npayload, prx->crc_errors, prx->header_errors,
+                    prx->dropped);
+        }
+
+        arena_reset(&chan->rx_work, mark);
+    }
+
+    telemetry_frame(&chan->telemetry, chan->fbb_offset_freq, chan->rx_level,
+            get_locked(&chan->costas));
+}
+
+/*
+ * Build the packet Frame zero padding for the desired
+ * sample rate, through the Raised Root Cosine Filter,
+ * into count times cycles samples of signal
+ */
+static void tx_shape(struct channel *chan, complex float signal[], const complex float symbol[], int count) {
+    const struct rate_profile *p = chan->profile;
+    const int cycles = p->cycles;
+
+    for (int i = 0; i < count; i++) {
+        signal[(i * cycles)] = symbol[i];
+
+        for (int j = 1; j < cycles; j++) {
+            signal[(i * cycles) + j] = 0.0f;
+        }
+    }
+
+    rrc_fir(chan->tables->coeffs, p->ntaps, chan->tx_filter, signal, (count * cycles));
+}
+
+/*
+ * Modulate the symbols by first upsampling to the profile sample
+ * rate, and translating the spectrum to the carrier, where it is
+ * filtered using the root raised cosine coefficients.
+ *
+ * The filter and carrier run on from one call to the next, so
+ * the symbols are done a frame at a time in the workspace,
+ * and length may be as long as you like.
+ */
+int tx_frame(struct channel *chan, int16_t samples[], complex float symbol[], int length) {
+    const struct rate_profile *p = chan->profile;
+    const int cycles = p->cycles;
+    const int chunk = (p->frame_size / cycles);
+
+    size_t mark = arena_mark(&chan->tx_work);
+    complex float *signal = arena_alloc(&chan->tx_work, p->frame_size * sizeof (complex float));
+
+    for (int done = 0; done < length; done += chunk) {
+        int count = ((length - done) < chunk) ? (length - done) : chunk;
+        int16_t *out = &samples[(done * cycles)];
+
+        tx_shape(chan, signal, &symbol[done], count);
+
+        /*
+         * Shift Baseband to Center Frequency, and return
+         * the resulting real samples @ .5, clipped
+         * (imaginary part discarded)
+         */
+        mixer_up(&chan->tx_mixer, signal, out, (count * cycles));
+    }
+
+    arena_reset(&chan->tx_work, mark);
+
+    return (length * cycles);
+}
+
+/*
+ * Transmit function for complex baseband, such as a
+ * channel of a wideband stream for the channelizer.
+ * As tx_frame() without the carrier, into length
+ * times cycles samples of out.
+ *
+ * Returns the number of samples put out
+ */
+int tx_baseband_frame(struct channel *chan, complex float out[], complex float symbol[], int length) {
+    tx_shape(chan, out, symbol, length);
+
+    return (length * chan->profile->cycles);
+}
+
+/*
+ * Gray coded QPSK, one bit pair per symbol
+ */
+int qpsk_packet_mod(struct channel *chan, int16_t samples[], int tx_bits[], int length) {
+    const struct mapper *qpsk = mapper_get(MOD_QPSK);
+    const int cycles = chan->profile->cycles;
+    const int chunk = (chan->profile->frame_size / cycles);
+
+    size_t mark = arena_mark(&chan->tx_work);
+    complex float *symbol = arena_alloc(&chan->tx_work, chunk * sizeof (complex float));
+
+    for (int done = 0; done < length; done += chunk) {
+        int count = ((length - done) < chunk) ? (length - done) : chunk;
+
+        for (int i = 0, s = (done * 2); i < count; i++, s += 2) {
+            symbol[i] = mapper_map(qpsk, &tx_bits[s]);
+        }
+
+        tx_frame(chan, &samples[(done * cycles)], symbol, count);
+    }
+
+    arena_reset(&chan->tx_work, mark);
+
+    return (length * cycles);
+}
@@ -0,0 +1,154 @@
+/*
+ * modem.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <complex.h>
+#include <stdatomic.h>
+
+#include "costas_loop.h"
+#include "profile.h"
+#include "sync_detect.h"
+#include "packet.h"
+#include "mapper.h"
+#include "mixer.h"
+#include "timing.h"
+#include "telemetry.h"
+#include "arena.h"
+#include "diag.h"
+#include "resample.h"
+
+#define LEVEL_GAIN      0.01f   // symbol amplitude filter
+#define PEAK_DECAY      0.999f  // per symbol, of the largest amplitude
+#define FLL_GAIN        0.1f    // coarse carrier correction, per frame
+#define FLL_SMOOTH      0.05f   // its lag product filter
+#define HUNT_VARIANCE   0.01f   // phase error variance of a false lock
+#define HUNT_TIME       0.5f    // seconds of it before the Costas loop restarts
+
+/*
+ * All of the state for one modem channel. The profile
+ * tables are shared, everything else is per channel.
+ */
+struct channel {
+    const struct profile_tables *tables;
+    const struct rate_profile *profile;
+
+    struct arena arena;         // everything below, sized at creation
+    struct arena rx_work;       // receive scratch
+    struct arena tx_work;       // transmit scratch
+
+    struct costas_loop costas;
+    long hunt;                  // symbols the loop has looked falsely locked
+
+    // Coarse carrier correction ahead of the filter
+
+    struct nco fll;
+    complex float fll_last;     // last filtered sample
+    complex float fll_line;     // filtered lag product
+    int fll_frames;             // in the line, up to 1 / FLL_SMOOTH
+    _Atomic float fll_hz;       // read by the Costas stage
+
+    complex float *tx_filter;
+    complex float *rx_filter;
+
+    struct timing *timing;
+
+    complex float *input_frame;
+    complex float *costas_frame;
+    uint8_t *rx_bits;           // mapper->bits per symbol of the last frame
+
+    const struct mapper *mapper;    // receive constellation
+    float rx_level;             // mean symbol amplitude
+    float rx_gain;              // amplitude of a unit point, from the decisions
+    float rx_peak;              // largest recent symbol amplitude
+
+    // Two carriers for full duplex
+
+    struct mixer tx_mixer;
+    struct mixer rx_mixer;
+
+    int pcm_channels;       // interleaved receive channels
+    int pcm_channel;        // the one to take
+
+    // Sound card rate, off when NULL
+
+    struct resampler *rx_audio;
+    struct resampler *tx_audio;
+    float *audio_frame;     // resampled, short of a whole frame
+    int audio_count;
+
+    float fbb_offset_freq;
+
+    float d_error;
+
+    // Packet start detection
+
+    long sample_count;      // samples received before this frame
+
+    struct sync_detect *sync;
+    struct sync_event sync_events[SYNC_EVENTS];
+    int sync_count;         // events found in the last frame
+
+    struct packet_rx *packets;  // coded packets, off when NULL
+    int hypotheses;         // packet timing hypotheses, 0 for none
+
+    struct telemetry telemetry;     // link quality, for any thread
+
+    // Diagnostics, off when NULL
+
+    struct diag_tap *diag;
+    int diag_id;            // channel number in the records
+};
+
+/*
+ * Workspace sizes and high water marks, in bytes
+ */
+struct workspace {
+    size_t size;
+    size_t used;
+    size_t rx_size;
+    size_t rx_peak;
+    size_t tx_size;
+    size_t tx_peak;
+};
+
+struct channel *channel_create(const struct rate_profile *);
+void channel_destroy(struct channel *);
+int channel_set_sync(struct channel *, const int [], int, float);
+int channel_set_packets(struct channel *, CodeRate);
+int channel_set_mode(struct channel *, ModID);
+void channel_set_offset(struct channel *, double, double);
+int channel_set_input(struct channel *, int, int);
+void channel_set_timing(struct channel *, bool);
+int channel_set_hypotheses(struct channel *, int);
+int channel_set_audio(struct channel *, int);
+void channel_workspace(const struct channel *, struct workspace *);
+void channel_telemetry(struct channel *, struct link_stats *);
+
+void rx_frame(struct channel *, int16_t []);
+void rx_baseband_frame(struct channel *, complex float []);
+void rx_iq_frame(struct channel *, int16_t []);
+int rx_audio(struct channel *, const int16_t [], int, bool *);
+int tx_audio(struct channel *, complex float [], int, int16_t []);
+
+// Receive stages
+
+void rx_mix(struct channel *, int16_t [], complex float []);
+void rx_filter(struct channel *, complex float []);
+long rx_timing(struct channel *, complex float [], complex float []);
+void rx_costas(struct channel *, complex float [], long, uint8_t []);
+int tx_frame(struct channel *, int16_t [], complex float [], int);
+int tx_baseband_frame(struct channel *, complex float [], complex float [], int);
+int qpsk_packet_mod(struct channel *, int16_t [], int [], int);
+
+#ifdef __cplusplus
+}
+#endif
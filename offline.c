@@ -0,0 +1,342 @@
+/*
+ * offline.c
+ *
+ * Parallel decode of a capture file
+ *
+ * A recording is cut into segments, and a pool of threads
+ * decodes them on separate channels. Each channel starts
+ * a warmup window before its segment, so the RRC filter,
+ * timing and Costas loop have converged when the segment
+ * begins, and the packets found in the warmup are dropped.
+ * It also runs on past the end, to finish the last packet.
+ *
+ * A packet near a boundary may be decoded by both of the
+ * segments beside it, so they keep a guard either side,
+ * and the merge removes the second copy.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "offline.h"
+
+struct offline_segment {
+    struct offline_packet *packets;
+    long count;
+    long max;
+    long crc_errors;
+    long rescued;
+};
+
+struct offline_job {
+    const struct capture_reader *rd;
+    const struct offline_config *cfg;
+
+    long frames;            // in the capture
+    long segment;           // frames, whole rx frames
+    long guard;             // frames either side of a segment
+    long overrun;           // frames run past the guard
+
+    struct offline_segment *segs;
+    int nsegments;
+
+    atomic_int next;
+    atomic_bool failed;
+};
+
+/*
+ * Fill in the defaults for the profile, the
+ * capture is then decoded as the test sends it
+ */
+void offline_defaults(struct offline_config *cfg, const struct rate_profile *profile) {
+    memset(cfg, 0, sizeof (struct offline_config));
+
+    cfg->profile = profile;
+    cfg->mode = MOD_QPSK;
+    cfg->rate = FEC_1_2;
+    cfg->segment = (long) (OFFLINE_SEGMENT * profile->fs);
+    cfg->warmup = (long) (OFFLINE_WARMUP * profile->fs);
+}
+
+static int segment_add(struct offline_segment *seg, uint64_t frame, ModID mode,
+        const uint8_t payload[]) {
+    if (seg->count == seg->max) {
+        long max = (seg->max > 0) ? (seg->max * 2) : 64;
+        struct offline_packet *packets = realloc(seg->packets, max * sizeof (struct offline_packet));
+
+        if (packets == NULL)
+            return -1;
+
+        seg->packets = packets;
+        seg->max = max;
+    }
+
+    struct offline_packet *pk = &seg->packets[seg->count++];
+
+    pk->frame = frame;
+    pk->mode = mode;
+    memcpy(pk->payload, payload, PACKET_BYTES);
+
+    return 0;
+}
+
+/*
+ * Decode segment k on a channel of its own
+ *
+ * Returns -1 on error
+ */
+static int segment_decode(struct offline_job *job, int k) {
+    const struct offline_config *cfg = job->cfg;
+    const struct rate_profile *p = cfg->profile;
+    const struct capture_header *h = job->rd->header;
+    const int frame_size = p->frame_size;
+    struct offline_segment *seg = &job->segs[k];
+
+    long start = (long) k * job->segment;
+    long end = start + job->segment;
+    long from = (start > cfg->warmup) ? (start - cfg->warmup) : 0;
+    long to = end + job->guard + job->overrun;
+
+    from -= from % frame_size;
+
+    struct channel *chan = channel_create(p);
+    int16_t *pcm = malloc((size_t) frame_size * h->channels * sizeof (int16_t));
+    int status = -1;
+
+    if (chan == NULL || pcm == NULL)
+        goto done;
+
+    if (channel_set_mode(chan, cfg->mode) != 0 || channel_set_hypotheses(chan, cfg->hypotheses) != 0 ||
+            channel_set_packets(chan, cfg->rate) != 0)
+        goto done;
+
+    if (h->format == CAP_PCM16 && channel_set_input(chan, h->channels, cfg->channel) != 0)
+        goto done;
+
+    channel_set_offset(chan, 0.0, cfg->rx_offset);
+
+    /*
+     * Packet offsets are counted from the first
+     * frame this channel was given
+     */
+    for (long at = from; at < to; at += frame_size) {
+        if (capture_read(job->rd, at, pcm, frame_size) != frame_size)
+            break;
+
+        if (h->format == CAP_IQ16)
+            rx_iq_frame(chan, pcm);
+        else
+            rx_frame(chan, pcm);
+
+        const struct packet_rx *prx = chan->packets;
+
+        for (int i = 0; i < prx->npayload; i++) {
+            long frame = from + prx->offsets[i];
+
+            if (prx->offsets[i] < 0 || frame < (start - job->guard) || frame >= (end + job->guard))
+                continue;
+
+            if (segment_add(seg, (uint64_t) frame, prx->modes[i], prx->payload[i]) != 0)
+                goto done;
+        }
+    }
+
+    seg->crc_errors = chan->packets->crc_errors;
+    seg->rescued = chan->packets->rescued;
+    status = 0;
+
+done:
+    free(pcm);
+    channel_destroy(chan);
+
+    return status;
+}
+
+static void *offline_worker(void *arg) {
+    struct offline_job *job = arg;
+    int k;
+
+    while ((k = atomic_fetch_add(&job->next, 1)) < job->nsegments) {
+        if (segment_decode(job, k) != 0)
+            atomic_store(&job->failed, true);
+    }
+
+    return NULL;
+}
+
+static int packet_order(const void *a, const void *b) {
+    const struct offline_packet *pa = a;
+    const struct offline_packet *pb = b;
+
+    return (pa->frame > pb->frame) - (pa->frame < pb->frame);
+}
+
+/*
+ * Put the segments back together in order, dropping
+ * any packet already found a little earlier
+ *
+ * Returns -1 on error
+ */
+static int offline_merge(struct offline_job *job, struct offline_result *res) {
+    long total = 0;
+
+    for (int k = 0; k < job->nsegments; k++) {
+        total += job->segs[k].count;
+        res->crc_errors += job->segs[k].crc_errors;
+        res->rescued += job->segs[k].rescued;
+    }
+
+    if (total == 0)
+        return 0;
+
+    if ((res->packets = malloc(total * sizeof (struct offline_packet))) == NULL)
+        return -1;
+
+    for (int k = 0; k < job->nsegments; k++) {
+        memcpy(&res->packets[res->count], job->segs[k].packets,
+                job->segs[k].count * sizeof (struct offline_packet));
+        res->count += job->segs[k].count;
+    }
+
+    qsort(res->packets, res->count, sizeof (struct offline_packet), packet_order);
+
+    long kept = 0;
+
+    for (long i = 0; i < res->count; i++) {
+        const struct offline_packet *pk = &res->packets[i];
+        bool duplicate = false;
+
+        for (long j = kept - 1; j >= 0 && (pk->frame - res->packets[j].frame) < (uint64_t) job->guard; j--) {
+            if (res->packets[j].mode == pk->mode &&
+                    memcmp(res->packets[j].payload, pk->payload, PACKET_BYTES) == 0) {
+                duplicate = true;
+                break;
+            }
+        }
+
+        if (duplicate) {
+            res->duplicates++;
+            continue;
+        }
+
+        res->packets[kept++] = *pk;
+    }
+
+    res->count = kept;
+
+    return 0;
+}
+
+/*
+ * Decode the whole capture, which must be at the rates
+ * of the profile. The result is freed with
+ * offline_result_free().
+ *
+ * Returns -1 on error
+ */
+int offline_decode(const struct capture_reader *rd, const struct offline_config *cfg,
+        struct offline_result *res) {
+    const struct rate_profile *p = cfg->profile;
+    const struct capture_header *h = rd->header;
+    struct offline_job job = { 0 };
+    struct timespec t0, t1;
+
+    memset(res, 0, sizeof (struct offline_result));
+
+    if (h->fs != p->fs || h->rs != p->rs || cfg->warmup < 0)
+        return -1;
+
+    if (h->format == CAP_IQ16 && h->channels != 2)
+        return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    /*
+     * Segments are whole rx frames, so each channel sees
+     * the same frame boundaries as a sequential decode.
+     * A sync word can be placed a few symbols either way,
+     * and a packet ends well inside the overrun.
+     */
+    job.rd = rd;
+    job.cfg = cfg;
+    job.frames = (long) rd->frames;
+    job.segment = ((cfg->segment + p->frame_size - 1) / p->frame_size) * p->frame_size;
+    job.guard = (long) PACKET_SYNC * p->cycles;
+    job.overrun = ((long) packet_symbols(MOD_BPSK, cfg->rate) * p->cycles) + (2L * p->frame_size);
+
+    if (job.segment <= 0)
+        job.segment = job.frames;
+
+    job.nsegments = (job.frames > 0) ? (int) ((job.frames + job.segment - 1) / job.segment) : 0;
+
+    if (job.nsegments > 0 &&
+            (job.segs = calloc(job.nsegments, sizeof (struct offline_segment))) == NULL)
+        return -1;
+
+    int threads = (cfg->threads > 0) ? cfg->threads : (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (threads > job.nsegments)
+        threads = job.nsegments;
+
+    if (threads < 1)
+        threads = 1;
+
+    // This thread takes its share, so one fewer is started
+
+    pthread_t *tid = NULL;
+    int started = 0;
+
+    if (threads > 1 && (tid = malloc((threads - 1) * sizeof (pthread_t))) == NULL)
+        threads = 1;
+
+    atomic_init(&job.next, 0);
+    atomic_init(&job.failed, false);
+
+    for (int t = 0; t < threads - 1; t++) {
+        if (pthread_create(&tid[t], NULL, offline_worker, &job) != 0)
+            break;
+
+        started++;
+    }
+
+    offline_worker(&job);
+
+    for (int t = 0; t < started; t++) {
+        pthread_join(tid[t], NULL);
+    }
+
+    free(tid);
+
+    int status = atomic_load(&job.failed) ? -1 : offline_merge(&job, res);
+
+    for (int k = 0; k < job.nsegments; k++) {
+        free(job.segs[k].packets);
+    }
+
+    free(job.segs);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    res->segments = job.nsegments;
+    res->threads = started + 1;
+    res->seconds = (double) (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    if (status != 0)
+        offline_result_free(res);
+
+    return status;
+}
+
+void offline_result_free(struct offline_result *res) {
+    free(res->packets);
+    res->packets = NULL;
+    res->count = 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * offline.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+#include "modem.h"
+#include "capture.h"
+
+#define OFFLINE_SEGMENT 60.0    // default seconds per segment
+#define OFFLINE_WARMUP  8.0     // default seconds decoded before each
+
+/*
+ * Each segment is decoded by a fresh channel, started
+ * warmup frames early so the filter, timing and Costas
+ * loop have settled by the time the segment begins.
+ */
+struct offline_config {
+    const struct rate_profile *profile;
+    ModID mode;
+    CodeRate rate;
+    double rx_offset;       // Hz, as channel_set_offset()
+    int channel;            // of the capture's interleaved channels
+    int hypotheses;         // as channel_set_hypotheses()
+    long segment;           // frames per segment
+    long warmup;            // frames decoded then discarded
+    int threads;            // 0 for one per core
+};
+
+struct offline_packet {
+    uint64_t frame;         // where its sync word starts
+    ModID mode;
+    uint8_t payload[PACKET_BYTES];
+};
+
+/*
+ * Packets in the order they were sent, with
+ * those seen by two segments counted once
+ */
+struct offline_result {
+    struct offline_packet *packets;
+    long count;
+    long crc_errors;
+    long rescued;           // by other than the first hypothesis
+    long duplicates;        // removed at segment boundaries
+    int segments;
+    int threads;
+    double seconds;         // wall clock
+};
+
+void offline_defaults(struct offline_config *, const struct rate_profile *);
+int offline_decode(const struct capture_reader *, const struct offline_config *,
+        struct offline_result *);
+void offline_result_free(struct offline_result *);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,432 @@
+/*
+ * packet.c
+ *
+ * Packet link over the modem. A packet is the sync word,
+ * a short header giving the constellation of the rest,
+ * then the payload and its CRC16 convolutionally coded
+ * at the chosen rate.
+ *
+ * The sync word and header are always QPSK, whose points
+ * every constellation shares, so the receiver learns the
+ * carrier phase and amplitude from them before it gives
+ * the Viterbi decoder the soft bits of the payload.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <complex.h>
+#include <math.h>
+
+#include "qpsk.h"
+#include "packet.h"
+#include "algorithms/crc16.h"
+
+#define MODE_BITS       4       // mode field, repeated through the header
+
+/*
+ * The CCSDS 64 bit attached sync marker
+ */
+static const uint8_t sync_word[(PACKET_SYNC * 2) / 8] = {
+    0x03, 0x47, 0x76, 0xC7, 0x27, 0x28, 0x95, 0xB0
+};
+
+/*
+ * Fill in the sync word as bit pairs, for channel_set_sync()
+ *
+ * Returns the number of symbols
+ */
+int packet_sync_bits(int bits[]) {
+    for (int i = 0; i < (PACKET_SYNC * 2); i++) {
+        bits[i] = (sync_word[i / 8] >> (7 - (i % 8))) & 0x1;
+    }
+
+    return PACKET_SYNC;
+}
+
+static int coded_symbols(ModID mode, CodeRate rate) {
+    int bits = mapper_get(mode)->bits;
+
+    return (conv_coded_bits(PACKET_BYTES + 2, rate) + bits - 1) / bits;
+}
+
+/*
+ * Symbols in a whole packet
+ */
+int packet_symbols(ModID mode, CodeRate rate) {
+    return PACKET_SYNC + PACKET_HEADER + coded_symbols(mode, rate);
+}
+
+/*
+ * Build a packet as symbols for tx_frame(), symbols
+ * must hold packet_symbols()
+ *
+ * Returns the number of symbols, or -1 on error
+ */
+int packet_build(const uint8_t payload[], complex float symbols[], ModID mode, CodeRate rate) {
+    const struct mapper *qpsk = mapper_get(MOD_QPSK);
+    const struct mapper *m = mapper_get(mode);
+    uint8_t frame[PACKET_BYTES + 2];
+    uint8_t coded[(((PACKET_BYTES + 2) * 8) + CONV_TAIL) * 2];
+    int bits[(PACKET_SYNC * 2)];
+    int n = 0;
+
+    if (m == NULL)
+        return -1;
+
+    packet_sync_bits(bits);
+
+    for (int i = 0; i < PACKET_SYNC; i++) {
+        symbols[n++] = mapper_map(qpsk, &bits[(i * 2)]);
+    }
+
+    for (int i = 0; i < (PACKET_HEADER * 2); i++) {
+        bits[i] = (mode >> (MODE_BITS - 1 - (i % MODE_BITS))) & 0x1;
+    }
+
+    for (int i = 0; i < PACKET_HEADER; i++) {
+        symbols[n++] = mapper_map(qpsk, &bits[(i * 2)]);
+    }
+
+    memcpy(frame, payload, PACKET_BYTES);
+
+    uint16_t crc = crc16(payload, PACKET_BYTES);
+
+    frame[PACKET_BYTES] = (uint8_t) (crc >> 8);
+    frame[PACKET_BYTES + 1] = (uint8_t) crc;
+
+    int nbits = conv_encode(frame, PACKET_BYTES + 2, coded, rate);
+
+    for (int i = 0; i < nbits; i += m->bits) {
+        for (int k = 0; k < m->bits; k++) {
+            bits[k] = ((i + k) < nbits) ? coded[i + k] : 0;
+        }
+
+        symbols[n++] = mapper_map(m, bits);
+    }
+
+    return n;
+}
+
+/*
+ * Returns NULL on error
+ */
+struct packet_rx *packet_rx_create(CodeRate rate, int hypotheses) {
+    if (hypotheses < 0 || hypotheses > PACKET_TIMINGS)
+        return NULL;
+
+    struct packet_rx *prx = calloc(1, sizeof (struct packet_rx));
+
+    if (prx == NULL)
+        return NULL;
+
+    int mother = (((PACKET_BYTES + 2) * 8) + CONV_TAIL) * 2;
+
+    prx->rate = rate;
+    prx->timings = (hypotheses > 0) ? hypotheses : 1;
+    prx->rotations = (hypotheses > 0) ? 4 : 1;
+    prx->viterbi = viterbi_create((PACKET_BYTES + 2) * 8);
+    prx->history = calloc(PACKET_HISTORY * prx->timings, sizeof (complex float));
+    prx->position = calloc(PACKET_HISTORY, sizeof (long));
+    prx->soft = calloc(coded_symbols(MOD_BPSK, rate) + MAPPER_BITS, sizeof (uint8_t));
+    prx->depunctured = calloc(mother, sizeof (uint8_t));
+
+    if (prx->viterbi == NULL || prx->history == NULL || prx->position == NULL ||
+            prx->soft == NULL || prx->depunctured == NULL) {
+        packet_rx_destroy(prx);
+        return NULL;
+    }
+
+    return prx;
+}
+
+void packet_rx_destroy(struct packet_rx *prx) {
+    if (prx == NULL)
+        return;
+
+    viterbi_destroy(prx->viterbi);
+    free(prx->history);
+    free(prx->position);
+    free(prx->soft);
+    free(prx->depunctured);
+    free(prx);
+}
+
+static complex float history(const struct packet_rx *prx, int timing, long n) {
+    return prx->history[(timing * PACKET_HISTORY) + (n & (PACKET_HISTORY - 1))];
+}
+
+/*
+ * The derotation to bring the symbols from start back to
+ * the transmitted points, at unit amplitude. The sync word
+ * was correlated against the QPSK points as the Costas
+ * loop holds them, so undo that rotation as well.
+ */
+static complex float packet_derotate(const struct packet_rx *prx, int timing, long start, float phase) {
+    float level = 0.0f;
+
+    for (long n = start - PACKET_SYNC; n < (start + PACKET_HEADER); n++) {
+        level += cabsf(history(prx, timing, n));
+    }
+
+    level /= (PACKET_SYNC + PACKET_HEADER);
+
+    if (level <= 0.0f)
+        return 0.0f;
+
+    return cmplxconj(phase + mapper_get(MOD_QPSK)->settle) / level;
+}
+
+/*
+ * Read the mode field, summing the soft bits of
+ * each repeat
+ *
+ * Returns the ModID, or -1 if it is not one
+ */
+static int packet_header(const struct packet_rx *prx, int timing, long start, complex float derotate) {
+    const struct mapper *qpsk = mapper_get(MOD_QPSK);
+    int sum[MODE_BITS] = { 0 };
+    uint8_t soft[2];
+    int mode = 0;
+
+    for (int i = 0; i < PACKET_HEADER; i++) {
+        mapper_soft(qpsk, history(prx, timing, start + i) * derotate, soft);
+
+        sum[(i * 2) % MODE_BITS] += soft[0] - 128;
+        sum[((i * 2) + 1) % MODE_BITS] += soft[1] - 128;
+    }
+
+    for (int i = 0; i < MODE_BITS; i++) {
+        mode = (mode << 1) | (sum[i] > 0);
+    }
+
+    return (mode < MOD_MODES) ? mode : -1;
+}
+
+/*
+ * Soft decisions for the coded block after the header
+ *
+ * Returns 0 when the CRC is good
+ */
+static int packet_decode(struct packet_rx *prx, int timing, long start, complex float derotate,
+        ModID mode, uint8_t payload[]) {
+    const struct mapper *m = mapper_get(mode);
+    const int coded = coded_symbols(mode, prx->rate);
+    uint8_t frame[PACKET_BYTES + 2];
+
+    start += PACKET_HEADER;
+
+    for (int i = 0; i < coded; i++) {
+        mapper_soft(m, history(prx, timing, start + i) * derotate, &prx->soft[(i * m->bits)]);
+    }
+
+    conv_depuncture(prx->soft, PACKET_BYTES + 2, prx->depunctured, prx->rate);
+    viterbi_decode(prx->viterbi, prx->depunctured, (PACKET_BYTES + 2) * 8, frame);
+
+    uint16_t crc = (uint16_t) ((frame[PACKET_BYTES] << 8) | frame[PACKET_BYTES + 1]);
+
+    prx->hypotheses++;
+
+    if (crc != crc16(frame, PACKET_BYTES))
+        return -1;
+
+    memcpy(payload, frame, PACKET_BYTES);
+
+    return 0;
+}
+
+/*
+ * Queue a decoded payload
+ */
+static void packet_commit(struct packet_rx *prx, long start, ModID mode) {
+    prx->modes[prx->npayload] = mode;
+    prx->offsets[prx->npayload] = prx->position[(start - PACKET_SYNC) & (PACKET_HISTORY - 1)];
+    prx->npayload++;
+}
+
+/*
+ * Try the other hypotheses of a packet whose first failed,
+ * nearest the estimate first: each timing candidate, with
+ * the rotation of the sync word then the others. A header
+ * that is not a mode ends a hypothesis before the Viterbi
+ * decoder, and the first good CRC ends the rest.
+ *
+ * The scrambler and interleaver in algorithms/ are not
+ * in the packet and add nothing to search. The scrambler
+ * seed is fixed, and its registers are file statics every
+ * channel thread would share. The interleaver permutes
+ * packed hard bits, ahead of a soft decision decoder.
+ *
+ * Returns 0 when one was decoded
+ */
+static int packet_retry(struct packet_rx *prx, long start, float phase, uint8_t payload[], ModID *decoded) {
+    static const int rotations[4] = { 0, 1, 3, 2 };
+    bool header = false;
+
+    for (int t = 0; t < prx->timings; t++) {
+        for (int r = 0; r < prx->rotations; r++) {
+            if (t == 0 && r == 0)
+                continue;
+
+            complex float derotate = packet_derotate(prx, t, start, phase + rotations[r] * (M_PI / 2.0));
+            int mode = packet_header(prx, t, start, derotate);
+
+            if (mode < 0)
+                continue;
+
+            header = true;
+
+            if (packet_decode(prx, t, start, derotate, (ModID) mode, payload) == 0) {
+                *decoded = (ModID) mode;
+                return 0;
+            }
+        }
+    }
+
+    if (header)
+        prx->crc_errors++;
+    else
+        prx->header_errors++;
+
+    return -1;
+}
+
+/*
+ * The symbol count up to which those received are the
+ * payload of a packet in mode whose header is in, or 0
+ */
+long packet_rx_payload(const struct packet_rx *prx, ModID mode) {
+    long until = 0;
+
+    for (int p = 0; p < prx->npending; p++) {
+        if (prx->pending[p].mode == (int) mode && !prx->pending[p].retry) {
+            long end = prx->pending[p].start + PACKET_HEADER + coded_symbols(mode, prx->rate);
+
+            if (end > until)
+                until = end;
+        }
+    }
+
+    return until;
+}
+
+/*
+ * Add the symbols of a frame, one row of count for each
+ * timing hypothesis, with their sample offsets, and the
+ * sync events found in them. Decoded payloads, their
+ * modes and where they started are left in prx->payload,
+ * prx->modes and prx->offsets.
+ *
+ * Returns the number of packets decoded
+ */
+int packet_rx_process(struct packet_rx *prx, const complex float symbols[], const long position[],
+        int count, const struct sync_event events[], int nevents) {
+    for (int i = 0; i < count; i++) {
+        for (int t = 0; t < prx->timings; t++) {
+            prx->history[(t * PACKET_HISTORY) + (prx->count & (PACKET_HISTORY - 1))] = symbols[(t * count) + i];
+        }
+
+        prx->position[prx->count & (PACKET_HISTORY - 1)] = position[i];
+        prx->count++;
+    }
+
+    /*
+     * The correlator reports a sync word some time after
+     * it arrives, so find its first symbol in the history
+     */
+    long oldest = (prx->count > PACKET_HISTORY) ? (prx->count - PACKET_HISTORY) : 0;
+
+    for (int e = 0; e < nevents && prx->npending < SYNC_EVENTS; e++) {
+        for (long n = prx->count - 1; n >= oldest; n--) {
+            if (prx->position[n & (PACKET_HISTORY - 1)] == events[e].offset) {
+                prx->pending[prx->npending].start = n + PACKET_SYNC;
+                prx->pending[prx->npending].phase = events[e].phase;
+                prx->pending[prx->npending].mode = -1;
+                prx->pending[prx->npending].retry = false;
+                prx->npending++;
+                break;
+            }
+        }
+    }
+
+    prx->npayload = 0;
+
+    /*
+     * The hypothesis the loop and timing estimate give
+     * is tried as soon as it can be. The others wait for
+     * the longest packet, as their headers may differ.
+     */
+    const long longest = PACKET_HEADER + coded_symbols(MOD_BPSK, prx->rate);
+    const bool hypotheses = (prx->timings * prx->rotations) > 1;
+
+    for (int p = 0; p < prx->npending; ) {
+        long start = prx->pending[p].start;
+
+        if ((start - PACKET_SYNC) < oldest) {
+            prx->pending[p] = prx->pending[--prx->npending];
+            continue;
+        }
+
+        if (prx->pending[p].retry) {
+            if ((start + longest) > prx->count) {
+                p++;
+                continue;
+            }
+
+            ModID mode;
+
+            if (prx->npayload == PACKET_QUEUE) {
+                prx->dropped++;
+            } else if (packet_retry(prx, start, prx->pending[p].phase, prx->payload[prx->npayload], &mode) == 0) {
+                prx->rescued++;
+                packet_commit(prx, start, mode);
+            }
+
+            prx->pending[p] = prx->pending[--prx->npending];
+            continue;
+        }
+
+        if ((start + PACKET_HEADER) > prx->count) {
+            p++;
+            continue;
+        }
+
+        complex float derotate = packet_derotate(prx, 0, start, prx->pending[p].phase);
+
+        if (prx->pending[p].mode < 0) {
+            if ((prx->pending[p].mode = packet_header(prx, 0, start, derotate)) < 0) {
+                if (hypotheses) {
+                    prx->pending[p].retry = true;
+                    continue;
+                }
+
+                prx->header_errors++;
+                prx->pending[p] = prx->pending[--prx->npending];
+                continue;
+            }
+        }
+
+        ModID mode = (ModID) prx->pending[p].mode;
+
+        if ((start + PACKET_HEADER + coded_symbols(mode, prx->rate)) > prx->count) {
+            p++;
+            continue;
+        }
+
+        if (prx->npayload == PACKET_QUEUE) {
+            prx->dropped++;
+        } else if (packet_decode(prx, 0, start, derotate, mode, prx->payload[prx->npayload]) == 0) {
+            packet_commit(prx, start, mode);
+        } else if (hypotheses) {
+            prx->pending[p].retry = true;
+            continue;
+        } else {
+            prx->crc_errors++;
+        }
+
+        prx->pending[p] = prx->pending[--prx->npending];
+    }
+
+    return prx->npayload;
+}
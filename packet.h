@@ -0,0 +1,76 @@
+/*
+ * packet.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <complex.h>
+
+#include "algorithms/viterbi.h"
+#include "sync_detect.h"
+#include "mapper.h"
+
+#define PACKET_BYTES    32      // payload, the CRC16 follows
+#define PACKET_SYNC     32      // sync word symbols
+#define PACKET_HEADER   8       // QPSK symbols carrying the mode
+#define PACKET_HISTORY  2048    // received symbols kept, power of 2
+#define PACKET_QUEUE    8       // most packets decoded per frame
+#define PACKET_TIMINGS  3       // most timing hypotheses
+#define PACKET_SPREAD   0.125f  // of a symbol between timing hypotheses
+
+/*
+ * Receive side of the packet link. Symbols are kept until
+ * the coded block after each sync word has arrived.
+ */
+struct packet_rx {
+    CodeRate rate;
+    int timings;                // timing hypotheses, the estimate first
+    int rotations;              // 4 to try every phase ambiguity
+    struct viterbi *viterbi;
+
+    complex float *history;     // PACKET_HISTORY per timing
+    long *position;             // sample offset of each symbol
+    long count;                 // symbols received
+
+    struct {
+        long start;             // symbol count of the header
+        float phase;            // carrier phase of the sync word
+        int mode;               // ModID, -1 until the header is in
+        bool retry;             // first hypothesis failed
+    } pending[SYNC_EVENTS];
+    int npending;
+
+    uint8_t *soft;              // coded soft bits, then depunctured
+    uint8_t *depunctured;
+
+    uint8_t payload[PACKET_QUEUE][PACKET_BYTES];
+    ModID modes[PACKET_QUEUE];
+    long offsets[PACKET_QUEUE]; // sample offset of each sync word
+    int npayload;               // packets decoded in the last frame
+    long crc_errors;
+    long header_errors;
+    long dropped;               // decoded past PACKET_QUEUE in a frame
+    long hypotheses;            // payloads put through the decoder
+    long rescued;               // decoded by other than the first
+};
+
+int packet_sync_bits(int []);
+int packet_symbols(ModID, CodeRate);
+int packet_build(const uint8_t [], complex float [], ModID, CodeRate);
+
+struct packet_rx *packet_rx_create(CodeRate, int);
+void packet_rx_destroy(struct packet_rx *);
+int packet_rx_process(struct packet_rx *, const complex float [], const long [], int,
+        const struct sync_event [], int);
+long packet_rx_payload(const struct packet_rx *, ModID);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,561 @@
+/*
+ * pcm.c
+ *
+ * int16 to float conversion, and back, at the PCM boundary
+ *
+ * The receive side converts and mixes down in one pass,
+ * and the transmit side mixes up and keeps only the real
+ * part, rounds and saturates in one pass, so an overdriven
+ * frame clips rather than wrapping around.
+ *
+ * Input may be interleaved stereo, taking either channel,
+ * or IQ pairs from an SDR, which are complex already.
+ *
+ * Each kernel has a scalar version, and SSE4.1, AVX2 or
+ * NEON versions of the mono and stereo cases, picked once
+ * for the CPU through dispatch.c. All of them round to
+ * nearest even, so they give the same samples.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PCM_X86
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PCM_NEON
+#endif
+
+#include "pcm.h"
+#include "dispatch.h"
+
+#define PCM_MAX     32767.0f
+#define PCM_MIN     -32768.0f
+
+/*
+ * One set of kernels per instruction set
+ */
+struct pcm_kernels {
+    const char *name;
+    SimdLevel level;
+    void (*to_float)(const int16_t [], int, int, float [], int, float);
+    void (*from_float)(const float [], int16_t [], int, float);
+    void (*mix_down)(const int16_t [], int, int, const float [], const float [],
+            complex float [], int, float);
+    void (*mix_up)(const complex float [], const float [], const float [],
+            int16_t [], int, float);
+};
+
+static const struct pcm_kernels *kernels;     // for the current CPU
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static int16_t saturate(float x) {
+    x = (x > PCM_MAX) ? PCM_MAX : ((x < PCM_MIN) ? PCM_MIN : x);
+
+    return (int16_t) lrintf(x);
+}
+
+// Scalar, any number of channels
+
+static void to_float_scalar(const int16_t in[], int channels, int channel,
+        float out[], int length, float scale) {
+    for (int i = 0; i < length; i++) {
+        out[i] = (float) in[(i * channels) + channel] * scale;
+    }
+}
+
+static void from_float_scalar(const float in[], int16_t out[], int length, float scale) {
+    for (int i = 0; i < length; i++) {
+        out[i] = saturate(in[i] * scale);
+    }
+}
+
+static void mix_down_scalar(const int16_t in[], int channels, int channel,
+        const float re[], const float im[], complex float out[], int length, float scale) {
+    for (int i = 0; i < length; i++) {
+        float x = (float) in[(i * channels) + channel] * scale;
+
+        out[i] = (x * re[i]) - (x * im[i]) * I;
+    }
+}
+
+static void mix_up_scalar(const complex float in[], const float re[], const float im[],
+        int16_t out[], int length, float scale) {
+    for (int i = 0; i < length; i++) {
+        out[i] = saturate((crealf(in[i]) * re[i] - cimagf(in[i]) * im[i]) * scale);
+    }
+}
+
+#ifdef PCM_X86
+
+/*
+ * Four samples of one channel, mono or stereo
+ */
+__attribute__((target("sse4.1")))
+static inline __m128 load4_sse(const int16_t *p, int channels, int channel) {
+    __m128i v;
+
+    if (channels == 1) {
+        v = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *) p));
+    } else {
+        v = _mm_loadu_si128((const __m128i *) p);
+        v = (channel == 0) ? _mm_srai_epi32(_mm_slli_epi32(v, 16), 16) : _mm_srai_epi32(v, 16);
+    }
+
+    return _mm_cvtepi32_ps(v);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i round4_sse(__m128 x) {
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(PCM_MIN)), _mm_set1_ps(PCM_MAX));
+
+    return _mm_cvtps_epi32(x);
+}
+
+__attribute__((target("sse4.1")))
+static void to_float_sse(const int16_t in[], int channels, int channel,
+        float out[], int length, float scale) {
+    const __m128 s = _mm_set1_ps(scale);
+    int i = 0;
+
+    if (channels <= 2) {
+        for (; i <= (length - 4); i += 4) {
+            _mm_storeu_ps(&out[i], _mm_mul_ps(load4_sse(&in[i * channels], channels, channel), s));
+        }
+    }
+
+    to_float_scalar(&in[i * channels], channels, channel, &out[i], length - i, scale);
+}
+
+__attribute__((target("sse4.1")))
+static void from_float_sse(const float in[], int16_t out[], int length, float scale) {
+    const __m128 s = _mm_set1_ps(scale);
+    int i = 0;
+
+    for (; i <= (length - 8); i += 8) {
+        __m128i lo = round4_sse(_mm_mul_ps(_mm_loadu_ps(&in[i]), s));
+        __m128i hi = round4_sse(_mm_mul_ps(_mm_loadu_ps(&in[i + 4]), s));
+
+        _mm_storeu_si128((__m128i *) &out[i], _mm_packs_epi32(lo, hi));
+    }
+
+    from_float_scalar(&in[i], &out[i], length - i, scale);
+}
+
+__attribute__((target("sse4.1")))
+static void mix_down_sse(const int16_t in[], int channels, int channel,
+        const float re[], const float im[], complex float out[], int length, float scale) {
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    float *o = (float *) out;
+    int i = 0;
+
+    if (channels <= 2) {
+        for (; i <= (length - 4); i += 4) {
+            __m128 x = _mm_mul_ps(load4_sse(&in[i * channels], channels, channel), s);
+            __m128 xr = _mm_mul_ps(x, _mm_loadu_ps(&re[i]));
+            __m128 xi = _mm_xor_ps(_mm_mul_ps(x, _mm_loadu_ps(&im[i])), sign);
+
+            _mm_storeu_ps(&o[(i * 2)], _mm_unpacklo_ps(xr, xi));
+            _mm_storeu_ps(&o[(i * 2) + 4], _mm_unpackhi_ps(xr, xi));
+        }
+    }
+
+    mix_down_scalar(&in[i * channels], channels, channel, &re[i], &im[i], &out[i], length - i, scale);
+}
+
+__attribute__((target("sse4.1")))
+static void mix_up_sse(const complex float in[], const float re[], const float im[],
+        int16_t out[], int length, float scale) {
+    const __m128 s = _mm_set1_ps(scale);
+    const float *p = (const float *) in;
+    int i = 0;
+
+    for (; i <= (length - 8); i += 8) {
+        __m128i half[2];
+
+        for (int h = 0; h < 2; h++) {
+            int k = i + (h * 4);
+            __m128 a = _mm_loadu_ps(&p[(k * 2)]);
+            __m128 b = _mm_loadu_ps(&p[(k * 2) + 4]);
+            __m128 sr = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            __m128 si = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            __m128 y = _mm_sub_ps(_mm_mul_ps(sr, _mm_loadu_ps(&re[k])), _mm_mul_ps(si, _mm_loadu_ps(&im[k])));
+
+            half[h] = round4_sse(_mm_mul_ps(y, s));
+        }
+
+        _mm_storeu_si128((__m128i *) &out[i], _mm_packs_epi32(half[0], half[1]));
+    }
+
+    mix_up_scalar(&in[i], &re[i], &im[i], &out[i], length - i, scale);
+}
+
+/*
+ * Eight samples of one channel, mono or stereo
+ */
+__attribute__((target("avx2")))
+static inline __m256 load8_avx2(const int16_t *p, int channels, int channel) {
+    __m256i v;
+
+    if (channels == 1) {
+        v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) p));
+    } else {
+        v = _mm256_loadu_si256((const __m256i *) p);
+        v = (channel == 0) ? _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16) : _mm256_srai_epi32(v, 16);
+    }
+
+    return _mm256_cvtepi32_ps(v);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i round8_avx2(__m256 x) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(PCM_MIN)), _mm256_set1_ps(PCM_MAX));
+
+    return _mm256_cvtps_epi32(x);
+}
+
+/*
+ * Pack sixteen, as the pack works within 128 bit lanes
+ */
+__attribute__((target("avx2")))
+static inline __m256i pack16_avx2(__m256i lo, __m256i hi) {
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+}
+
+__attribute__((target("avx2")))
+static void to_float_avx2(const int16_t in[], int channels, int channel,
+        float out[], int length, float scale) {
+    const __m256 s = _mm256_set1_ps(scale);
+    int i = 0;
+
+    if (channels <= 2) {
+        for (; i <= (length - 8); i += 8) {
+            _mm256_storeu_ps(&out[i], _mm256_mul_ps(load8_avx2(&in[i * channels], channels, channel), s));
+        }
+    }
+
+    to_float_scalar(&in[i * channels], channels, channel, &out[i], length - i, scale);
+}
+
+__attribute__((target("avx2")))
+static void from_float_avx2(const float in[], int16_t out[], int length, float scale) {
+    const __m256 s = _mm256_set1_ps(scale);
+    int i = 0;
+
+    for (; i <= (length - 16); i += 16) {
+        __m256i lo = round8_avx2(_mm256_mul_ps(_mm256_loadu_ps(&in[i]), s));
+        __m256i hi = round8_avx2(_mm256_mul_ps(_mm256_loadu_ps(&in[i + 8]), s));
+
+        _mm256_storeu_si256((__m256i *) &out[i], pack16_avx2(lo, hi));
+    }
+
+    from_float_scalar(&in[i], &out[i], length - i, scale);
+}
+
+__attribute__((target("avx2")))
+static void mix_down_avx2(const int16_t in[], int channels, int channel,
+        const float re[], const float im[], complex float out[], int length, float scale) {
+    const __m256 s = _mm256_set1_ps(scale);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    float *o = (float *) out;
+    int i = 0;
+
+    if (channels <= 2) {
+        for (; i <= (length - 8); i += 8) {
+            __m256 x = _mm256_mul_ps(load8_avx2(&in[i * channels], channels, channel), s);
+            __m256 xr = _mm256_mul_ps(x, _mm256_loadu_ps(&re[i]));
+            __m256 xi = _mm256_xor_ps(_mm256_mul_ps(x, _mm256_loadu_ps(&im[i])), sign);
+            __m256 lo = _mm256_unpacklo_ps(xr, xi);
+            __m256 hi = _mm256_unpackhi_ps(xr, xi);
+
+            _mm256_storeu_ps(&o[(i * 2)], _mm256_permute2f128_ps(lo, hi, 0x20));
+            _mm256_storeu_ps(&o[(i * 2) + 8], _mm256_permute2f128_ps(lo, hi, 0x31));
+        }
+    }
+
+    mix_down_scalar(&in[i * channels], channels, channel, &re[i], &im[i], &out[i], length - i, scale);
+}
+
+__attribute__((target("avx2")))
+static void mix_up_avx2(const complex float in[], const float re[], const float im[],
+        int16_t out[], int length, float scale) {
+    const __m256 s = _mm256_set1_ps(scale);
+    const float *p = (const float *) in;
+    int i = 0;
+
+    for (; i <= (length - 16); i += 16) {
+        __m256i half[2];
+
+        for (int h = 0; h < 2; h++) {
+            int k = i + (h * 8);
+            __m256 a = _mm256_loadu_ps(&p[(k * 2)]);
+            __m256 b = _mm256_loadu_ps(&p[(k * 2) + 8]);
+
+            /*
+             * The shuffle works within lanes, giving
+             * samples 0 1 4 5 2 3 6 7, so swap the middle
+             */
+            __m256 sr = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            __m256 si = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+
+            sr = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sr), 0xD8));
+            si = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(si), 0xD8));
+
+            __m256 y = _mm256_sub_ps(_mm256_mul_ps(sr, _mm256_loadu_ps(&re[k])),
+                                     _mm256_mul_ps(si, _mm256_loadu_ps(&im[k])));
+
+            half[h] = round8_avx2(_mm256_mul_ps(y, s));
+        }
+
+        _mm256_storeu_si256((__m256i *) &out[i], pack16_avx2(half[0], half[1]));
+    }
+
+    mix_up_scalar(&in[i], &re[i], &im[i], &out[i], length - i, scale);
+}
+
+#endif
+
+#ifdef PCM_NEON
+
+static void to_float_neon(const int16_t in[], int channels, int channel,
+        float out[], int length, float scale) {
+    int i = 0;
+
+    if (channels <= 2) {
+        for (; i <= (length - 8); i += 8) {
+            int16x8_t v = (channels == 1) ? vld1q_s16(&in[i]) : vld2q_s16(&in[i * 2]).val[channel];
+
+            vst1q_f32(&out[i], vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+            vst1q_f32(&out[i + 4], vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale));
+        }
+    }
+
+    to_float_scalar(&in[i * channels], channels, channel, &out[i], length - i, scale);
+}
+
+static void from_float_neon(const float in[], int16_t out[], int length, float scale) {
+    int i = 0;
+
+    for (; i <= (length - 8); i += 8) {
+        int32x4_t lo = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(&in[i]), scale));
+        int32x4_t hi = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(&in[i + 4]), scale));
+
+        vst1q_s16(&out[i], vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+
+    from_float_scalar(&in[i], &out[i], length - i, scale);
+}
+
+static void mix_down_neon(const int16_t in[], int channels, int channel,
+        const float re[], const float im[], complex float out[], int length, float scale) {
+    float *o = (float *) out;
+    int i = 0;
+
+    if (channels <= 2) {
+        for (; i <= (length - 8); i += 8) {
+            int16x8_t v = (channels == 1) ? vld1q_s16(&in[i]) : vld2q_s16(&in[i * 2]).val[channel];
+            float32x4_t x[2] = {
+                vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale),
+                vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale)
+            };
+
+            for (int h = 0; h < 2; h++) {
+                int k = i + (h * 4);
+                float32x4x2_t c;
+
+                c.val[0] = vmulq_f32(x[h], vld1q_f32(&re[k]));
+                c.val[1] = vnegq_f32(vmulq_f32(x[h], vld1q_f32(&im[k])));
+
+                vst2q_f32(&o[(k * 2)], c);
+            }
+        }
+    }
+
+    mix_down_scalar(&in[i * channels], channels, channel, &re[i], &im[i], &out[i], length - i, scale);
+}
+
+static void mix_up_neon(const complex float in[], const float re[], const float im[],
+        int16_t out[], int length, float scale) {
+    const float *p = (const float *) in;
+    int i = 0;
+
+    for (; i <= (length - 8); i += 8) {
+        int16x4_t half[2];
+
+        for (int h = 0; h < 2; h++) {
+            int k = i + (h * 4);
+            float32x4x2_t c = vld2q_f32(&p[(k * 2)]);
+            float32x4_t y = vmlsq_f32(vmulq_f32(c.val[0], vld1q_f32(&re[k])), c.val[1], vld1q_f32(&im[k]));
+
+            half[h] = vqmovn_s32(vcvtnq_s32_f32(vmulq_n_f32(y, scale)));
+        }
+
+        vst1q_s16(&out[i], vcombine_s16(half[0], half[1]));
+    }
+
+    mix_up_scalar(&in[i], &re[i], &im[i], &out[i], length - i, scale);
+}
+
+#endif
+
+/*
+ * Scalar first, then in order of preference
+ */
+static const struct pcm_kernels variants[] = {
+    { "scalar", SIMD_SCALAR, to_float_scalar, from_float_scalar, mix_down_scalar, mix_up_scalar },
+#if defined(PCM_X86)
+    { "sse4.1", SIMD_SSE41, to_float_sse, from_float_sse, mix_down_sse, mix_up_sse },
+    { "avx2", SIMD_AVX2, to_float_avx2, from_float_avx2, mix_down_avx2, mix_up_avx2 },
+#elif defined(PCM_NEON)
+    { "neon", SIMD_NEON, to_float_neon, from_float_neon, mix_down_neon, mix_up_neon },
+#endif
+};
+
+#define VARIANTS    (int) (sizeof (variants) / sizeof (variants[0]))
+
+static void kernels_pick(void) {
+    kernels = &variants[0];
+
+    for (int i = 1; i < VARIANTS; i++) {
+        if (dispatch_has(variants[i].level))
+            kernels = &variants[i];
+    }
+}
+
+/*
+ * Convert length samples of one channel, of channels
+ * interleaved, to float times scale
+ */
+void pcm_to_float(const int16_t in[], int channels, int channel, float out[], int length, float scale) {
+    pthread_once(&kernels_once, kernels_pick);
+
+    kernels->to_float(in, channels, channel, out, length, scale);
+}
+
+/*
+ * Convert length floats times scale, rounded and saturated
+ */
+void pcm_from_float(const float in[], int16_t out[], int length, float scale) {
+    pthread_once(&kernels_once, kernels_pick);
+
+    kernels->from_float(in, out, length, scale);
+}
+
+/*
+ * Convert length interleaved IQ pairs to complex
+ */
+void pcm_iq_to_complex(const int16_t in[], complex float out[], int length, float scale) {
+    pcm_to_float(in, 1, 0, (float *) out, (length * 2), scale);
+}
+
+/*
+ * Convert and multiply by the conjugate of the carrier
+ * phasors re, im, giving complex baseband
+ */
+void pcm_mix_down(const int16_t in[], int channels, int channel, const float re[], const float im[],
+        complex float out[], int length, float scale) {
+    pthread_once(&kernels_once, kernels_pick);
+
+    kernels->mix_down(in, channels, channel, re, im, out, length, scale);
+}
+
+/*
+ * Multiply complex baseband by the carrier phasors re, im,
+ * and keep the real part times scale, rounded and saturated
+ */
+void pcm_mix_up(const complex float in[], const float re[], const float im[],
+        int16_t out[], int length, float scale) {
+    pthread_once(&kernels_once, kernels_pick);
+
+    kernels->mix_up(in, re, im, out, length, scale);
+}
+
+const char *pcm_variant(void) {
+    pthread_once(&kernels_once, kernels_pick);
+
+    return kernels->name;
+}
+
+#define TEST_LENGTH 1013    // odd, so the kernels run their tails
+#define TEST_SEED   12345u
+
+static uint32_t test_random(uint32_t *state) {
+    *state = (*state * 1664525u) + 1013904223u;
+
+    return *state >> 8;
+}
+
+/*
+ * Check every kernel the CPU can run, whatever the override,
+ * against the scalar ones on the same inputs. They must give
+ * the same bits, rounding ties and saturating alike.
+ *
+ * Returns the number of kernels that differ
+ */
+int pcm_selftest(void) {
+    static int16_t pcm[TEST_LENGTH * 2];
+    static float f[TEST_LENGTH], re[TEST_LENGTH], im[TEST_LENGTH];
+    static float f_ref[TEST_LENGTH], f_out[TEST_LENGTH];
+    static int16_t s_ref[TEST_LENGTH], s_out[TEST_LENGTH];
+    static complex float c[TEST_LENGTH], c_ref[TEST_LENGTH], c_out[TEST_LENGTH];
+    uint32_t state = TEST_SEED;
+    int failed = 0;
+
+    for (int i = 0; i < (TEST_LENGTH * 2); i++) {
+        pcm[i] = (int16_t) test_random(&state);
+    }
+
+    /*
+     * Floats past full scale, and on the halves
+     */
+    for (int i = 0; i < TEST_LENGTH; i++) {
+        f[i] = ((float) (test_random(&state) % 100000) - 50000.0f) / ((i & 0x1) ? 1.0f : 2.0f);
+        re[i] = cosf(i * 0.1f);
+        im[i] = sinf(i * 0.1f);
+        c[i] = (((float) (test_random(&state) % 4000) - 2000.0f) / 1000.0f) +
+               (((float) (test_random(&state) % 4000) - 2000.0f) / 1000.0f) * I;
+    }
+
+    const struct pcm_kernels *ref = &variants[0];
+
+    for (int v = 1; v < VARIANTS; v++) {
+        const struct pcm_kernels *k = &variants[v];
+        int differ = 0;
+
+        if (!dispatch_cpu(k->level))
+            continue;
+
+        for (int channels = 1; channels <= 2; channels++) {
+            for (int channel = 0; channel < channels; channel++) {
+                ref->to_float(pcm, channels, channel, f_ref, TEST_LENGTH, (1.0f / PCM_SCALE));
+                k->to_float(pcm, channels, channel, f_out, TEST_LENGTH, (1.0f / PCM_SCALE));
+                differ += memcmp(f_ref, f_out, sizeof (f_ref)) != 0;
+
+                ref->mix_down(pcm, channels, channel, re, im, c_ref, TEST_LENGTH, (1.0f / PCM_SCALE));
+                k->mix_down(pcm, channels, channel, re, im, c_out, TEST_LENGTH, (1.0f / PCM_SCALE));
+                differ += memcmp(c_ref, c_out, sizeof (c_ref)) != 0;
+            }
+        }
+
+        ref->from_float(f, s_ref, TEST_LENGTH, 1.0f);
+        k->from_float(f, s_out, TEST_LENGTH, 1.0f);
+        differ += memcmp(s_ref, s_out, sizeof (s_ref)) != 0;
+
+        ref->mix_up(c, re, im, s_ref, TEST_LENGTH, PCM_SCALE);
+        k->mix_up(c, re, im, s_out, TEST_LENGTH, PCM_SCALE);
+        differ += memcmp(s_ref, s_out, sizeof (s_ref)) != 0;
+
+        printf("pcm      %-8s %s\n", k->name, (differ == 0) ? "ok" : "FAILED");
+
+        failed += (differ != 0);
+    }
+
+    return failed;
+}
@@ -0,0 +1,36 @@
+/*
+ * pcm.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <complex.h>
+
+#define PCM_SCALE       16384.0f    // full scale is 2.0, the modem runs at .5
+
+/*
+ * int16 conversion kernels for the PCM boundary. The input
+ * may be interleaved, taking one of channels per frame.
+ * Output to int16 rounds and saturates.
+ */
+void pcm_to_float(const int16_t [], int, int, float [], int, float);
+void pcm_from_float(const float [], int16_t [], int, float);
+void pcm_iq_to_complex(const int16_t [], complex float [], int, float);
+
+void pcm_mix_down(const int16_t [], int, int, const float [], const float [],
+        complex float [], int, float);
+void pcm_mix_up(const complex float [], const float [], const float [],
+        int16_t [], int, float);
+
+const char *pcm_variant(void);
+int pcm_selftest(void);
+
+#ifdef __cplusplus
+}
+#endif
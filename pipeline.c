@@ -0,0 +1,327 @@
+/*
+ * pipeline.c
+ *
+ * Stage per core receive pipeline
+ *
+ * For one very fast channel a single core running the
+ * whole of rx_frame() is the limit. Here each stage of
+ * the receive chain runs on its own thread, optionally
+ * pinned to its own core:
+ *
+ *   mix -> RRC filter -> timing/decimation -> Costas/demod -> sink
+ *
+ * Frames move between stages as block pointers through
+ * SPSC rings, taken in batches, and come back to the
+ * submitter through a free ring once the sink is done.
+ * So throughput is set by the slowest stage rather than
+ * by the whole chain.
+ *
+ * The stages each own their part of the channel state,
+ * the same split used by rx_frame() itself.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+
+#include "pipeline.h"
+
+static long long now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Copy out the packets of the frame the Costas
+ * stage just ran, for the sink
+ */
+static void block_packets(struct rx_block *b, const struct packet_rx *prx) {
+    b->npayload = (prx != NULL) ? prx->npayload : 0;
+
+    if (b->npayload == 0)
+        return;
+
+    memcpy(b->payload, prx->payload, b->npayload * sizeof (prx->payload[0]));
+    memcpy(b->modes, prx->modes, b->npayload * sizeof (prx->modes[0]));
+    memcpy(b->offsets, prx->offsets, b->npayload * sizeof (prx->offsets[0]));
+}
+
+static void block_run(struct pipeline *pl, StageID id, struct rx_block *b) {
+    struct channel *chan = pl->chan;
+
+    switch (id) {
+    case STAGE_MIX:
+        rx_mix(chan, b->pcm, b->samples);
+        break;
+    case STAGE_FILTER:
+        rx_filter(chan, b->samples);
+        break;
+    case STAGE_TIMING:
+        b->base = rx_timing(chan, b->samples, b->symbols);
+        break;
+    case STAGE_COSTAS:
+        rx_costas(chan, b->symbols, b->base, b->bits);
+        block_packets(b, chan->packets);
+        break;
+    case STAGE_SINK:
+        if (pl->sink != NULL)
+            pl->sink(pl->user, b);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Hand a block to the next stage, or back
+ * to the free ring from the sink
+ */
+static void block_forward(struct pipeline *pl, StageID id, struct rx_block *b) {
+    if (id == STAGE_SINK) {
+        ringbuf_write(pl->free, &b, 1);
+        sem_post(&pl->free_ready);
+    } else {
+        ringbuf_write(pl->stages[id + 1].in, &b, 1);
+        sem_post(&pl->stages[id + 1].ready);
+    }
+}
+
+static void *stage_thread(void *arg) {
+    struct stage *st = arg;
+    struct pipeline *pl = st->pl;
+    struct rx_block *batch[PIPELINE_BATCH];
+
+    while (1) {
+        int n = 0;
+
+        /*
+         * Wait for one block, then take
+         * whatever else is already queued
+         */
+        sem_wait(&st->ready);
+        n++;
+
+        while (n < PIPELINE_BATCH && sem_trywait(&st->ready) == 0)
+            n++;
+
+        ringbuf_read(st->in, batch, n);
+
+        for (int i = 0; i < n; i++) {
+            struct rx_block *b = batch[i];
+
+            if (b == NULL) {
+                // closing, pass it along and stop
+
+                if (st->id != STAGE_SINK) {
+                    ringbuf_write(pl->stages[st->id + 1].in, &b, 1);
+                    sem_post(&pl->stages[st->id + 1].ready);
+                }
+
+                return NULL;
+            }
+
+            long long start = now_ns();
+
+            block_run(pl, st->id, b);
+
+            long long end = now_ns();
+            unsigned long long service = (unsigned long long) (end - start);
+
+            atomic_fetch_add(&st->service_ns, service);
+            atomic_fetch_add(&st->wait_ns, (unsigned long long) (start - b->stamp[st->id]));
+
+            if (service > atomic_load(&st->max_ns))
+                atomic_store(&st->max_ns, service);
+
+            b->stamp[st->id + 1] = end;
+
+            if (st->id == STAGE_SINK) {
+                atomic_fetch_add(&pl->latency_ns, (unsigned long long) (end - b->stamp[0]));
+                atomic_fetch_add(&pl->count, 1);
+            }
+
+            block_forward(pl, st->id, b);
+        }
+    }
+}
+
+/*
+ * sink may be NULL to discard the bits
+ *
+ * Returns NULL on error
+ */
+struct pipeline *pipeline_create(struct channel *chan,
+        void (*sink)(void *, const struct rx_block *), void *user) {
+    struct pipeline *pl = calloc(1, sizeof (struct pipeline));
+
+    if (pl == NULL)
+        return NULL;
+
+    const int frame_size = chan->profile->frame_size;
+    const int symbols = frame_size / chan->profile->cycles;
+
+    pl->chan = chan;
+    pl->sink = sink;
+    pl->user = user;
+
+    /*
+     * Room for every block plus the closing NULL
+     */
+    if ((pl->free = ringbuf_create(PIPELINE_BLOCKS + 1, sizeof (struct rx_block *))) == NULL) {
+        free(pl);
+        return NULL;
+    }
+
+    sem_init(&pl->free_ready, 0, 0);
+
+    for (int s = 0; s < STAGES; s++) {
+        pl->stages[s].pl = pl;
+        pl->stages[s].id = s;
+        pl->stages[s].in = ringbuf_create(PIPELINE_BLOCKS + 1, sizeof (struct rx_block *));
+
+        if (pl->stages[s].in == NULL) {
+            pipeline_destroy(pl);
+            return NULL;
+        }
+
+        sem_init(&pl->stages[s].ready, 0, 0);
+    }
+
+    for (int i = 0; i < PIPELINE_BLOCKS; i++) {
+        struct rx_block *b = &pl->blocks[i];
+
+        b->pcm = calloc(frame_size, sizeof (int16_t));
+        b->samples = calloc(frame_size, sizeof (complex float));
+        b->symbols = calloc(symbols * PACKET_TIMINGS, sizeof (complex float));
+        b->bits = calloc(symbols * MAPPER_BITS, sizeof (uint8_t));
+
+        if (b->pcm == NULL || b->samples == NULL || b->symbols == NULL || b->bits == NULL) {
+            pipeline_destroy(pl);
+            return NULL;
+        }
+
+        ringbuf_write(pl->free, &b, 1);
+        sem_post(&pl->free_ready);
+    }
+
+    return pl;
+}
+
+/*
+ * Start a thread per stage. With cpu zero or more,
+ * stage s is pinned to core cpu + s.
+ *
+ * Returns -1 on error, with any stages started
+ * stopped again, so the pipeline can be destroyed
+ */
+int pipeline_start(struct pipeline *pl, int cpu) {
+    for (int s = 0; s < STAGES; s++) {
+        struct stage *st = &pl->stages[s];
+
+        if (pthread_create(&st->thread, NULL, stage_thread, st) != 0) {
+            struct rx_block *b = NULL;
+
+            /*
+             * The closing NULL stops at the first stage
+             * not started, in a ring with room for it
+             */
+            if (s > 0) {
+                ringbuf_write(pl->stages[STAGE_MIX].in, &b, 1);
+                sem_post(&pl->stages[STAGE_MIX].ready);
+            }
+
+            for (int i = 0; i < s; i++) {
+                pthread_join(pl->stages[i].thread, NULL);
+            }
+
+            return -1;
+        }
+
+        if (cpu >= 0) {
+            cpu_set_t set;
+
+            CPU_ZERO(&set);
+            CPU_SET(cpu + s, &set);
+
+            pthread_setaffinity_np(st->thread, sizeof (cpu_set_t), &set);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Queue one frame of PCM, from one producer thread.
+ * Waits only if every block is in flight.
+ */
+void pipeline_submit(struct pipeline *pl, const int16_t pcm[]) {
+    struct rx_block *b;
+
+    sem_wait(&pl->free_ready);
+    ringbuf_read(pl->free, &b, 1);
+
+    memcpy(b->pcm, pcm, pl->chan->profile->frame_size * sizeof (int16_t));
+    b->stamp[0] = now_ns();
+
+    ringbuf_write(pl->stages[STAGE_MIX].in, &b, 1);
+    sem_post(&pl->stages[STAGE_MIX].ready);
+}
+
+/*
+ * Drain every frame submitted, and stop the threads
+ */
+void pipeline_close(struct pipeline *pl) {
+    struct rx_block *b = NULL;
+
+    ringbuf_write(pl->stages[STAGE_MIX].in, &b, 1);
+    sem_post(&pl->stages[STAGE_MIX].ready);
+
+    for (int s = 0; s < STAGES; s++) {
+        pthread_join(pl->stages[s].thread, NULL);
+    }
+}
+
+void pipeline_destroy(struct pipeline *pl) {
+    if (pl == NULL)
+        return;
+
+    for (int i = 0; i < PIPELINE_BLOCKS; i++) {
+        free(pl->blocks[i].pcm);
+        free(pl->blocks[i].samples);
+        free(pl->blocks[i].symbols);
+        free(pl->blocks[i].bits);
+    }
+
+    for (int s = 0; s < STAGES; s++) {
+        if (pl->stages[s].in != NULL) {
+            ringbuf_destroy(pl->stages[s].in);
+            sem_destroy(&pl->stages[s].ready);
+        }
+    }
+
+    ringbuf_destroy(pl->free);
+    sem_destroy(&pl->free_ready);
+
+    free(pl);
+}
+
+void pipeline_stats(struct pipeline *pl, struct pipeline_stats *stats) {
+    unsigned long count = atomic_load(&pl->count);
+    double n = (count > 0) ? (double) count : 1.0;
+
+    stats->blocks = count;
+
+    for (int s = 0; s < STAGES; s++) {
+        stats->mean_us[s] = atomic_load(&pl->stages[s].service_ns) / n / 1000.0;
+        stats->max_us[s] = atomic_load(&pl->stages[s].max_ns) / 1000.0;
+        stats->wait_us[s] = atomic_load(&pl->stages[s].wait_ns) / n / 1000.0;
+    }
+
+    stats->latency_us = atomic_load(&pl->latency_ns) / n / 1000.0;
+}
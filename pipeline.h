@@ -0,0 +1,106 @@
+/*
+ * pipeline.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "modem.h"
+#include "ringbuf.h"
+
+#define PIPELINE_BLOCKS 16  // frames in flight
+#define PIPELINE_BATCH  4   // most frames a stage takes at once
+
+typedef enum {
+    STAGE_MIX,
+    STAGE_FILTER,
+    STAGE_TIMING,
+    STAGE_COSTAS,
+    STAGE_SINK,
+    STAGES
+} StageID;
+
+/*
+ * One frame as it moves through the stages
+ */
+struct rx_block {
+    int16_t *pcm;
+    complex float *samples;
+    complex float *symbols;
+    uint8_t *bits;              // mapper->bits per symbol
+    long base;                  // sample offset of the first symbol
+    long long stamp[STAGES + 1];  // ns, submit then end of each stage
+
+    /*
+     * The packets decoded in this frame, copied from
+     * the channel, as the Costas stage goes on to the
+     * next frame while the sink has this one
+     */
+    uint8_t payload[PACKET_QUEUE][PACKET_BYTES];
+    ModID modes[PACKET_QUEUE];
+    long offsets[PACKET_QUEUE];
+    int npayload;
+};
+
+struct pipeline_stats {
+    unsigned long blocks;
+    double mean_us[STAGES];     // service time per stage
+    double max_us[STAGES];
+    double wait_us[STAGES];     // mean time queued before each stage
+    double latency_us;          // mean submit to end of sink
+};
+
+struct pipeline;
+
+/*
+ * One thread per stage. The sink gets the bits and
+ * packets of each frame in order, on the sink thread,
+ * and must take them from the block, not the channel.
+ */
+struct stage {
+    struct pipeline *pl;
+    StageID id;
+    pthread_t thread;
+
+    struct ringbuf *in;         // rx_block pointers into this stage
+    sem_t ready;
+
+    atomic_ullong service_ns;
+    atomic_ullong max_ns;
+    atomic_ullong wait_ns;
+};
+
+struct pipeline {
+    struct channel *chan;
+    void (*sink)(void *, const struct rx_block *);
+    void *user;
+
+    struct rx_block blocks[PIPELINE_BLOCKS];
+    struct ringbuf *free;       // sink back to pipeline_submit()
+    sem_t free_ready;
+
+    struct stage stages[STAGES];
+
+    atomic_ulong count;
+    atomic_ullong latency_ns;
+};
+
+struct pipeline *pipeline_create(struct channel *, void (*)(void *, const struct rx_block *), void *);
+int pipeline_start(struct pipeline *, int);
+void pipeline_submit(struct pipeline *, const int16_t []);
+void pipeline_close(struct pipeline *);
+void pipeline_destroy(struct pipeline *);
+void pipeline_stats(struct pipeline *, struct pipeline_stats *);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,135 @@
+/*
+ * profile.c
+ *
+ * Runtime selectable rate profiles
+ *
+ * A mixed-rate gateway may run many channels at each
+ * rate, so the filter and oscillator tables are built
+ * the first time a profile is acquired, then reference
+ * counted and shared until the last channel lets go.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "qpsk.h"
+#include "profile.h"
+#include "rrc_fir.h"
+#include "mixer.h"
+
+/*
+ * The 4800 baud profile needs a wider audio
+ * passband, so it runs at twice the sample rate.
+ *
+ * The loop bandwidths and pull-in are in Hz, as a
+ * radio's error is, so the slow profiles are not
+ * left with a fraction of the range of the fast ones.
+ */
+static const struct rate_profile presets[RATE_PROFILES] = {
+    [RATE_300]  = {  9600.0f,  300.0f, CENTER, .35f, 32, 255, FRAME_SIZE, 6.0f, 3.0f, 100.0f },
+    [RATE_1200] = {  9600.0f, 1200.0f, CENTER, .35f,  8, 127, FRAME_SIZE, 12.0f, 6.0f, 200.0f },
+    [RATE_2400] = {      FS,       RS, CENTER, .35f, CYCLES, NTAPS, FRAME_SIZE, 24.0f, 12.0f, 200.0f },
+    [RATE_4800] = { 19200.0f, 4800.0f, 3600.0f, .35f,  4, 127, (FRAME_SIZE * 2), 48.0f, 24.0f, 200.0f }
+};
+
+static struct profile_tables *cache;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+const struct rate_profile *rate_profile(RateID id) {
+    if (id < 0 || id >= RATE_PROFILES)
+        return NULL;
+
+    return &presets[id];
+}
+
+static struct profile_tables *profile_build(const struct rate_profile *p) {
+    struct profile_tables *t = calloc(1, sizeof (struct profile_tables));
+
+    if (t == NULL)
+        return NULL;
+
+    t->coeffs = malloc(RRC_HALF(p->ntaps) * sizeof (float));
+
+    if (t->coeffs == NULL) {
+        free(t);
+        return NULL;
+    }
+
+    t->profile = *p;
+
+    /*
+     * Create an RRC filter using the
+     * Sample Rate, baud, and Alpha
+     */
+    rrc_make(t->coeffs, p->ntaps, p->fs, p->rs, p->alpha);
+
+    /*
+     * A carrier that does not repeat is left
+     * to the mixer NCO of each channel
+     */
+    t->carrier = mixer_table_create(p->center, p->fs);
+
+    return t;
+}
+
+/*
+ * Returns the shared tables for the profile,
+ * building them if this is the first user.
+ *
+ * Returns NULL on error
+ */
+const struct profile_tables *profile_acquire(const struct rate_profile *p) {
+    struct profile_tables *t;
+
+    if (p == NULL || p->cycles < 1 || p->ntaps < 1 || (p->ntaps % 2) == 0 ||
+            fabsf((p->fs / p->rs) - p->cycles) > 0.001f ||
+            (p->frame_size % p->cycles) != 0)
+        return NULL;
+
+    pthread_mutex_lock(&cache_lock);
+
+    for (t = cache; t != NULL; t = t->next) {
+        if (memcmp(&t->profile, p, sizeof (struct rate_profile)) == 0)
+            break;
+    }
+
+    if (t == NULL && (t = profile_build(p)) != NULL) {
+        t->next = cache;
+        cache = t;
+    }
+
+    if (t != NULL)
+        t->refs++;
+
+    pthread_mutex_unlock(&cache_lock);
+
+    return t;
+}
+
+void profile_release(const struct profile_tables *tables) {
+    struct profile_tables **pp;
+
+    if (tables == NULL)
+        return;
+
+    pthread_mutex_lock(&cache_lock);
+
+    for (pp = &cache; *pp != NULL; pp = &(*pp)->next) {
+        struct profile_tables *t = *pp;
+
+        if (t == tables) {
+            if (--t->refs == 0) {
+                *pp = t->next;
+                mixer_table_destroy(t->carrier);
+                free(t->coeffs);
+                free(t);
+            }
+
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,65 @@
+/*
+ * profile.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <complex.h>
+
+#include "mixer.h"
+
+/*
+ * Preset rate profiles
+ */
+typedef enum {
+    RATE_300,
+    RATE_1200,
+    RATE_2400,
+    RATE_4800,
+    RATE_PROFILES
+} RateID;
+
+/*
+ * Everything that used to be a compile-time
+ * constant of the modem, chosen per channel
+ */
+struct rate_profile {
+    float fs;           // sample rate
+    float rs;           // symbol rate
+    float center;       // carrier frequency
+    float alpha;        // RRC roll-off
+    int cycles;         // samples per symbol
+    int ntaps;          // RRC filter length
+    int frame_size;     // samples per rx_frame()
+    float loop_wide;    // Costas loop bandwidth in Hz, acquiring
+    float loop_narrow;  // and once locked
+    float pull;         // largest carrier offset taken, in Hz, 0 for the loop's own
+};
+
+/*
+ * Tables built once per distinct profile, and
+ * shared read-only by every channel that uses it
+ */
+struct profile_tables {
+    struct rate_profile profile;
+
+    float *coeffs;          // RRC coefficients up to the centre tap
+    struct mixer_table *carrier;    // one period, NULL if none
+
+    int refs;
+    struct profile_tables *next;
+};
+
+const struct rate_profile *rate_profile(RateID);
+
+const struct profile_tables *profile_acquire(const struct rate_profile *);
+void profile_release(const struct profile_tables *);
+
+#ifdef __cplusplus
+}
+#endif
@@ -2,6 +2,16 @@
  * qpsk.c
  *
  * Testing program for qpsk modem algorithms, January 2023
+ *
+ * Usage: qpsk [300|1200|2400|4800] [bpsk|qpsk|8psk|16qam] [44100|48000]
+ *        qpsk selftest
+ *        qpsk golden
+ *
+ * Exits with failure if fewer than PASS of the packets of
+ * either mode are decoded through the round trip, with
+ * rx_frame() or through the stage per core pipeline, or
+ * of a shorter burst looped back through the full duplex
+ * runtime.
  */
 
 // Includes
@@ -14,346 +24,776 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include "qpsk.h"
-#include "costas_loop.h"
+#include "modem.h"
+#include "profile.h"
+#include "diag.h"
+#include "packet.h"
+#include "capture.h"
+#include "offline.h"
+#include "pipeline.h"
+#include "runtime.h"
+#include "dispatch.h"
+#include "pcm.h"
 #include "rrc_fir.h"
-
-// Prototypes
-
-static void qpsk_demod(complex float, int []);
-static void rx_frame(int16_t []);
-static complex float qpsk_mod(int []);
-static int tx_frame(int16_t [], complex float [], int);
-static complex float qpsk_mod(int []);
-static int qpsk_packet_mod(int16_t [], int [], int);
+#include "costas_bank.h"
+#include "resample.h"
+#include "golden.h"
+#include "channelizer.h"
+
+#define PACKETS 200
+#define SEGMENT 10.0    // seconds per offline segment
+#define PASS    0.9     // of the packets of each mode, for make check
+#define LOOP_PACKETS 20     // through the runtime loopback
+#define LOOP_SPEED  20      // times real time
+#define LOOP_LEAD   8.0     // seconds of idle, for the loops to settle at 300 baud
+#define CHZ_CHANNELS 8      // channelizer bins, fs / 2 apart
+#define CHZ_PACKETS 20      // on each busy bin
+#define CHZ_SNR     20.0    // dB, of the whole wideband stream
 
 // Globals
 
-FILE *fin;
-FILE *fout;
+/*
+ * Bin 2 is beside 1, and 6 is the negative
+ * frequency of 2, so each has a neighbour
+ */
+static const bool chz_busy[CHZ_CHANNELS] = { [1] = true, [2] = true, [6] = true };
 
-complex float tx_filter[NTAPS];
-complex float rx_filter[NTAPS];
+static const char *mode_names[MOD_MODES] = {
+    [MOD_BPSK] = "bpsk",
+    [MOD_QPSK] = "qpsk",
+    [MOD_8PSK] = "8psk",
+    [MOD_16QAM] = "16qam"
+};
 
-complex float input_frame[FRAME_SIZE];
-complex float decimated_frame[FRAME_SIZE / 2];
-complex float costas_frame[FRAME_SIZE / CYCLES];
+static const char *stage_names[STAGES] = {
+    [STAGE_MIX] = "mix",
+    [STAGE_FILTER] = "filter",
+    [STAGE_TIMING] = "timing",
+    [STAGE_COSTAS] = "costas",
+    [STAGE_SINK] = "sink"
+};
+
+struct capture *fout;
+struct capture_reader *fin;
 
-// Two phase for full duplex
+/*
+ * Transmit symbols to the capture, into frame, or at the
+ * sound card rate into audio if there is a resampler
+ *
+ * Returns the number of samples written
+ */
+static long capture_send(struct channel *chan, complex float symbols[], int count,
+        int16_t frame[], int16_t audio[]) {
+    if (chan->tx_audio == NULL) {
+        int length = tx_frame(chan, frame, symbols, count);
 
-complex float fbb_tx_phase;
-complex float fbb_tx_rect;
+        capture_write(fout, frame, length);
+        return length;
+    }
 
-complex float fbb_rx_phase;
-complex float fbb_rx_rect;
+    int length = tx_audio(chan, symbols, count, audio);
 
-float fbb_offset_freq;
+    capture_write(fout, audio, length);
 
-float d_error;
+    return length;
+}
 
 /*
- * QPSK Quadrant bit-pair values - Gray Coded
+ * Pipeline sink, counting packets by mode
  */
-static const complex float constellation[] = {
-    1.0f + 0.0f * I, //  I
-    0.0f + 1.0f * I, //  Q
-    0.0f - 1.0f * I, // -Q
-    -1.0f + 0.0f * I // -I
-};
+static void pipeline_count(void *user, const struct rx_block *b) {
+    int *decoded = user;
+
+    for (int i = 0; i < b->npayload; i++) {
+        decoded[b->modes[i]]++;
+    }
+}
 
 /*
- * Gray coded QPSK demodulation function
+ * Decode the capture again through the pipeline,
+ * one thread per stage, on a channel of its own
  *
- * By rotating received symbol 45 degrees the bits
- * are easier to decode as they are in a specific
- * rectangular quadrants.
- * 
- * Each bit pair differs from the next by only one bit.
+ * Returns -1 on error
  */
-static void qpsk_demod(complex float symbol, int bits[]) {
-    complex float rotate = symbol * cmplx(ROTATE45);
+static int pipeline_decode(const struct rate_profile *p, ModID mode, int decoded[],
+        struct pipeline_stats *stats) {
+    struct channel *chan = channel_create(p);
+    struct pipeline *pl = NULL;
+    int16_t *pcm = malloc(p->frame_size * sizeof (int16_t));
+    int status = -1;
+
+    if (chan == NULL || pcm == NULL || channel_set_mode(chan, mode) != 0 ||
+            channel_set_packets(chan, FEC_1_2) != 0)
+        goto done;
+
+    if ((pl = pipeline_create(chan, pipeline_count, decoded)) == NULL || pipeline_start(pl, -1) != 0)
+        goto done;
+
+    for (uint64_t at = 0; capture_read(fin, at, pcm, p->frame_size) == p->frame_size; at += p->frame_size) {
+        pipeline_submit(pl, pcm);
+    }
+
+    pipeline_close(pl);
+    pipeline_stats(pl, stats);
+    status = 0;
 
-    bits[0] = crealf(rotate) < 0.0f; // I < 0 ?
-    bits[1] = cimagf(rotate) < 0.0f; // Q < 0 ?
+done:
+    pipeline_destroy(pl);
+    free(pcm);
+    channel_destroy(chan);
+
+    return status;
 }
 
 /*
- * Receive function
- * 
- * 2400 baud QPSK at 9600 samples/sec.
- *
- * Remove any frequency and timing offsets
+ * Runtime loopback, playback into a pipe that capture
+ * reads, paced faster than real time but well within
+ * what the receive worker keeps up with
  */
-static void rx_frame(int16_t in[]) {
-    //float distance;
-    float max_i = 0.0f;
-    float max_q = 0.0f;
+struct loopback {
+    ModID mode;
+    int fd[2];                  // read, write
+    int lead;                   // idle frames sent, on the transmit worker
+    int sent;                   // packets
+    atomic_bool tx_done;
+    int tail;                   // playback frames after the last burst
+    struct timespec period;
+
+    int *bits;                  // idle, two per symbol of a frame
+    complex float *symbols;     // a BPSK packet, the longest
+};
 
-    float av_i = 0.0f;;
-    float av_q = 0.0f;
+static bool loop_capture(void *user, int16_t pcm[], int length) {
+    struct loopback *lb = user;
+    uint8_t *p = (uint8_t *) pcm;
+    size_t bytes = length * sizeof (int16_t);
 
-    /*
-     * You need as many histograms as you think
-     * you'll need for timing offset. Using 8 for now.
-     * First [0] index not used.
-     */
-    int hist_i[8] = { 0 };
-    int hist_q[8] = { 0 };
-    
-    int hmax = 0;
-    int index = 0;
+    while (bytes > 0) {
+        ssize_t n = read(lb->fd[0], p, bytes);
 
-    int hist[8] = { 0 };
-    int bits[2];
+        if (n < 0 && errno == EINTR)
+            continue;
 
-    /*
-     * Convert input PCM to complex samples
-     * at 9600 Hz sample rate
-     */
-    for (int i = 0; i < FRAME_SIZE; i++) {
-        fbb_rx_phase *= fbb_rx_rect;
+        if (n <= 0)
+            return false;
 
-        input_frame[i] = fbb_rx_phase * ((float) in[i] / 16384.0f);
+        p += n;
+        bytes -= (size_t) n;
     }
 
-    fbb_rx_phase /= cabsf(fbb_rx_phase); // normalize as magnitude can drift
+    return true;
+}
 
-    /*
-     * Raised Root Cosine Filter
-     */
-    rrc_fir(rx_filter, input_frame, FRAME_SIZE);
+/*
+ * Once the bursts are all out, a ring's worth of
+ * frames and a few more, then the end of the stream
+ */
+static bool loop_playback(void *user, const int16_t pcm[], int length) {
+    struct loopback *lb = user;
 
-    /*
-     * Find maximum absolute I/Q value for one symbol length
-     * after passing through the filter
-     */
-    for (int i = 0; i < FRAME_SIZE; i += CYCLES) {
-        for (int j = 0; j < CYCLES; j++) {
-            av_i += fabsf(crealf(input_frame[i+j]));
-            av_q += fabsf(cimagf(input_frame[i+j]));
-        }
-        
-        av_i /= CYCLES;
-        av_q /= CYCLES;
+    if (atomic_load(&lb->tx_done) && lb->tail++ > (RUNTIME_FRAMES + 4)) {
+        close(lb->fd[1]);
+        return false;
+    }
 
-        if (av_i > max_i) {
-            max_i = av_i;
-        }
+    nanosleep(&lb->period, NULL);
 
-        if (av_q > max_q) {
-            max_q = av_q;
-        }
+    return write(lb->fd[1], pcm, length * sizeof (int16_t)) == (ssize_t) (length * sizeof (int16_t));
+}
 
-        /*
-         * Create I/Q amplitude histograms
-         */
-        float hv_i = (max_i / 8.0f);
-        float hv_q = (max_q / 8.0f);
-    
-        for (int k = 1; k < 8; k++) {
-            if (av_i <= (hv_i * k)) {
-                hist_i[k] += 1;
-                break;
-            }
-        }
+/*
+ * A lead in of idle QPSK frames, then each burst a
+ * frame of idle QPSK and a packet, every other
+ * one BPSK as in the main test, and idle again to the
+ * end of its last frame, so the runtime pads nothing
+ */
+static int loop_transmit(void *user, struct channel *chan, int16_t burst[], int max) {
+    struct loopback *lb = user;
+    const struct rate_profile *p = chan->profile;
+    const int idle = p->frame_size / p->cycles;
+    int *bits = lb->bits;
+    complex float *symbols = lb->symbols;
+    uint8_t payload[PACKET_BYTES] = { 0 };
+
+    if (lb->sent == LOOP_PACKETS) {
+        atomic_store(&lb->tx_done, true);
+        return -1;
+    }
 
-        for (int k = 1; k < 8; k++) {
-            if (av_q <= (hv_q * k)) {
-                hist_q[k] += 1;
-                break;
-            }
-        }
+    for (int i = 0; i < (idle * 2); i++) {
+        bits[i] = rand() % 2;
     }
 
-    /*
-     * Sum the I/Q histograms
-     * and ind the maximum value
-     */
-    for (int i = 0; i < 8; i++) {            
-        hist[i] = (hist_i[i] + hist_q[i]);
+    int length = qpsk_packet_mod(chan, burst, bits, idle);
 
-        if (hist[i] > hmax) {
-            hmax = hist[i];
-            index = i;
-        }
+    if (lb->lead < (int) (LOOP_LEAD * p->fs / p->frame_size)) {
+        lb->lead++;
+        return length;
     }
 
-    /*
-     * Decimate by 4 to the 2400 symbol rate
-     * adjust for the timing error using index
-     */
-    for (int i = 0; i < (FRAME_SIZE / CYCLES); i++) {
-        int extended = (FRAME_SIZE / CYCLES) + i; // compute once
-        
-        decimated_frame[i] = decimated_frame[extended];			// use previous frame
-        decimated_frame[extended] = input_frame[(i * CYCLES) + index];	// current frame
-    }
+    payload[0] = (uint8_t) lb->sent;
+
+    int count = packet_build(payload, symbols, (lb->sent & 0x1) ? MOD_BPSK : lb->mode, FEC_1_2);
+
+    lb->sent++;
+    length += tx_frame(chan, &burst[length], symbols, count);
+
+    int pad = ((p->frame_size - (length % p->frame_size)) % p->frame_size) / p->cycles;
+
+    return length + qpsk_packet_mod(chan, &burst[length], bits, pad);
+}
+
+/*
+ * Returns the packets decoded through the
+ * runtime, or -1 on error
+ */
+static long loopback_decode(const struct rate_profile *p, ModID mode, struct runtime_stats *stats) {
+    struct loopback lb = { .mode = mode, .fd = { -1, -1 } };
+    const struct runtime_io io = { loop_capture, loop_playback, loop_transmit, &lb };
+    const int burst = (2 * p->frame_size) + (packet_symbols(MOD_BPSK, FEC_1_2) * p->cycles);
+    struct channel *chan = channel_create(p);
+    struct runtime *rt = NULL;
+    long status = -1;
+
+    atomic_init(&lb.tx_done, false);
+    lb.period.tv_nsec = (long) (1e9 * p->frame_size / p->fs / LOOP_SPEED);
 
     /*
-     * Costas Loop over the decimated frame
+     * Allocated once, as runtime_create() does its
+     * buffers, not on the transmit worker's stack
      */
-    for (int i = 0; i < (FRAME_SIZE / CYCLES); i++) {
-       costas_frame[i] = decimated_frame[i] * cmplxconj(get_phase());
+    lb.bits = malloc((p->frame_size / p->cycles) * 2 * sizeof (int));
+    lb.symbols = malloc(packet_symbols(MOD_BPSK, FEC_1_2) * sizeof (complex float));
 
-#ifdef TEST_SCATTER
-        fprintf(stderr, "%f %f\n", crealf(costas_frame[i]), cimagf(costas_frame[i]));
-#endif
+    if (lb.bits == NULL || lb.symbols == NULL || chan == NULL || channel_set_mode(chan, mode) != 0 ||
+            channel_set_packets(chan, FEC_1_2) != 0 || pipe(lb.fd) != 0)
+        goto done;
 
-        d_error = phase_detector(costas_frame[i]);
+    channel_set_offset(chan, 50.0, 0.0);
 
-        advance_loop(d_error);
-        phase_wrap();
-        frequency_limit();
+    if ((rt = runtime_create(chan, &io, burst)) == NULL)
+        goto done;
 
-        qpsk_demod(costas_frame[i], bits);
+    if (runtime_start(rt, 0) == 0) {
+        struct link_stats link;
 
-        //printf("%d%d ", bits[0], bits[1]);
+        runtime_wait(rt);
+        runtime_stats(rt, stats);
+        channel_telemetry(chan, &link);
+
+        status = (long) link.packets;
+    } else {
+        close(lb.fd[1]);
     }
 
-    /*
-     * Save the detected frequency error
-     */
-    fbb_offset_freq = (get_frequency() * RS / TAU);	// convert radians to freq at symbol rate
+done:
+    runtime_destroy(rt);
+
+    if (lb.fd[0] >= 0)
+        close(lb.fd[0]);
+
+    free(lb.bits);
+    free(lb.symbols);
+    channel_destroy(chan);
+
+    return status;
 }
 
 /*
- * Modulate the symbols by first upsampling to 9600 Hz sample rate,
- * and translating the spectrum to 1500 Hz, where it is filtered
- * using the root raised cosine coefficients.
+ * Complex Gaussian noise of unit power
  */
-static int tx_frame(int16_t samples[], complex float symbol[], int length) {
-    complex float signal[(length * CYCLES)];
+static complex float noise(void) {
+    float u = (rand() + 1.0f) / ((float) RAND_MAX + 2.0f);
+    float v = rand() / (float) RAND_MAX;
 
-    /*
-     * Build the 2400 baud packet Frame zero padding
-     * for the desired 9600 Hz sample rate.
-     */
-    for (int i = 0; i < length; i++) {
-        signal[(i * CYCLES)] = symbol[i];
+    return sqrtf(-logf(u)) * cexpf(I * (float) (TAU * v));
+}
 
-        for (int j = 1; j < CYCLES; j++) {
-            signal[(i * CYCLES) + j] = 0.0f;
+/*
+ * Packets on the busy bins of a wideband stream, each
+ * from a transmitter at the wideband rate moved up to
+ * its bin, and a receiver on every bin through the
+ * channelizer. The first payload byte is the bin, so a
+ * packet from any other bin is counted as foreign.
+ * There is noise over the stream, as there would be
+ * off the air, without which a neighbour leaking in far
+ * down is still a clean signal to an idle receiver.
+ *
+ * Returns -1 on error
+ */
+static int channelizer_decode(const struct rate_profile *p, ModID mode, int own[], int *foreign) {
+    const int decim = CHZ_CHANNELS / 2;
+    const struct mapper *qpsk = mapper_get(MOD_QPSK);
+    const int idle = p->frame_size / p->cycles;
+    const int packet = packet_symbols(MOD_BPSK, FEC_1_2);
+    const int nsymbols = (idle * 2) + (CHZ_PACKETS * (idle + packet));
+    const long length = (long) nsymbols * p->cycles * decim;
+    const int chunk = p->frame_size * decim;
+
+    struct rate_profile wide = *p;
+    struct channelizer *chz = channelizer_create(p->fs * decim, CHZ_CHANNELS, decim);
+    struct channel *rx[CHZ_CHANNELS] = { NULL };
+    complex float *stream = calloc(length + chunk, sizeof (complex float));
+    complex float *signal = malloc(length * sizeof (complex float));
+    complex float *symbols = malloc(nsymbols * sizeof (complex float));
+    int status = -1;
+
+    wide.fs *= decim;
+    wide.cycles *= decim;
+    wide.ntaps = (p->ntaps * decim) + 1;
+    wide.frame_size *= decim;
+
+    *foreign = 0;
+
+    if (chz == NULL || stream == NULL || signal == NULL || symbols == NULL)
+        goto done;
+
+    for (int m = 0; m < CHZ_CHANNELS; m++) {
+        own[m] = 0;
+
+        if (!chz_busy[m])
+            continue;
+
+        /*
+         * A random lead of idle, so the bins are not
+         * in step, then idle and a packet in turn
+         */
+        struct channel *tx = channel_create(&wide);
+        uint8_t payload[PACKET_BYTES];
+        int n = 0;
+
+        if (tx == NULL)
+            goto done;
+
+        for (int lead = idle + (rand() % idle); n < lead; n++) {
+            int bits[2] = { rand() % 2, rand() % 2 };
+
+            symbols[n] = mapper_map(qpsk, bits);
+        }
+
+        for (int k = 0; k < CHZ_PACKETS; k++) {
+            for (int i = 0; i < idle; i++, n++) {
+                int bits[2] = { rand() % 2, rand() % 2 };
+
+                symbols[n] = mapper_map(qpsk, bits);
+            }
+
+            payload[0] = (uint8_t) m;
+
+            for (int i = 1; i < PACKET_BYTES; i++) {
+                payload[i] = (uint8_t) rand();
+            }
+
+            n += packet_build(payload, &symbols[n], (k & 0x1) ? MOD_BPSK : mode, FEC_1_2);
+        }
+
+        long count = tx_baseband_frame(tx, signal, symbols, n);
+
+        channel_destroy(tx);
+
+        for (long i = 0; i < count; i++) {
+            stream[i] += signal[i] * cexpf(I * (float) (TAU * ((m * i) % CHZ_CHANNELS) / CHZ_CHANNELS));
         }
     }
 
-    /*
-     * Raised Root Cosine Filter
-     */
-    rrc_fir(tx_filter, signal, (length * CYCLES));
+    double power = 0.0;
 
-    /*
-     * Shift Baseband to Center Frequency
-     */
-    for (int i = 0; i < (length * CYCLES); i++) {
-        fbb_tx_phase *= fbb_tx_rect;
-        signal[i] *= fbb_tx_phase;
+    for (long i = 0; i < length; i++) {
+        power += crealf(stream[i] * conjf(stream[i]));
     }
 
-    fbb_tx_phase /= cabsf(fbb_tx_phase); // normalize as magnitude can drift
+    const float sigma = (float) sqrt((power / length) * pow(10.0, -CHZ_SNR / 10.0));
+
+    for (long i = 0; i < length; i++) {
+        stream[i] += sigma * noise();
+    }
+
+    for (int m = 0; m < CHZ_CHANNELS; m++) {
+        if ((rx[m] = channel_create(p)) == NULL || channel_set_mode(rx[m], mode) != 0 ||
+                channel_set_packets(rx[m], FEC_1_2) != 0 || channelizer_attach(chz, m, rx[m]) != 0)
+            goto done;
+    }
 
     /*
-     * Now return the resulting real samples
-     * (imaginary part discarded)
+     * A frame for every channel each chunk, so
+     * the packets of each can be taken after it
      */
-    for (int i = 0; i < (length * CYCLES); i++) {
-        samples[i] = (int16_t)(crealf(signal[i]) * 16384.0f); // @ .5
-    }
+    for (long at = 0; at < length; at += chunk) {
+        channelizer_process(chz, &stream[at], chunk);
 
-    return (length * CYCLES);
-}
+        for (int m = 0; m < CHZ_CHANNELS; m++) {
+            const struct packet_rx *prx = rx[m]->packets;
 
-/*
- * Gray coded QPSK modulation function
- */
-static complex float qpsk_mod(int bits[]) {
-    return constellation[(bits[1] << 1) | bits[0]];
-}
+            for (int i = 0; i < prx->npayload; i++) {
+                if (prx->payload[i][0] == m)
+                    own[m]++;
+                else
+                    (*foreign)++;
+            }
+        }
+    }
 
-static int qpsk_packet_mod(int16_t samples[], int tx_bits[], int length) {
-    complex float symbol[length];
-    int dibit[2];
+    status = 0;
 
-    for (int i = 0, s = 0; i < length; i++, s += 2) {
-        dibit[0] = tx_bits[s + 1] & 0x1;
-        dibit[1] = tx_bits[s ] & 0x1;
+done:
+    channelizer_destroy(chz);
 
-        symbol[i] = qpsk_mod(dibit);
+    for (int m = 0; m < CHZ_CHANNELS; m++) {
+        channel_destroy(rx[m]);
     }
 
-    return tx_frame(samples, symbol, length);
+    free(stream);
+    free(signal);
+    free(symbols);
+
+    return status;
 }
 
 // Main Program
 
 int main(int argc, char** argv) {
-    int bits[6400];
-    int16_t frame[FRAME_SIZE];
+    RateID rate = RATE_2400;
+    ModID mode = MOD_QPSK;
+    int card = 0;
+    int decoded[MOD_MODES] = { 0 };
     int length;
 
+    /*
+     * Every SIMD kernel the CPU has against the scalar one
+     */
+    if (argc > 1 && strcmp(argv[1], "selftest") == 0) {
+        printf("Using %s\n", dispatch_name(dispatch_level()));
+
+        int failed = pcm_selftest() + rrc_selftest() + viterbi_selftest() +
+                     costas_bank_selftest() + resample_selftest() + golden_selftest();
+
+        return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    /*
+     * The reference tables for golden.c
+     */
+    if (argc > 1 && strcmp(argv[1], "golden") == 0) {
+        golden_print();
+        return (EXIT_SUCCESS);
+    }
+
+    if (argc > 1) {
+        switch (atoi(argv[1])) {
+        case 300:
+            rate = RATE_300;
+            break;
+        case 1200:
+            rate = RATE_1200;
+            break;
+        case 2400:
+            rate = RATE_2400;
+            break;
+        case 4800:
+            rate = RATE_4800;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [300|1200|2400|4800] [bpsk|qpsk|8psk|16qam] [44100|48000]\n", argv[0]);
+            return (EXIT_FAILURE);
+        }
+    }
+
+    if (argc > 2) {
+        for (mode = 0; mode < MOD_MODES; mode++) {
+            if (strcmp(argv[2], mode_names[mode]) == 0)
+                break;
+        }
+
+        if (mode == MOD_MODES) {
+            fprintf(stderr, "Usage: %s [300|1200|2400|4800] [bpsk|qpsk|8psk|16qam] [44100|48000]\n", argv[0]);
+            return (EXIT_FAILURE);
+        }
+    }
+
+    /*
+     * A sound card rate runs the signal through
+     * the resamplers, as a card would
+     */
+    if (argc > 3 && (card = atoi(argv[3])) <= 0) {
+        fprintf(stderr, "Usage: %s [300|1200|2400|4800] [bpsk|qpsk|8psk|16qam] [44100|48000]\n", argv[0]);
+        return (EXIT_FAILURE);
+    }
+
     srand(time(0));
 
     /*
-     * All terms are radians per sample.
-     *
-     * The loop bandwidth determins the lock range
-     * and should be set around 2pi/100 to 2pi/200
+     * Create the channel, which builds the RRC filter
+     * using the Sample Rate, baud, and Alpha of the profile
      */
-    create_control_loop((TAU / 100.0f), -1.0f, 1.0f);
+    struct channel *chan = channel_create(rate_profile(rate));
+
+    if (chan == NULL) {
+        fprintf(stderr, "Unable to create the modem channel\n");
+        return (EXIT_FAILURE);
+    }
+
+    const struct rate_profile *p = chan->profile;
 
     /*
-     * Create an RRC filter using the
-     * Sample Rate, baud, and Alpha
+     * Each packet follows some idle QPSK symbols, one
+     * bit pair per symbol. Every other packet is BPSK,
+     * which any receive mode takes, and the payload
+     * starts with the packet number.
      */
-    rrc_make(FS, RS, .35f);
+    int idle = (p->frame_size / p->cycles);
+    int packet = packet_symbols(MOD_BPSK, FEC_1_2);
+    const struct mapper *qpsk = mapper_get(MOD_QPSK);
+    int bits[(idle * 2)];
+    complex float symbols[((idle > packet) ? idle : packet)];
+    int16_t frame[(((idle > packet) ? idle : packet) * p->cycles)];
+    int16_t *audio = NULL;
+    uint8_t payload[PACKET_BYTES];
+
+    if (card > 0) {
+        if (channel_set_audio(chan, card) != 0 ||
+                (audio = malloc(resampler_bound(chan->tx_audio, (int) (sizeof (frame) / sizeof (frame[0]))) *
+                sizeof (int16_t))) == NULL) {
+            fprintf(stderr, "Unable to resample to %d\n", card);
+            return (EXIT_FAILURE);
+        }
+    }
 
     /*
      * create the QPSK data waveform.
-     * This simulates the transmitted packets.
+     * This simulates the transmitted packets,
+     * marking where each one starts.
      */
-    fout = fopen(TX_FILENAME, "wb");
+    struct capture_info info = { CAP_PCM16, 1, 0, (card > 0) ? card : p->fs, p->rs, p->center };
+    uint64_t sent = 0;
+
+    if ((fout = capture_create(TX_FILENAME, &info)) == NULL) {
+        fprintf(stderr, "Unable to create %s\n", TX_FILENAME);
+        return (EXIT_FAILURE);
+    }
 
-    fbb_tx_phase = cmplx(0.0f);
-    //fbb_tx_rect = cmplx(TAU * CENTER / FS);
-    //fbb_offset_freq = CENTER;
+    //channel_set_offset(chan, 0.0, 0.0);
+    //chan->fbb_offset_freq = p->center;
 
-    fbb_tx_rect = cmplx(TAU * (CENTER + 50.0) / FS);
-    fbb_offset_freq = (CENTER + 50.0);
+    channel_set_offset(chan, 50.0, 0.0);
+    chan->fbb_offset_freq = (p->center + 50.0);
 
-    for (int k = 0; k < 1000; k++) {
-        // 256 QPSK
-        for (int i = 0; i < FRAME_SIZE; i++) {
+    for (int k = 0; k < PACKETS; k++) {
+        for (int i = 0; i < (idle * 2); i++) {
             bits[i] = rand() % 2;
         }
 
-        length = qpsk_packet_mod(frame, bits, (FRAME_SIZE / 2));
+        for (int i = 0; i < idle; i++) {
+            symbols[i] = mapper_map(qpsk, &bits[(i * 2)]);
+        }
+
+        sent += capture_send(chan, symbols, idle, frame, audio);
+
+        payload[0] = (uint8_t) (k >> 8);
+        payload[1] = (uint8_t) k;
+
+        for (int i = 2; i < PACKET_BYTES; i++) {
+            payload[i] = (uint8_t) rand();
+        }
+
+        length = packet_build(payload, symbols, (k & 0x1) ? MOD_BPSK : mode, FEC_1_2);
 
-        fwrite(frame, sizeof (int16_t), length, fout);
+        capture_mark(fout, sent, CAP_EVENT_PACKET, (float) k);
+        sent += capture_send(chan, symbols, length, frame, audio);
     }
 
-    fclose(fout);
+    capture_close(fout);
 
     /*
      * Now try to process what was transmitted
      */
-    fin = fopen(TX_FILENAME, "rb");
+    if ((fin = capture_open(TX_FILENAME)) == NULL) {
+        fprintf(stderr, "Unable to read %s\n", TX_FILENAME);
+        return (EXIT_FAILURE);
+    }
+
+    uint64_t received = 0;
 
-    fbb_rx_phase = cmplx(0.0f);
-    fbb_rx_rect = cmplxconj(TAU * CENTER / FS);
+    channel_set_mode(chan, mode);
+    channel_set_packets(chan, FEC_1_2);
+
+#ifdef TEST_SCATTER
+    /*
+     * Constellation points for the scatter diagram,
+     * see diag2txt to convert them to text
+     */
+    chan->diag = diag_create(SCATTER_FILENAME, p->fs, p->rs);
+#endif
 
     while (1) {
         /*
          * Read in the frame samples
          */
-        size_t count = fread(frame, sizeof (int16_t), FRAME_SIZE, fin);
+        long count = capture_read(fin, received, frame, p->frame_size);
 
-        if (count != FRAME_SIZE)
+        if (count != p->frame_size)
             break;
 
-        rx_frame(frame);
+        received += count;
+
+        if (card == 0) {
+            rx_frame(chan, frame);
+
+            for (int i = 0; i < chan->packets->npayload; i++) {
+                decoded[chan->packets->modes[i]]++;
+            }
+
+            continue;
+        }
+
+        for (int done = 0; done < count; ) {
+            bool ready;
+
+            done += rx_audio(chan, &frame[done], (int) (count - done), &ready);
+
+            for (int i = 0; ready && i < chan->packets->npayload; i++) {
+                decoded[chan->packets->modes[i]]++;
+            }
+        }
     }
-    
-    fclose(fin);
 
-    return (EXIT_SUCCESS);
+    const int expect = (mode == MOD_BPSK) ? PACKETS : (PACKETS / 2);
+    bool passed = (decoded[mode] >= (int) (PASS * expect)) &&
+                  (decoded[MOD_BPSK] >= (int) (PASS * expect));
+
+    if (mode == MOD_BPSK) {
+        printf("bpsk %d of %d packets decoded, %ld CRC errors\n",
+               decoded[MOD_BPSK], expect, chan->packets->crc_errors);
+    } else {
+        printf("%s %d of %d, bpsk %d of %d packets decoded, %ld CRC errors\n",
+               mode_names[mode], decoded[mode], expect, decoded[MOD_BPSK], expect,
+               chan->packets->crc_errors);
+    }
+
+    struct link_stats stats;
+
+    channel_telemetry(chan, &stats);
+
+    printf("EVM %.1f%%, SNR %.1f dB, phase variance %.4f, %.1f Hz, timing %.2f (jitter %.3f), %s, CRC pass %.2f, %lu dropped\n",
+           stats.evm, stats.snr, stats.phase_var, stats.frequency, stats.timing,
+           stats.timing_jitter, stats.locked ? "locked" : "unlocked", stats.crc_pass, stats.dropped);
+
+    /*
+     * Decode it again in segments across the cores,
+     * which should find the same packets, and with
+     * every timing hypothesis, which may find more.
+     * The offline decoder takes the profile rate only.
+     */
+    struct offline_config cfg;
+    struct offline_result res;
+
+    offline_defaults(&cfg, p);
+    cfg.mode = mode;
+    cfg.segment = (long) (SEGMENT * p->fs);
+    cfg.hypotheses = PACKET_TIMINGS;
+
+    if (card == 0) {
+        if (offline_decode(fin, &cfg, &res) != 0) {
+            fprintf(stderr, "Unable to decode offline\n");
+            passed = false;
+        } else {
+            printf("offline %ld of %d packets decoded, %ld rescued, %d segments on %d threads, "
+                   "%ld duplicates, %.2f s\n", res.count, PACKETS, res.rescued, res.segments,
+                   res.threads, res.duplicates, res.seconds);
+
+            passed = passed && (res.count >= (long) (PASS * PACKETS));
+
+            offline_result_free(&res);
+        }
+    }
+
+    /*
+     * And through the pipeline, which runs the same
+     * stages as rx_frame() on threads of their own
+     */
+    int piped[MOD_MODES] = { 0 };
+    struct pipeline_stats ps;
+
+    if (card == 0) {
+        if (pipeline_decode(p, mode, piped, &ps) != 0) {
+            fprintf(stderr, "Unable to run the pipeline\n");
+            passed = false;
+        } else {
+            if (mode != MOD_BPSK)
+                printf("pipeline %s %d of %d, ", mode_names[mode], piped[mode], expect);
+            else
+                printf("pipeline ");
+
+            printf("bpsk %d of %d packets decoded, %lu frames, latency %.0f us\n",
+                   piped[MOD_BPSK], expect, ps.blocks, ps.latency_us);
+
+            // Service time, worst case and queueing, by stage
+
+            for (int s = 0; s < STAGES; s++) {
+                printf("%s%s %.1f us, max %.0f, wait %.0f", (s == 0) ? "stages " : "; ",
+                       stage_names[s], ps.mean_us[s], ps.max_us[s], ps.wait_us[s]);
+            }
+
+            printf("\n");
+
+            passed = passed && (piped[mode] >= (int) (PASS * expect)) &&
+                     (piped[MOD_BPSK] >= (int) (PASS * expect));
+        }
+    }
+
+    /*
+     * Then packets on some bins of a wideband stream,
+     * through the channelizer to a receiver on every bin
+     */
+    int own[CHZ_CHANNELS];
+    int foreign;
+
+    if (card == 0) {
+        if (channelizer_decode(p, mode, own, &foreign) != 0) {
+            fprintf(stderr, "Unable to run the channelizer\n");
+            passed = false;
+        } else {
+            const char *sep = "channelizer";
+
+            for (int m = 0; m < CHZ_CHANNELS; m++) {
+                if (chz_busy[m]) {
+                    printf("%s bin %d %d", sep, m, own[m]);
+                    passed = passed && (own[m] >= (int) (PASS * CHZ_PACKETS));
+                    sep = ",";
+                }
+            }
+
+            printf(" of %d packets decoded, %d from other bins\n", CHZ_PACKETS, foreign);
+
+            passed = passed && (foreign == 0);
+        }
+    }
+
+    /*
+     * Then a shorter run through the full duplex runtime,
+     * transmit worker to playback to capture to receive
+     */
+    struct runtime_stats rs;
+    long looped = loopback_decode(p, mode, &rs);
+
+    if (looped < 0) {
+        fprintf(stderr, "Unable to run the runtime loopback\n");
+        passed = false;
+    } else {
+        printf("runtime %ld of %d packets decoded, %lu rx %lu tx frames, %lu overruns, %lu underruns\n",
+               looped, LOOP_PACKETS, rs.rx_frames, rs.tx_frames, rs.rx_overruns, rs.tx_underruns);
+
+        passed = passed && (looped >= (long) (PASS * LOOP_PACKETS));
+    }
+
+    capture_reader_close(fin);
+    free(audio);
+
+    diag_destroy(chan->diag);
+    channel_destroy(chan);
+
+    return (passed ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -0,0 +1,712 @@
+/*
+ * qpskd.c
+ *
+ * Modem daemon, serving channels over local sockets
+ *
+ * Usage: qpskd [-s socket] [-f fifo]... [-r 300|1200|2400|4800]
+ *              [-m bpsk|qpsk|8psk|16qam] [-a rate] [-P priority] [-i seconds]
+ *              [-w prefix]
+ *
+ * Each client connected to the PCM socket, or writing to a
+ * named pipe, is a sound card for a channel of its own, and
+ * every packet decoded goes to the listeners on the packet
+ * socket, the PCM socket name with .packets added. The
+ * wire format is in qpskd.h.
+ *
+ * A channel has a thread, optionally SCHED_FIFO, which
+ * runs a frame once all of it has arrived. The frame has to
+ * be done before the next one is due, 53 ms for 512 samples
+ * at 9600, or it is late. A client paced in real time which
+ * gets QPSKD_BACKLOG frames ahead of its thread is an
+ * overrun, and the frames queued are dropped to catch up,
+ * as a sound card would. A frame that arrives after it was
+ * due with nothing queued is the client starving the
+ * channel, and the clock restarts from it.
+ *
+ * The counts and the service time against the frame
+ * period are printed each interval, on SIGUSR1, and when
+ * a client leaves.
+ *
+ * With -w, each channel's input is recorded to prefix
+ * followed by the client number and .cap, with an event
+ * at each sync word the channel detected, for capinfo or
+ * an offline run of the same hours again.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "qpskd.h"
+#include "capture.h"
+#include "modem.h"
+#include "profile.h"
+#include "runtime.h"
+
+#define POLL_MS     100     // longest wait before looking for a stop
+
+static const char *mode_names[MOD_MODES] = {
+    [MOD_BPSK] = "bpsk",
+    [MOD_QPSK] = "qpsk",
+    [MOD_8PSK] = "8psk",
+    [MOD_16QAM] = "16qam"
+};
+
+static const int bauds[RATE_PROFILES] = {
+    [RATE_300] = 300,
+    [RATE_1200] = 1200,
+    [RATE_2400] = 2400,
+    [RATE_4800] = 4800
+};
+
+/*
+ * Set once by the channel thread, with a release so the
+ * hello and the channel are whole for the reports
+ */
+enum client_state {
+    CLIENT_PENDING,             // waiting for the hello
+    CLIENT_RUNNING,
+    CLIENT_REFUSED
+};
+
+struct client {
+    int id;
+    int fd;
+    const char *fifo;           // path, NULL for a socket client
+    struct qpskd_hello hello;
+    struct channel *chan;
+    pthread_t thread;
+    bool realtime;              // got SCHED_FIFO
+
+    int chunk;                  // input frames per modem frame
+    long long period_ns;        // of a frame
+    int16_t *pcm;
+    struct capture *cap;        // of the input, NULL if not recording
+
+    atomic_int state;           // enum client_state
+    atomic_bool done;
+    atomic_ulong frames;
+    atomic_ulong late;          // finished after the next frame was due
+    atomic_ulong overruns;      // fell QPSKD_BACKLOG frames behind
+    atomic_ulong dropped;       // frames thrown away to catch up
+    atomic_ulong starved;       // client sent a frame after it was due
+    atomic_ulong packets;
+    atomic_ullong service_ns;   // total
+    atomic_ullong max_ns;
+};
+
+static struct {
+    struct qpskd_hello defaults;    // for named pipes
+    int priority;
+    const char *record;         // capture prefix, NULL for none
+
+    struct client *clients[QPSKD_CLIENTS];
+    pthread_mutex_t clients_lock;
+
+    int listeners[QPSKD_LISTENERS];
+    int nlisteners;
+    pthread_mutex_t listeners_lock;
+    atomic_ulong undelivered;   // packets a listener was too slow for
+
+    atomic_bool running;
+} daemon_state = {
+    .clients_lock = PTHREAD_MUTEX_INITIALIZER,
+    .listeners_lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static volatile sig_atomic_t stop_signal;
+static volatile sig_atomic_t report_signal;
+
+static void on_signal(int sig) {
+    if (sig == SIGUSR1)
+        report_signal = 1;
+    else
+        stop_signal = 1;
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+/*
+ * Read exactly bytes, waking every POLL_MS to see if
+ * the daemon is stopping
+ *
+ * Returns false at end of stream, on error or stop
+ */
+static bool read_full(int fd, void *buf, size_t bytes) {
+    uint8_t *p = buf;
+
+    while (bytes > 0) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+
+        if (!atomic_load(&daemon_state.running))
+            return false;
+
+        if (poll(&pfd, 1, POLL_MS) <= 0)
+            continue;
+
+        ssize_t n = read(fd, p, bytes);
+
+        if (n == 0)
+            return false;
+
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+
+            return false;
+        }
+
+        p += n;
+        bytes -= (size_t) n;
+    }
+
+    return true;
+}
+
+/*
+ * Send a packet to every listener, without waiting on
+ * any of them, as this is on a channel thread. A full
+ * socket loses the packet, any other error the listener.
+ */
+static void publish(struct client *c) {
+    const struct packet_rx *prx = c->chan->packets;
+    struct qpskd_packet pk = { .magic = QPSKD_MAGIC, .client = c->id };
+
+    for (int i = 0; i < prx->npayload; i++) {
+        pk.sample = prx->offsets[i];
+        pk.mode = (uint8_t) prx->modes[i];
+        memcpy(pk.payload, prx->payload[i], PACKET_BYTES);
+
+        atomic_fetch_add(&c->packets, 1);
+
+        pthread_mutex_lock(&daemon_state.listeners_lock);
+
+        for (int k = 0; k < daemon_state.nlisteners; ) {
+            if (send(daemon_state.listeners[k], &pk, sizeof (pk), MSG_DONTWAIT | MSG_NOSIGNAL) ==
+                    (ssize_t) sizeof (pk)) {
+                k++;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                atomic_fetch_add(&daemon_state.undelivered, 1);
+                k++;
+            } else {
+                close(daemon_state.listeners[k]);
+                daemon_state.listeners[k] = daemon_state.listeners[--daemon_state.nlisteners];
+            }
+        }
+
+        pthread_mutex_unlock(&daemon_state.listeners_lock);
+    }
+}
+
+/*
+ * Set up the channel the hello asks for
+ *
+ * Returns -1 on error
+ */
+static int client_setup(struct client *c) {
+    const struct qpskd_hello *h = &c->hello;
+    int id;
+
+    for (id = 0; id < RATE_PROFILES; id++) {
+        if (bauds[id] == h->baud)
+            break;
+    }
+
+    if (h->magic != QPSKD_MAGIC || id == RATE_PROFILES || h->mode >= MOD_MODES ||
+            h->rate >= FEC_RATES || h->channels < 1 || h->channel >= h->channels)
+        return -1;
+
+    if ((c->chan = channel_create(rate_profile((RateID) id))) == NULL)
+        return -1;
+
+    const struct rate_profile *p = c->chan->profile;
+    const int fs = (h->fs > 0) ? (int) h->fs : (int) p->fs;
+
+    if (channel_set_mode(c->chan, (ModID) h->mode) != 0 ||
+            channel_set_packets(c->chan, (CodeRate) h->rate) != 0 ||
+            channel_set_input(c->chan, h->channels, h->channel) != 0)
+        return -1;
+
+    if (fs != (int) p->fs && channel_set_audio(c->chan, fs) != 0)
+        return -1;
+
+    /*
+     * The input that makes one modem frame, which
+     * is whole for the usual sound card rates
+     */
+    c->chunk = (int) (((long) p->frame_size * fs + ((long) p->fs / 2)) / (long) p->fs);
+    c->period_ns = (c->chunk * 1000000000LL) / fs;
+
+    if ((c->pcm = malloc((size_t) c->chunk * h->channels * sizeof (int16_t))) == NULL)
+        return -1;
+
+    if (daemon_state.record != NULL) {
+        const struct capture_info info = {
+            .format = CAP_PCM16, .channels = h->channels,
+            .fs = (float) fs, .rs = p->rs, .center = p->center
+        };
+        char name[4096];
+
+        snprintf(name, sizeof (name), "%s%d.cap", daemon_state.record, c->id);
+
+        if ((c->cap = capture_create(name, &info)) == NULL)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Mark the sync words of the frame just run, moving
+ * them from the profile rate to the input's
+ */
+static void record_syncs(struct client *c) {
+    const struct channel *chan = c->chan;
+    const double fs = (c->hello.fs > 0) ? c->hello.fs : chan->profile->fs;
+
+    for (int i = 0; i < chan->sync_count; i++) {
+        const struct sync_event *e = &chan->sync_events[i];
+
+        if (e->offset >= 0) {
+            capture_mark(c->cap, (uint64_t) ((double) e->offset * fs / chan->profile->fs + 0.5),
+                    CAP_EVENT_SYNC, e->strength);
+        }
+    }
+}
+
+static void client_frame(struct client *c) {
+    if (c->cap != NULL)
+        capture_write(c->cap, c->pcm, c->chunk);
+
+    if (c->chan->rx_audio == NULL) {
+        rx_frame(c->chan, c->pcm);
+        publish(c);
+
+        if (c->cap != NULL)
+            record_syncs(c);
+
+        return;
+    }
+
+    for (int done = 0; done < c->chunk; ) {
+        bool ready;
+
+        done += rx_audio(c->chan, &c->pcm[(long) done * c->hello.channels], c->chunk - done, &ready);
+
+        if (ready) {
+            publish(c);
+
+            if (c->cap != NULL)
+                record_syncs(c);
+        }
+    }
+}
+
+/*
+ * Run frames as they arrive, against a clock of one
+ * period a frame from the first
+ */
+static void client_run(struct client *c) {
+    const size_t bytes = (size_t) c->chunk * c->hello.channels * sizeof (int16_t);
+    long long t0 = 0;
+
+    atomic_store_explicit(&c->state, CLIENT_RUNNING, memory_order_release);
+
+    for (long n = 0; read_full(c->fd, c->pcm, bytes); n++) {
+        long long arrive = now_ns();
+
+        if (n == 0)
+            t0 = arrive;
+
+        long long deadline = t0 + ((n + 1) * c->period_ns);
+
+        if (arrive > deadline) {
+            int queued = 0;
+
+            if (ioctl(c->fd, FIONREAD, &queued) == 0 && (size_t) queued >= (bytes * QPSKD_BACKLOG)) {
+                long drop = (long) ((size_t) queued / bytes);
+
+                atomic_fetch_add(&c->overruns, 1);
+
+                for (long k = 0; k < drop && read_full(c->fd, c->pcm, bytes); k++) {
+                    atomic_fetch_add(&c->dropped, 1);
+                    n++;
+                }
+
+                arrive = now_ns();
+            } else {
+                atomic_fetch_add(&c->starved, 1);
+            }
+
+            t0 = arrive - (n * c->period_ns);
+            deadline = arrive + c->period_ns;
+        }
+
+        client_frame(c);
+
+        long long done = now_ns();
+        unsigned long long service = (unsigned long long) (done - arrive);
+        unsigned long long max = atomic_load(&c->max_ns);
+
+        atomic_fetch_add(&c->frames, 1);
+        atomic_fetch_add(&c->service_ns, service);
+
+        while (service > max && !atomic_compare_exchange_weak(&c->max_ns, &max, service))
+            ;
+
+        if (done > deadline)
+            atomic_fetch_add(&c->late, 1);
+    }
+}
+
+static void *client_thread(void *arg) {
+    struct client *c = arg;
+    struct sched_param param;
+    int policy;
+
+    if (pthread_getschedparam(pthread_self(), &policy, &param) == 0)
+        c->realtime = (policy == SCHED_FIFO);
+
+    /*
+     * A socket client says what it is first
+     */
+    if (c->fifo == NULL) {
+        struct qpskd_reply reply = { QPSKD_MAGIC, -1 };
+        bool ok = read_full(c->fd, &c->hello, sizeof (c->hello)) && client_setup(c) == 0;
+
+        if (ok)
+            reply.client = c->id;
+
+        if (send(c->fd, &reply, sizeof (reply), MSG_NOSIGNAL) == (ssize_t) sizeof (reply) && ok)
+            client_run(c);
+    } else if (client_setup(c) == 0) {
+        client_run(c);
+    }
+
+    if (atomic_load(&c->state) == CLIENT_PENDING)
+        atomic_store(&c->state, CLIENT_REFUSED);
+
+    atomic_store(&c->done, true);
+
+    return NULL;
+}
+
+/*
+ * Returns -1 if there is no room or the thread
+ * would not start
+ */
+static int client_start(int fd, const char *fifo) {
+    struct client *c = calloc(1, sizeof (struct client));
+    int status = -1;
+
+    if (c == NULL)
+        return -1;
+
+    c->fd = fd;
+    c->fifo = fifo;
+    atomic_init(&c->state, CLIENT_PENDING);
+
+    if (fifo != NULL)
+        c->hello = daemon_state.defaults;
+
+    pthread_mutex_lock(&daemon_state.clients_lock);
+
+    for (int i = 0; i < QPSKD_CLIENTS; i++) {
+        if (daemon_state.clients[i] == NULL) {
+            c->id = i;
+
+            if (runtime_thread(&c->thread, client_thread, c, daemon_state.priority) == 0) {
+                daemon_state.clients[i] = c;
+                status = 0;
+            }
+
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&daemon_state.clients_lock);
+
+    if (status != 0)
+        free(c);
+
+    return status;
+}
+
+/*
+ * The hello and the channel are only read once the
+ * thread has said they are set up
+ */
+static void client_report(struct client *c) {
+    int state = atomic_load_explicit(&c->state, memory_order_acquire);
+
+    if (state != CLIENT_RUNNING) {
+        fprintf(stderr, "client %d %s\n", c->id, (state == CLIENT_PENDING) ? "pending" : "refused");
+        return;
+    }
+
+    unsigned long frames = atomic_load(&c->frames);
+    double mean_ms = (frames > 0) ? (atomic_load(&c->service_ns) / 1e6 / frames) : 0.0;
+    double period_ms = c->period_ns / 1e6;
+
+    fprintf(stderr, "client %d %s %d baud %s: %lu frames, %lu late, %lu overruns (%lu dropped), "
+            "%lu starved, service %.2f ms mean %.2f max of %.1f (load %.1f%%), %lu packets, %s\n",
+            c->id, (c->fifo != NULL) ? c->fifo : "socket", c->hello.baud, mode_names[c->hello.mode],
+            frames, atomic_load(&c->late), atomic_load(&c->overruns), atomic_load(&c->dropped),
+            atomic_load(&c->starved), mean_ms, atomic_load(&c->max_ns) / 1e6, period_ms,
+            (period_ms > 0.0) ? (100.0 * mean_ms / period_ms) : 0.0,
+            atomic_load(&c->packets), c->realtime ? "SCHED_FIFO" : "SCHED_OTHER");
+}
+
+static void client_destroy(struct client *c) {
+    if (c->fd >= 0)
+        close(c->fd);
+
+    if (c->cap != NULL)
+        capture_close(c->cap);
+
+    channel_destroy(c->chan);
+    free(c->pcm);
+    free(c);
+}
+
+/*
+ * Report the clients, and join those that have gone,
+ * or all of them when stopping
+ */
+static void clients_service(bool report, bool all) {
+    pthread_mutex_lock(&daemon_state.clients_lock);
+
+    for (int i = 0; i < QPSKD_CLIENTS; i++) {
+        struct client *c = daemon_state.clients[i];
+
+        if (c == NULL)
+            continue;
+
+        bool gone = all || atomic_load(&c->done);
+
+        if (gone)
+            pthread_join(c->thread, NULL);
+
+        if (report || gone)
+            client_report(c);
+
+        if (gone) {
+            daemon_state.clients[i] = NULL;
+            client_destroy(c);
+        }
+    }
+
+    if (report) {
+        fprintf(stderr, "%lu packets not delivered to slow listeners\n",
+                atomic_load(&daemon_state.undelivered));
+    }
+
+    pthread_mutex_unlock(&daemon_state.clients_lock);
+}
+
+/*
+ * Returns the listening socket, or -1 on error
+ */
+static int socket_listen(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd;
+
+    if (strlen(path) >= sizeof (addr.sun_path))
+        return -1;
+
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof (addr)) != 0 || listen(fd, QPSKD_CLIENTS) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-s socket] [-f fifo]... [-r 300|1200|2400|4800]\n"
+            "       [-m bpsk|qpsk|8psk|16qam] [-a rate] [-P priority] [-i seconds]\n"
+            "       [-w prefix]\n", name);
+}
+
+int main(int argc, char **argv) {
+    const char *path = QPSKD_SOCKET;
+    const char *fifos[QPSKD_CLIENTS];
+    int nfifos = 0;
+    int interval = 10;
+    int opt;
+
+    daemon_state.defaults = (struct qpskd_hello) {
+        .magic = QPSKD_MAGIC, .baud = 2400, .mode = MOD_QPSK, .rate = FEC_1_2, .channels = 1
+    };
+
+    while ((opt = getopt(argc, argv, "s:f:r:m:a:P:i:w:")) != -1) {
+        switch (opt) {
+        case 's':
+            path = optarg;
+            break;
+        case 'f':
+            if (nfifos < QPSKD_CLIENTS)
+                fifos[nfifos++] = optarg;
+            break;
+        case 'r':
+            daemon_state.defaults.baud = (uint16_t) atoi(optarg);
+            break;
+        case 'm':
+            for (opt = 0; opt < MOD_MODES; opt++) {
+                if (strcmp(optarg, mode_names[opt]) == 0)
+                    break;
+            }
+
+            if (opt == MOD_MODES) {
+                usage(argv[0]);
+                return (EXIT_FAILURE);
+            }
+
+            daemon_state.defaults.mode = (uint8_t) opt;
+            break;
+        case 'a':
+            daemon_state.defaults.fs = (uint32_t) atoi(optarg);
+            break;
+        case 'P':
+            daemon_state.priority = atoi(optarg);
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        case 'w':
+            daemon_state.record = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return (EXIT_FAILURE);
+        }
+    }
+
+    char packets_path[sizeof (((struct sockaddr_un *) 0)->sun_path)];
+
+    snprintf(packets_path, sizeof (packets_path), "%s%s", path, QPSKD_PACKETS);
+
+    int pcm_fd = socket_listen(path);
+    int packet_fd = socket_listen(packets_path);
+
+    if (pcm_fd < 0 || packet_fd < 0) {
+        fprintf(stderr, "Unable to listen on %s and %s\n", path, packets_path);
+        return (EXIT_FAILURE);
+    }
+
+    struct sigaction sa = { .sa_handler = on_signal };
+
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    /*
+     * Keep the real-time threads from page faults
+     */
+    if (daemon_state.priority > 0 && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        fprintf(stderr, "Unable to lock memory, continuing\n");
+
+    atomic_store(&daemon_state.running, true);
+
+    /*
+     * A pipe is opened for both reading and writing, so
+     * it does not block for a writer, or end when one
+     * goes, and the channel runs on to the next
+     */
+    for (int i = 0; i < nfifos; i++) {
+        int fd = open(fifos[i], O_RDWR);
+
+        if (fd < 0 || client_start(fd, fifos[i]) != 0) {
+            fprintf(stderr, "Unable to serve %s\n", fifos[i]);
+
+            if (fd >= 0)
+                close(fd);
+        }
+    }
+
+    fprintf(stderr, "qpskd on %s, packets on %s\n", path, packets_path);
+
+    long long next_report = now_ns() + (interval * 1000000000LL);
+
+    while (!stop_signal) {
+        struct pollfd pfd[2] = { { pcm_fd, POLLIN, 0 }, { packet_fd, POLLIN, 0 } };
+
+        if (poll(pfd, 2, 1000) > 0) {
+            int fd;
+
+            if ((pfd[0].revents & POLLIN) && (fd = accept(pcm_fd, NULL, NULL)) >= 0) {
+                if (client_start(fd, NULL) != 0)
+                    close(fd);
+            }
+
+            if ((pfd[1].revents & POLLIN) && (fd = accept(packet_fd, NULL, NULL)) >= 0) {
+                pthread_mutex_lock(&daemon_state.listeners_lock);
+
+                if (daemon_state.nlisteners < QPSKD_LISTENERS) {
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                    daemon_state.listeners[daemon_state.nlisteners++] = fd;
+                } else {
+                    close(fd);
+                }
+
+                pthread_mutex_unlock(&daemon_state.listeners_lock);
+            }
+        }
+
+        bool report = report_signal || (interval > 0 && now_ns() >= next_report);
+
+        if (report) {
+            report_signal = 0;
+            next_report = now_ns() + (interval * 1000000000LL);
+        }
+
+        clients_service(report, false);
+    }
+
+    atomic_store(&daemon_state.running, false);
+
+    clients_service(true, true);
+
+    for (int i = 0; i < daemon_state.nlisteners; i++) {
+        close(daemon_state.listeners[i]);
+    }
+
+    close(pcm_fd);
+    close(packet_fd);
+    unlink(path);
+    unlink(packets_path);
+
+    return (EXIT_SUCCESS);
+}
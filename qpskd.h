@@ -0,0 +1,63 @@
+/*
+ * qpskd.h
+ *
+ * Wire format of the modem daemon, host byte order, as
+ * both ends are on the same machine
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+#include "packet.h"
+
+#define QPSKD_SOCKET    "/tmp/qpskd.sock"   // PCM clients
+#define QPSKD_PACKETS   ".packets"          // added for the packet socket
+#define QPSKD_MAGIC     0x51534b44u         // "QSKD"
+
+#define QPSKD_CLIENTS   32      // most channels at once
+#define QPSKD_LISTENERS 16      // most packet sockets
+#define QPSKD_BACKLOG   4       // frames queued before it is an overrun
+
+/*
+ * A PCM client sends this first, then int16 frames of
+ * channels interleaved at fs, and gets a reply back.
+ * A named pipe has no hello, and takes the daemon's.
+ */
+struct qpskd_hello {
+    uint32_t magic;
+    uint16_t baud;          // 300, 1200, 2400 or 4800
+    uint8_t mode;           // ModID of the receiver
+    uint8_t rate;           // CodeRate of the packets
+    uint32_t fs;            // of the PCM, 0 for the profile rate
+    uint8_t channels;       // interleaved
+    uint8_t channel;        // the one to take
+    uint16_t reserved;
+};
+
+struct qpskd_reply {
+    uint32_t magic;
+    int32_t client;         // -1 if refused
+};
+
+/*
+ * Each packet decoded on any channel goes to every
+ * listener on the packet socket
+ */
+struct qpskd_packet {
+    uint32_t magic;
+    int32_t client;
+    int64_t sample;         // where its sync word starts, at the profile rate
+    uint8_t mode;           // ModID
+    uint8_t reserved[3];
+    uint8_t payload[PACKET_BYTES];
+};
+
+#ifdef __cplusplus
+}
+#endif
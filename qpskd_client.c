@@ -0,0 +1,302 @@
+/*
+ * qpskd_client.c
+ *
+ * Play a capture into the modem daemon, or listen to it
+ *
+ * Usage: qpskd_client [-s socket] [-r 300|1200|2400|4800]
+ *                     [-m bpsk|qpsk|8psk|16qam] [-c channel]
+ *                     [-x speed] [-p frames] [-n frames] [-o file] file.cap
+ *        qpskd_client [-s socket] -l
+ *
+ * The capture is sent as a socket client would, a hello
+ * with its rate and channels, then frames of 512 at
+ * speed times real time. A speed of 1 is paced as a
+ * sound card would be, more than 1, or 0 for as fast as
+ * the socket takes them, gives the service time alone,
+ * and less than 1 starves the channel. With -p, every so
+ * many frames the client stalls for twice QPSKD_BACKLOG
+ * frames, then catches up all at once, which the daemon
+ * counts as an overrun. With -o the samples go to a file
+ * or named pipe instead, without a hello, for -f.
+ *
+ * With -l, the packets decoded on every channel are
+ * counted until the daemon stops, and a few printed.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "qpskd.h"
+#include "capture.h"
+
+#define CLIENT_FRAMES   512     // per write
+
+static const char *mode_names[MOD_MODES] = {
+    [MOD_BPSK] = "bpsk",
+    [MOD_QPSK] = "qpsk",
+    [MOD_8PSK] = "8psk",
+    [MOD_16QAM] = "16qam"
+};
+
+/*
+ * Returns the connected socket, or -1 on error
+ */
+static int socket_connect(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd;
+
+    if (strlen(path) >= sizeof (addr.sun_path))
+        return -1;
+
+    strcpy(addr.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof (addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static bool write_full(int fd, const void *buf, size_t bytes) {
+    const uint8_t *p = buf;
+
+    while (bytes > 0) {
+        ssize_t n = write(fd, p, bytes);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        p += n;
+        bytes -= (size_t) n;
+    }
+
+    return true;
+}
+
+static bool read_full(int fd, void *buf, size_t bytes) {
+    uint8_t *p = buf;
+
+    while (bytes > 0) {
+        ssize_t n = read(fd, p, bytes);
+
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        p += n;
+        bytes -= (size_t) n;
+    }
+
+    return true;
+}
+
+static int listen_packets(const char *path) {
+    char packets_path[sizeof (((struct sockaddr_un *) 0)->sun_path)];
+    struct qpskd_packet pk;
+    long count = 0;
+    int fd;
+
+    snprintf(packets_path, sizeof (packets_path), "%s%s", path, QPSKD_PACKETS);
+
+    if ((fd = socket_connect(packets_path)) < 0) {
+        fprintf(stderr, "Unable to connect to %s\n", packets_path);
+        return (EXIT_FAILURE);
+    }
+
+    while (read_full(fd, &pk, sizeof (pk))) {
+        if (pk.magic != QPSKD_MAGIC)
+            break;
+
+        if (++count <= 3 || (count % 50) == 0) {
+            printf("packet %ld client %d sample %lld %s\n", count, pk.client,
+                    (long long) pk.sample, (pk.mode < MOD_MODES) ? mode_names[pk.mode] : "?");
+        }
+    }
+
+    printf("%ld packets\n", count);
+    close(fd);
+
+    return (EXIT_SUCCESS);
+}
+
+/*
+ * Send the capture a frame at a time, each against a
+ * clock from the first, so a slow write is caught up
+ */
+static long play(int fd, const struct capture_reader *rd, double speed, long stall, long frames) {
+    const int channels = rd->header->channels;
+    int16_t pcm[CLIENT_FRAMES * 2];
+    int16_t *buf = pcm;
+    long long period_ns = (speed > 0.0) ? (long long) (CLIENT_FRAMES * 1e9 / rd->header->fs / speed) : 0;
+    struct timespec t0;
+    long sent = 0;
+
+    if (channels > 2 && (buf = malloc((size_t) CLIENT_FRAMES * channels * sizeof (int16_t))) == NULL)
+        return -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (uint64_t at = 0; frames == 0 || sent < frames; at += CLIENT_FRAMES) {
+        if (capture_read(rd, at, buf, CLIENT_FRAMES) != CLIENT_FRAMES)
+            break;
+
+        if (!write_full(fd, buf, (size_t) CLIENT_FRAMES * channels * sizeof (int16_t)))
+            break;
+
+        sent++;
+
+        if (period_ns > 0) {
+            long long due = (t0.tv_sec * 1000000000LL) + t0.tv_nsec + (sent * period_ns);
+
+            if (stall > 0 && (sent % stall) == 0)
+                due += 2LL * QPSKD_BACKLOG * period_ns;
+            struct timespec ts = { due / 1000000000LL, due % 1000000000LL };
+
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                ;
+        }
+    }
+
+    if (buf != pcm)
+        free(buf);
+
+    return sent;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-s socket] [-r 300|1200|2400|4800]\n"
+            "       [-m bpsk|qpsk|8psk|16qam] [-c channel]\n"
+            "       [-x speed] [-p frames] [-n frames] [-o file] file.cap\n"
+            "       %s [-s socket] -l\n", name, name);
+}
+
+int main(int argc, char **argv) {
+    const char *path = QPSKD_SOCKET;
+    const char *output = NULL;
+    struct qpskd_hello hello = {
+        .magic = QPSKD_MAGIC, .baud = 2400, .mode = MOD_QPSK, .rate = FEC_1_2
+    };
+    double speed = 1.0;
+    long stall = 0;
+    long frames = 0;
+    bool listen = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:r:m:c:x:p:n:o:l")) != -1) {
+        switch (opt) {
+        case 's':
+            path = optarg;
+            break;
+        case 'r':
+            hello.baud = (uint16_t) atoi(optarg);
+            break;
+        case 'm':
+            for (opt = 0; opt < MOD_MODES; opt++) {
+                if (strcmp(optarg, mode_names[opt]) == 0)
+                    break;
+            }
+
+            if (opt == MOD_MODES) {
+                usage(argv[0]);
+                return (EXIT_FAILURE);
+            }
+
+            hello.mode = (uint8_t) opt;
+            break;
+        case 'c':
+            hello.channel = (uint8_t) atoi(optarg);
+            break;
+        case 'x':
+            speed = atof(optarg);
+            break;
+        case 'p':
+            stall = atol(optarg);
+            break;
+        case 'n':
+            frames = atol(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'l':
+            listen = true;
+            break;
+        default:
+            usage(argv[0]);
+            return (EXIT_FAILURE);
+        }
+    }
+
+    if (listen)
+        return listen_packets(path);
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return (EXIT_FAILURE);
+    }
+
+    struct capture_reader *rd = capture_open(argv[optind]);
+
+    if (rd == NULL || rd->header->format != CAP_PCM16) {
+        fprintf(stderr, "%s is not a PCM capture file\n", argv[optind]);
+        return (EXIT_FAILURE);
+    }
+
+    hello.fs = (uint32_t) rd->header->fs;
+    hello.channels = (uint8_t) rd->header->channels;
+
+    int fd;
+
+    if (output != NULL) {
+        if ((fd = open(output, O_WRONLY | O_CREAT, 0644)) < 0) {
+            fprintf(stderr, "Unable to open %s\n", output);
+            return (EXIT_FAILURE);
+        }
+    } else {
+        struct qpskd_reply reply;
+
+        if ((fd = socket_connect(path)) < 0) {
+            fprintf(stderr, "Unable to connect to %s\n", path);
+            return (EXIT_FAILURE);
+        }
+
+        if (!write_full(fd, &hello, sizeof (hello)) || !read_full(fd, &reply, sizeof (reply)) ||
+                reply.magic != QPSKD_MAGIC || reply.client < 0) {
+            fprintf(stderr, "Refused by %s\n", path);
+            return (EXIT_FAILURE);
+        }
+
+        printf("client %d\n", reply.client);
+    }
+
+    long sent = play(fd, rd, speed, stall, frames);
+
+    printf("%ld frames of %d sent\n", sent, CLIENT_FRAMES);
+
+    close(fd);
+    capture_reader_close(rd);
+
+    return (sent < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,465 @@
+/*
+ * resample.c
+ *
+ * Polyphase rational resampler at the PCM boundary
+ *
+ * Sound cards run at 44.1 or 48 kHz, and the profiles at
+ * 9600 or 19200, so the rates are reduced to up / down,
+ * 1 / 5 for 48000 to 9600 and 32 / 147 for 44100. The
+ * windowed sinc prototype, at the up sampled rate, is cut
+ * into up phases, and each output is the dot product of
+ * one phase with the last taps inputs, so the zeros of the
+ * up sampling and the dropped outputs are never worked out.
+ *
+ * The int16 input is converted by the PCM kernels straight
+ * into the delay line a block at a time, and the outputs
+ * rounded and saturated back to int16 from a block buffer,
+ * so the audio is read and written once. On the modem side
+ * the samples may stay float, so the mixer takes them as
+ * they are and they are only rounded at the sound card.
+ *
+ * The dot product has a scalar version, and SSE2, AVX or
+ * NEON versions, picked once for the CPU through
+ * dispatch.c. Each keeps eight partial sums, one per tap
+ * modulo eight, added in the same tree at the end, so they
+ * all give the same samples.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RESAMPLE_X86
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RESAMPLE_NEON
+#endif
+
+#include "qpsk.h"
+#include "resample.h"
+#include "pcm.h"
+#include "dispatch.h"
+
+struct resample_kernel {
+    const char *name;
+    SimdLevel level;
+    float (*dot)(const float [], const float [], int);
+};
+
+static const struct resample_kernel *kernel;    // for the current CPU
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static float dot_scalar(const float h[], const float x[], int taps) {
+    float acc[8] = { 0.0f };
+
+    for (int i = 0; i < taps; i += 8) {
+        for (int k = 0; k < 8; k++) {
+            acc[k] += h[i + k] * x[i + k];
+        }
+    }
+
+    return ((acc[0] + acc[4]) + (acc[2] + acc[6])) + ((acc[1] + acc[5]) + (acc[3] + acc[7]));
+}
+
+#if defined(RESAMPLE_X86)
+
+/*
+ * Lanes 0 to 3 and 4 to 7, added pairwise
+ * as the scalar tree
+ */
+__attribute__((target("sse2")))
+static inline float sum_sse2(__m128 lo, __m128 hi) {
+    __m128 s = _mm_add_ps(lo, hi);
+
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("sse2")))
+static float dot_sse2(const float h[], const float x[], int taps) {
+    __m128 lo = _mm_setzero_ps();
+    __m128 hi = _mm_setzero_ps();
+
+    for (int i = 0; i < taps; i += 8) {
+        lo = _mm_add_ps(lo, _mm_mul_ps(_mm_loadu_ps(&h[i]), _mm_loadu_ps(&x[i])));
+        hi = _mm_add_ps(hi, _mm_mul_ps(_mm_loadu_ps(&h[i + 4]), _mm_loadu_ps(&x[i + 4])));
+    }
+
+    return sum_sse2(lo, hi);
+}
+
+__attribute__((target("avx")))
+static float dot_avx(const float h[], const float x[], int taps) {
+    __m256 acc = _mm256_setzero_ps();
+
+    for (int i = 0; i < taps; i += 8) {
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(&h[i]), _mm256_loadu_ps(&x[i])));
+    }
+
+    return sum_sse2(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+}
+
+#elif defined(RESAMPLE_NEON)
+
+/*
+ * Separate multiply and add, as the fused
+ * multiply-add rounds differently from scalar
+ */
+static float dot_neon(const float h[], const float x[], int taps) {
+    float32x4_t lo = vdupq_n_f32(0.0f);
+    float32x4_t hi = vdupq_n_f32(0.0f);
+
+    for (int i = 0; i < taps; i += 8) {
+        lo = vaddq_f32(lo, vmulq_f32(vld1q_f32(&h[i]), vld1q_f32(&x[i])));
+        hi = vaddq_f32(hi, vmulq_f32(vld1q_f32(&h[i + 4]), vld1q_f32(&x[i + 4])));
+    }
+
+    float32x4_t s = vaddq_f32(lo, hi);
+    float32x2_t p = vadd_f32(vget_low_f32(s), vget_high_f32(s));
+
+    return vget_lane_f32(p, 0) + vget_lane_f32(p, 1);
+}
+
+#endif
+
+/*
+ * Scalar first, then in order of preference
+ */
+static const struct resample_kernel variants[] = {
+    { "scalar", SIMD_SCALAR, dot_scalar },
+#if defined(RESAMPLE_X86)
+    { "sse2", SIMD_SSE2, dot_sse2 },
+    { "avx", SIMD_AVX, dot_avx },
+#elif defined(RESAMPLE_NEON)
+    { "neon", SIMD_NEON, dot_neon },
+#endif
+};
+
+#define VARIANTS    (int) (sizeof (variants) / sizeof (variants[0]))
+
+static void kernels_pick(void) {
+    kernel = &variants[0];
+
+    for (int i = 1; i < VARIANTS; i++) {
+        if (dispatch_has(variants[i].level))
+            kernel = &variants[i];
+    }
+}
+
+static int gcd(int a, int b) {
+    while (b != 0) {
+        int t = a % b;
+
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+/*
+ * Blackman windowed sinc at the up sampled rate, cut at
+ * RESAMPLE_CUTOFF of the lower rate, with a gain of up so
+ * the inserted zeros keep the level. Phase p of output is
+ * taps p, p + up, p + 2 up ... newest sample last.
+ */
+static void resampler_design(struct resampler *r) {
+    const int length = r->taps * r->up;
+    const int lower = (r->in_rate < r->out_rate) ? r->in_rate : r->out_rate;
+    const double fc = RESAMPLE_CUTOFF * lower / ((double) r->in_rate * r->up);
+    const double mid = (length - 1) / 2.0;
+    double sum = 0.0;
+
+    for (int n = 0; n < length; n++) {
+        double t = n - mid;
+        double sinc = (t == 0.0) ? (2.0 * fc) : (sin(TAU * fc * t) / (M_PI * t));
+        double w = 0.42 - 0.5 * cos(TAU * n / (length - 1)) + 0.08 * cos(2.0 * TAU * n / (length - 1));
+        double h = sinc * w;
+
+        r->rows[((n % r->up) * r->taps) + (r->taps - 1 - (n / r->up))] = (float) h;
+        sum += h;
+    }
+
+    for (int n = 0; n < length; n++) {
+        r->rows[n] = (float) (r->rows[n] * r->up / sum);
+    }
+}
+
+/*
+ * From in_rate to out_rate, both in whole samples per second
+ *
+ * Returns NULL on error
+ */
+struct resampler *resampler_create(int in_rate, int out_rate) {
+    if (in_rate <= 0 || out_rate <= 0)
+        return NULL;
+
+    int g = gcd(in_rate, out_rate);
+    int up = out_rate / g;
+    int down = in_rate / g;
+
+    if (up > RESAMPLE_PHASES || down > (RESAMPLE_PHASES * RESAMPLE_SPAN))
+        return NULL;
+
+    struct resampler *r = calloc(1, sizeof (struct resampler));
+
+    if (r == NULL)
+        return NULL;
+
+    r->in_rate = in_rate;
+    r->out_rate = out_rate;
+    r->up = up;
+    r->down = down;
+
+    /*
+     * The filter spans RESAMPLE_SPAN samples of the lower
+     * rate, so taps inputs when decimating
+     */
+    int taps = (RESAMPLE_SPAN * ((up > down) ? up : down) + up - 1) / up;
+
+    r->taps = (taps + 7) & ~7;
+
+    r->rows = malloc((size_t) r->up * r->taps * sizeof (float));
+    r->history = malloc((r->taps - 1 + RESAMPLE_BLOCK) * sizeof (float));
+    r->block = malloc(resampler_bound(r, RESAMPLE_BLOCK) * sizeof (float));
+
+    if (r->rows == NULL || r->history == NULL || r->block == NULL) {
+        resampler_destroy(r);
+        return NULL;
+    }
+
+    resampler_design(r);
+    resampler_reset(r);
+
+    return r;
+}
+
+void resampler_destroy(struct resampler *r) {
+    if (r == NULL)
+        return;
+
+    free(r->rows);
+    free(r->history);
+    free(r->block);
+    free(r);
+}
+
+/*
+ * Clear the delay line, as at creation
+ */
+void resampler_reset(struct resampler *r) {
+    memset(r->history, 0, (r->taps - 1) * sizeof (float));
+
+    r->have = r->taps - 1;
+    r->start = 0;
+    r->phase = 0;
+}
+
+/*
+ * Returns the most outputs length inputs can give
+ */
+int resampler_bound(const struct resampler *r, int length) {
+    return (int) ((((long) length * r->up) + r->down - 1) / r->down) + 1;
+}
+
+/*
+ * Every output the n inputs just put in the history
+ * give, at most RESAMPLE_BLOCK of them
+ *
+ * Returns the number of samples put out
+ */
+static int resample_block(const struct resample_kernel *k, struct resampler *r, int n, float out[]) {
+    int produced = 0;
+
+    r->have += n;
+
+    while ((r->start + r->taps) <= r->have) {
+        out[produced++] = k->dot(&r->rows[r->phase * r->taps], &r->history[r->start], r->taps);
+
+        r->phase += r->down;
+        r->start += r->phase / r->up;
+        r->phase %= r->up;
+    }
+
+    /*
+     * Keep the window of the next output on. When
+     * decimating it may start past the inputs so far.
+     */
+    int drop = (r->start < r->have) ? r->start : r->have;
+
+    memmove(r->history, &r->history[drop], (r->have - drop) * sizeof (float));
+    r->have -= drop;
+    r->start -= drop;
+
+    return produced;
+}
+
+static int resample(const struct resample_kernel *k, struct resampler *r, const int16_t in[],
+        int channels, int channel, int length, int16_t out[]) {
+    int count = 0;
+
+    for (int done = 0; done < length; done += RESAMPLE_BLOCK) {
+        int n = ((length - done) < RESAMPLE_BLOCK) ? (length - done) : RESAMPLE_BLOCK;
+
+        pcm_to_float(&in[(long) done * channels], channels, channel, &r->history[r->have], n, 1.0f);
+
+        int produced = resample_block(k, r, n, r->block);
+
+        pcm_from_float(r->block, &out[count], produced, 1.0f);
+        count += produced;
+    }
+
+    return count;
+}
+
+/*
+ * Resample length frames of one channel, of channels
+ * interleaved, into out, which holds resampler_bound()
+ * samples.
+ *
+ * Returns the number of samples put out
+ */
+int resampler_process(struct resampler *r, const int16_t in[], int channels, int channel,
+        int length, int16_t out[]) {
+    pthread_once(&kernels_once, kernels_pick);
+
+    return resample(kernel, r, in, channels, channel, length, out);
+}
+
+/*
+ * As resampler_process(), but out is left as float, in
+ * int16 units, for the receiver to mix down unrounded
+ */
+int resampler_to_float(struct resampler *r, const int16_t in[], int channels, int channel,
+        int length, float out[]) {
+    int count = 0;
+
+    pthread_once(&kernels_once, kernels_pick);
+
+    for (int done = 0; done < length; done += RESAMPLE_BLOCK) {
+        int n = ((length - done) < RESAMPLE_BLOCK) ? (length - done) : RESAMPLE_BLOCK;
+
+        pcm_to_float(&in[(long) done * channels], channels, channel, &r->history[r->have], n, 1.0f);
+
+        count += resample_block(kernel, r, n, &out[count]);
+    }
+
+    return count;
+}
+
+/*
+ * As resampler_process(), but from float in int16 units,
+ * such as the unrounded transmit carrier, so the samples
+ * are only rounded and saturated once, on the way out
+ */
+int resampler_from_float(struct resampler *r, const float in[], int length, int16_t out[]) {
+    int count = 0;
+
+    pthread_once(&kernels_once, kernels_pick);
+
+    for (int done = 0; done < length; done += RESAMPLE_BLOCK) {
+        int n = ((length - done) < RESAMPLE_BLOCK) ? (length - done) : RESAMPLE_BLOCK;
+
+        memcpy(&r->history[r->have], &in[done], n * sizeof (float));
+
+        int produced = resample_block(kernel, r, n, r->block);
+
+        pcm_from_float(r->block, &out[count], produced, 1.0f);
+        count += produced;
+    }
+
+    return count;
+}
+
+const char *resample_variant(void) {
+    pthread_once(&kernels_once, kernels_pick);
+
+    return kernel->name;
+}
+
+#define TEST_LENGTH 4999    // odd, so the blocks run their tails
+#define TEST_SEED   12345u
+
+/*
+ * Run a resampler from the start on one
+ * kernel, fed in uneven pieces
+ *
+ * Returns the number of samples put out
+ */
+static int test_run(const struct resample_kernel *k, struct resampler *r,
+        const int16_t in[], int16_t out[]) {
+    int count = 0;
+
+    resampler_reset(r);
+
+    for (int done = 0, n = 1; done < TEST_LENGTH; done += n, n = (n * 7) % 700 + 1) {
+        if (n > (TEST_LENGTH - done))
+            n = TEST_LENGTH - done;
+
+        count += resample(k, r, &in[done], 1, 0, n, &out[count]);
+    }
+
+    return count;
+}
+
+/*
+ * Check every kernel the CPU can run, whatever the override,
+ * against the scalar one, at the sound card and profile
+ * rates both ways. They must give the same samples.
+ *
+ * Returns the number of kernels that differ
+ */
+int resample_selftest(void) {
+    static const int rates[][2] = {
+        { 48000, 9600 }, { 44100, 9600 }, { 48000, 19200 }, { 9600, 44100 }
+    };
+    static int16_t in[TEST_LENGTH];
+    static int16_t ref[(TEST_LENGTH * 5) + 64], out[(TEST_LENGTH * 5) + 64];
+    uint32_t state = TEST_SEED;
+    int failed = 0;
+
+    /*
+     * A tone, loud enough to clip after the
+     * filter ripple, with some noise on it
+     */
+    for (int i = 0; i < TEST_LENGTH; i++) {
+        state = (state * 1664525u) + 1013904223u;
+        in[i] = (int16_t) (32000.0f * sinf(i * 0.05f) + (float) ((int) (state >> 24) - 128));
+    }
+
+    for (int v = 1; v < VARIANTS; v++) {
+        int differ = 0;
+
+        if (!dispatch_cpu(variants[v].level))
+            continue;
+
+        for (int t = 0; t < (int) (sizeof (rates) / sizeof (rates[0])); t++) {
+            struct resampler *r = resampler_create(rates[t][0], rates[t][1]);
+
+            if (r == NULL) {
+                differ++;
+                continue;
+            }
+
+            int n_ref = test_run(&variants[0], r, in, ref);
+            int n_out = test_run(&variants[v], r, in, out);
+
+            differ += (n_ref != n_out) || memcmp(ref, out, n_ref * sizeof (int16_t)) != 0;
+
+            resampler_destroy(r);
+        }
+
+        printf("resample %-8s %s\n", variants[v].name, (differ == 0) ? "ok" : "FAILED");
+
+        failed += (differ != 0);
+    }
+
+    return failed;
+}
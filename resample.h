@@ -0,0 +1,53 @@
+/*
+ * resample.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+
+#define RESAMPLE_SPAN   32      // filter length, in samples at the lower rate
+#define RESAMPLE_BLOCK  256     // input samples converted at a time
+#define RESAMPLE_PHASES 1024    // most interpolation phases
+#define RESAMPLE_CUTOFF 0.45f   // of the lower rate
+
+/*
+ * Rational up / down resampler from int16 streams,
+ * such as a 48 or 44.1 kHz sound card, to the modem's
+ * 9600, or back. The modem side may be int16 or float.
+ * The filter runs on from one call to the next.
+ */
+struct resampler {
+    int in_rate;
+    int out_rate;
+    int up;                 // interpolation, after reducing the rates
+    int down;               // decimation
+    int taps;               // per phase, a multiple of 8
+
+    float *rows;            // up rows of taps, oldest sample first
+    float *history;         // taps - 1 delay line, then a block of input
+    float *block;           // outputs of one block
+    int have;               // samples in the history
+    int start;              // of the next output's window
+    int phase;              // of the next output, 0 to up - 1
+};
+
+struct resampler *resampler_create(int, int);
+void resampler_destroy(struct resampler *);
+void resampler_reset(struct resampler *);
+int resampler_bound(const struct resampler *, int);
+int resampler_process(struct resampler *, const int16_t [], int, int, int, int16_t []);
+int resampler_to_float(struct resampler *, const int16_t [], int, int, int, float []);
+int resampler_from_float(struct resampler *, const float [], int, int16_t []);
+
+const char *resample_variant(void);
+int resample_selftest(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,137 @@
+/*
+ * ringbuf.c
+ *
+ * Lock-free SPSC ring buffer
+ *
+ * Reads and writes are all or nothing, so an audio
+ * thread never blocks: a write to a full ring drops the
+ * data and counts an overrun, and a read from a ring
+ * without enough data returns false for the caller to
+ * fill in silence, and count an underrun if it matters.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ringbuf.h"
+
+/*
+ * Size is rounded up to a power of two elements
+ *
+ * Returns NULL on error
+ */
+struct ringbuf *ringbuf_create(size_t size, size_t elem) {
+    size_t n = 1;
+
+    if (size == 0 || elem == 0)
+        return NULL;
+
+    while (n < size)
+        n <<= 1;
+
+    size_t bytes = ((sizeof (struct ringbuf) + CACHE_LINE - 1) / CACHE_LINE) * CACHE_LINE;
+    struct ringbuf *rb = aligned_alloc(CACHE_LINE, bytes);
+
+    if (rb == NULL)
+        return NULL;
+
+    memset(rb, 0, sizeof (struct ringbuf));
+
+    size_t data = (((n * elem) + CACHE_LINE - 1) / CACHE_LINE) * CACHE_LINE;
+
+    if ((rb->data = aligned_alloc(CACHE_LINE, data)) == NULL) {
+        free(rb);
+        return NULL;
+    }
+
+    atomic_init(&rb->head, 0);
+    atomic_init(&rb->tail, 0);
+    atomic_init(&rb->overruns, 0);
+    atomic_init(&rb->underruns, 0);
+
+    rb->size = n;
+    rb->mask = n - 1;
+    rb->elem = elem;
+
+    return rb;
+}
+
+void ringbuf_destroy(struct ringbuf *rb) {
+    if (rb == NULL)
+        return;
+
+    free(rb->data);
+    free(rb);
+}
+
+/*
+ * Producer side. Returns false, and counts an
+ * overrun, if there is no room for all count elements
+ */
+bool ringbuf_write(struct ringbuf *rb, const void *src, size_t count) {
+    size_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+
+    if ((head - rb->tail_cache + count) > rb->size) {
+        rb->tail_cache = atomic_load_explicit(&rb->tail, memory_order_acquire);
+
+        if ((head - rb->tail_cache + count) > rb->size) {
+            atomic_fetch_add_explicit(&rb->overruns, 1, memory_order_relaxed);
+            return false;
+        }
+    }
+
+    size_t index = head & rb->mask;
+    size_t first = rb->size - index;
+
+    if (first > count)
+        first = count;
+
+    memcpy(&rb->data[index * rb->elem], src, first * rb->elem);
+    memcpy(rb->data, (const uint8_t *) src + (first * rb->elem), (count - first) * rb->elem);
+
+    atomic_store_explicit(&rb->head, head + count, memory_order_release);
+
+    return true;
+}
+
+/*
+ * Consumer side. Returns false if there
+ * are fewer than count elements
+ */
+bool ringbuf_read(struct ringbuf *rb, void *dst, size_t count) {
+    size_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+
+    if ((rb->head_cache - tail) < count) {
+        rb->head_cache = atomic_load_explicit(&rb->head, memory_order_acquire);
+
+        if ((rb->head_cache - tail) < count)
+            return false;
+    }
+
+    size_t index = tail & rb->mask;
+    size_t first = rb->size - index;
+
+    if (first > count)
+        first = count;
+
+    memcpy(dst, &rb->data[index * rb->elem], first * rb->elem);
+    memcpy((uint8_t *) dst + (first * rb->elem), rb->data, (count - first) * rb->elem);
+
+    atomic_store_explicit(&rb->tail, tail + count, memory_order_release);
+
+    return true;
+}
+
+/*
+ * Elements waiting, safe from either side
+ */
+size_t ringbuf_count(struct ringbuf *rb) {
+    size_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+
+    return head - tail;
+}
+
+size_t ringbuf_space(struct ringbuf *rb) {
+    return rb->size - ringbuf_count(rb);
+}
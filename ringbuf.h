@@ -0,0 +1,54 @@
+/*
+ * ringbuf.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define CACHE_LINE  64
+
+/*
+ * Lock-free Single Producer Single Consumer ring.
+ *
+ * The producer and consumer indexes sit on their own cache
+ * lines, each with a private copy of the other side's index,
+ * so the two threads only share a line when the ring looks
+ * full or empty. Indexes run free and wrap by the mask.
+ */
+struct ringbuf {
+    _Alignas(CACHE_LINE) atomic_size_t head;   // producer
+    size_t tail_cache;
+
+    _Alignas(CACHE_LINE) atomic_size_t tail;   // consumer
+    size_t head_cache;
+
+    _Alignas(CACHE_LINE) atomic_ulong overruns; // writes dropped as full
+    atomic_ulong underruns;                     // reads short, counted by the caller
+
+    _Alignas(CACHE_LINE) size_t size;           // elements, power of two
+    size_t mask;
+    size_t elem;                                // bytes per element
+    uint8_t *data;
+};
+
+struct ringbuf *ringbuf_create(size_t, size_t);
+void ringbuf_destroy(struct ringbuf *);
+
+bool ringbuf_write(struct ringbuf *, const void *, size_t);
+bool ringbuf_read(struct ringbuf *, void *, size_t);
+
+size_t ringbuf_count(struct ringbuf *);
+size_t ringbuf_space(struct ringbuf *);
+
+#ifdef __cplusplus
+}
+#endif
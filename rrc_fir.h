@@ -13,8 +13,15 @@ extern "C" {
 #define NTAPS         127	// lower bauds need more taps, 127 for 300 baud is good
 #define GAIN          1.85
 
-void rrc_fir(complex float [], complex float [], int);
-void rrc_make(float, float, float);
+#define RRC_BLOCK       256     // samples filtered per kernel call
+
+#define RRC_HALF(ntaps) (((ntaps) / 2) + 1)    // coefficients kept
+#define RRC_MEMORY(ntaps) (((ntaps) - 1) + RRC_BLOCK)   // delay line, then a block
+
+void rrc_fir(const float [], int, complex float [], complex float [], int);
+void rrc_make(float [], int, float, float, float);
+const char *rrc_variant(void);
+int rrc_selftest(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,333 @@
+/*
+ * runtime.c
+ *
+ * Pipelined Full Duplex Runtime
+ *
+ *   capture  --> rx_ring --> rx worker (rx_frame)
+ *   playback <-- tx_ring <-- tx worker (transmit, tx_frame)
+ *
+ * Each ring has one producer and one consumer, so they
+ * are the lock-free SPSC rings, and the audio threads
+ * never wait on the DSP. The workers sleep on semaphores
+ * which the audio threads post without blocking.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+
+#include "runtime.h"
+
+static void *capture_thread(void *arg) {
+    struct runtime *rt = arg;
+    int16_t *frame = rt->capture_frame;
+
+    while (atomic_load(&rt->running)) {
+        if (rt->io.capture(rt->io.user, frame, rt->frame_size) == false)
+            break;
+
+        /*
+         * A full ring drops the frame and counts the
+         * overrun, the capture side must never stall
+         */
+        if (ringbuf_write(rt->rx_ring, frame, rt->frame_size))
+            sem_post(&rt->rx_ready);
+    }
+
+    atomic_store(&rt->capture_done, true);
+    sem_post(&rt->rx_ready);
+
+    return NULL;
+}
+
+static void *rx_thread(void *arg) {
+    struct runtime *rt = arg;
+    int16_t *frame = rt->rx_frame;
+
+    while (1) {
+        sem_wait(&rt->rx_ready);
+
+        if (ringbuf_read(rt->rx_ring, frame, rt->frame_size)) {
+            rx_frame(rt->chan, frame);
+            atomic_fetch_add(&rt->rx_frames, 1);
+        } else if (atomic_load(&rt->capture_done) || !atomic_load(&rt->running)) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void *tx_thread(void *arg) {
+    struct runtime *rt = arg;
+    int16_t *burst = rt->tx_burst;
+    struct timespec idle = { 0, (long) (1e9 * rt->frame_size / rt->chan->profile->fs) };
+
+    while (atomic_load(&rt->running)) {
+        int length = rt->io.transmit(rt->io.user, rt->chan, burst, rt->burst);
+
+        if (length < 0)
+            break;
+
+        if (length == 0) {
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        /*
+         * Pad the burst to whole frames
+         */
+        int frames = (length + rt->frame_size - 1) / rt->frame_size;
+
+        memset(&burst[length], 0, ((frames * rt->frame_size) - length) * sizeof (int16_t));
+
+        for (int i = 0; i < frames && atomic_load(&rt->running); i++) {
+            const int16_t *frame = &burst[i * rt->frame_size];
+
+            /*
+             * The worker may wait, playback frees a frame
+             * every frame period, so back off until it does
+             */
+            while (ringbuf_space(rt->tx_ring) < (size_t) rt->frame_size &&
+                    atomic_load(&rt->running)) {
+                sem_wait(&rt->tx_space);
+            }
+
+            if (ringbuf_write(rt->tx_ring, frame, rt->frame_size))
+                atomic_fetch_add(&rt->tx_frames, 1);
+
+            /*
+             * Busy once the first frame is in, or playback
+             * could find the ring empty ahead of it
+             */
+            if (i == 0)
+                atomic_store(&rt->tx_busy, true);
+        }
+
+        atomic_store(&rt->tx_busy, false);
+    }
+
+    return NULL;
+}
+
+static void *playback_thread(void *arg) {
+    struct runtime *rt = arg;
+    int16_t *frame = rt->playback_frame;
+
+    while (atomic_load(&rt->running)) {
+        if (ringbuf_read(rt->tx_ring, frame, rt->frame_size)) {
+            sem_post(&rt->tx_space);
+        } else {
+            /*
+             * Silence between bursts is normal,
+             * but not in the middle of one
+             */
+            if (atomic_load(&rt->tx_busy))
+                atomic_fetch_add(&rt->tx_ring->underruns, 1);
+
+            memset(frame, 0, rt->frame_size * sizeof (int16_t));
+        }
+
+        if (rt->io.playback(rt->io.user, frame, rt->frame_size) == false)
+            break;
+    }
+
+    return NULL;
+}
+
+/*
+ * Real-time threads get SCHED_FIFO at the given priority,
+ * or the default policy if that is 0 or not permitted
+ */
+int runtime_thread(pthread_t *thread, void *(*fn)(void *), void *arg, int priority) {
+    if (priority > 0) {
+        pthread_attr_t attr;
+        struct sched_param param = { .sched_priority = priority };
+
+        pthread_attr_init(&attr);
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+
+        int rc = pthread_create(thread, &attr, fn, arg);
+
+        pthread_attr_destroy(&attr);
+
+        if (rc == 0)
+            return 0;
+    }
+
+    return pthread_create(thread, NULL, fn, arg);
+}
+
+/*
+ * Either of the playback or transmit callbacks may be
+ * NULL for receive only. burst is the most samples
+ * one transmit call may return.
+ *
+ * Returns NULL on error
+ */
+struct runtime *runtime_create(struct channel *chan, const struct runtime_io *io, int burst) {
+    if (chan == NULL || io == NULL || io->capture == NULL)
+        return NULL;
+
+    struct runtime *rt = calloc(1, sizeof (struct runtime));
+
+    if (rt == NULL)
+        return NULL;
+
+    sem_init(&rt->rx_ready, 0, 0);
+    sem_init(&rt->tx_space, 0, 0);
+
+    rt->chan = chan;
+    rt->io = *io;
+    rt->frame_size = chan->profile->frame_size;
+    rt->burst = burst;
+
+    rt->rx_ring = ringbuf_create(RUNTIME_FRAMES * rt->frame_size, sizeof (int16_t));
+    rt->tx_ring = ringbuf_create(RUNTIME_FRAMES * rt->frame_size, sizeof (int16_t));
+
+    /*
+     * The thread buffers are made here, rather than
+     * on the stacks of the real-time threads
+     */
+    rt->capture_frame = calloc(rt->frame_size, sizeof (int16_t));
+    rt->rx_frame = calloc(rt->frame_size, sizeof (int16_t));
+    rt->playback_frame = calloc(rt->frame_size, sizeof (int16_t));
+    rt->tx_burst = calloc(burst + rt->frame_size, sizeof (int16_t));
+
+    if (rt->rx_ring == NULL || rt->tx_ring == NULL ||
+            rt->capture_frame == NULL || rt->rx_frame == NULL ||
+            rt->playback_frame == NULL || rt->tx_burst == NULL) {
+        runtime_destroy(rt);
+        return NULL;
+    }
+
+    atomic_init(&rt->running, false);
+    atomic_init(&rt->capture_done, false);
+    atomic_init(&rt->tx_busy, false);
+    atomic_init(&rt->rx_frames, 0);
+    atomic_init(&rt->tx_frames, 0);
+
+    return rt;
+}
+
+void runtime_destroy(struct runtime *rt) {
+    if (rt == NULL)
+        return;
+
+    sem_destroy(&rt->rx_ready);
+    sem_destroy(&rt->tx_space);
+
+    ringbuf_destroy(rt->rx_ring);
+    ringbuf_destroy(rt->tx_ring);
+    free(rt->capture_frame);
+    free(rt->rx_frame);
+    free(rt->playback_frame);
+    free(rt->tx_burst);
+    free(rt);
+}
+
+/*
+ * priority is the SCHED_FIFO priority for
+ * the capture and playback threads, 0 for none
+ *
+ * If a thread cannot be made, those already running
+ * are stopped and joined, their callbacks returning
+ * as for runtime_stop(), and the runtime is left
+ * stopped for runtime_destroy().
+ *
+ * Returns -1 on error
+ */
+int runtime_start(struct runtime *rt, int priority) {
+    bool duplex = (rt->io.playback != NULL && rt->io.transmit != NULL && rt->burst > 0);
+    pthread_t *started[4];
+    int count = 0;
+
+    atomic_store(&rt->running, true);
+
+    if (pthread_create(&rt->rx_thread, NULL, rx_thread, rt) != 0)
+        goto fail;
+
+    started[count++] = &rt->rx_thread;
+
+    if (runtime_thread(&rt->capture_thread, capture_thread, rt, priority) != 0)
+        goto fail;
+
+    started[count++] = &rt->capture_thread;
+
+    if (duplex) {
+        if (pthread_create(&rt->tx_thread, NULL, tx_thread, rt) != 0)
+            goto fail;
+
+        started[count++] = &rt->tx_thread;
+
+        if (runtime_thread(&rt->playback_thread, playback_thread, rt, priority) != 0)
+            goto fail;
+    } else {
+        rt->io.playback = NULL;
+    }
+
+    return 0;
+
+fail:
+    atomic_store(&rt->running, false);
+    sem_post(&rt->rx_ready);
+    sem_post(&rt->tx_space);
+
+    for (int i = 0; i < count; i++) {
+        pthread_join(*started[i], NULL);
+    }
+
+    rt->joined = true;
+    rt->io.playback = NULL;
+
+    return -1;
+}
+
+/*
+ * Wait for the capture stream to end and the
+ * receive worker to drain it, then stop
+ */
+void runtime_wait(struct runtime *rt) {
+    if (!rt->joined) {
+        pthread_join(rt->capture_thread, NULL);
+        pthread_join(rt->rx_thread, NULL);
+        rt->joined = true;
+    }
+
+    runtime_stop(rt);
+}
+
+/*
+ * The capture callback has to return
+ * for its thread to see the stop
+ */
+void runtime_stop(struct runtime *rt) {
+    if (!atomic_exchange(&rt->running, false))
+        return;
+
+    sem_post(&rt->rx_ready);
+    sem_post(&rt->tx_space);
+
+    if (!rt->joined) {
+        pthread_join(rt->capture_thread, NULL);
+        pthread_join(rt->rx_thread, NULL);
+        rt->joined = true;
+    }
+
+    if (rt->io.playback != NULL) {
+        pthread_join(rt->tx_thread, NULL);
+        pthread_join(rt->playback_thread, NULL);
+    }
+}
+
+void runtime_stats(struct runtime *rt, struct runtime_stats *stats) {
+    stats->rx_frames = atomic_load(&rt->rx_frames);
+    stats->tx_frames = atomic_load(&rt->tx_frames);
+    stats->rx_overruns = atomic_load(&rt->rx_ring->overruns);
+    stats->tx_underruns = atomic_load(&rt->tx_ring->underruns);
+}
@@ -0,0 +1,92 @@
+/*
+ * runtime.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "modem.h"
+#include "ringbuf.h"
+
+#define RUNTIME_FRAMES  16  // frames of slack in each ring
+
+/*
+ * Audio and packet callbacks, all may block.
+ *
+ * capture fills a frame of PCM, false at end of stream
+ * playback sends a frame of PCM, false on error
+ * transmit modulates the next burst, returning the number
+ * of samples, 0 when idle, or -1 to stop transmitting
+ */
+struct runtime_io {
+    bool (*capture)(void *, int16_t [], int);
+    bool (*playback)(void *, const int16_t [], int);
+    int (*transmit)(void *, struct channel *, int16_t [], int);
+    void *user;
+};
+
+struct runtime_stats {
+    unsigned long rx_frames;
+    unsigned long tx_frames;
+    unsigned long rx_overruns;      // capture dropped, receive fell behind
+    unsigned long tx_underruns;     // playback starved mid transmission
+};
+
+/*
+ * Full duplex runtime. Capture and playback run on their
+ * own (optionally real-time) threads, and only move PCM
+ * between the audio callbacks and the rings. rx_frame()
+ * and tx_frame() run on worker threads, so bursty DSP load
+ * is soaked up by the rings instead of dropping samples.
+ */
+struct runtime {
+    struct channel *chan;
+    struct runtime_io io;
+    int frame_size;
+    int burst;                  // tx samples per transmit call
+
+    struct ringbuf *rx_ring;
+    struct ringbuf *tx_ring;
+
+    int16_t *capture_frame;
+    int16_t *rx_frame;
+    int16_t *playback_frame;
+    int16_t *tx_burst;
+
+    sem_t rx_ready;             // frames waiting in rx_ring
+    sem_t tx_space;             // frames freed in tx_ring
+
+    pthread_t capture_thread;
+    pthread_t playback_thread;
+    pthread_t rx_thread;
+    pthread_t tx_thread;
+
+    atomic_bool running;
+    atomic_bool capture_done;
+    bool joined;
+    atomic_bool tx_busy;
+    atomic_ulong rx_frames;
+    atomic_ulong tx_frames;
+};
+
+struct runtime *runtime_create(struct channel *, const struct runtime_io *, int);
+void runtime_destroy(struct runtime *);
+int runtime_start(struct runtime *, int);
+void runtime_wait(struct runtime *);
+void runtime_stop(struct runtime *);
+void runtime_stats(struct runtime *, struct runtime_stats *);
+int runtime_thread(pthread_t *, void *(*)(void *), void *, int);
+
+#ifdef __cplusplus
+}
+#endif
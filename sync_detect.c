@@ -0,0 +1,226 @@
+/*
+ * sync_detect.c
+ *
+ * FFT Sync Word Correlator
+ *
+ * Finds where a packet starts in the demodulated symbols
+ * by correlating against a sync word. A sliding correlation
+ * costs length multiplies per symbol, while overlap-save
+ * fast correlation costs O(log nfft), so long sync words
+ * on many channels keep the detection CPU bounded.
+ *
+ * The correlation magnitude is the same for all four
+ * phase ambiguities of the Costas loop, and the phase of
+ * the peak says which of them was received.
+ *
+ * The threshold is CFAR (Constant False Alarm Rate), the
+ * peak power against the mean power of the whole block,
+ * along with a floor on the normalized correlation so
+ * that noise during acquisition isn't reported.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "qpsk.h"
+#include "sync_detect.h"
+
+/*
+ * The pattern is the sync word symbols as received after
+ * the Costas loop, and threshold the CFAR ratio, or 0.0
+ * for SYNC_CFAR.
+ *
+ * Returns NULL on error
+ */
+struct sync_detect *sync_detect_create(const complex float pattern[], int length, float threshold) {
+    if (length < 2)
+        return NULL;
+
+    struct sync_detect *sd = calloc(1, sizeof (struct sync_detect));
+
+    if (sd == NULL)
+        return NULL;
+
+    sd->nfft = 64;
+
+    while (sd->nfft < (length * 4))
+        sd->nfft <<= 1;
+
+    sd->length = length;
+    sd->step = sd->nfft - length;
+    sd->threshold = (threshold > 0.0f) ? threshold : SYNC_CFAR;
+    sd->fill = length;
+
+    sd->plan = fft_plan_create(sd->nfft);
+    sd->pattern = calloc(sd->nfft, sizeof (complex float));
+    sd->block = calloc(sd->nfft, sizeof (complex float));
+    sd->work = calloc(sd->nfft, sizeof (complex float));
+    sd->position = calloc(sd->nfft, sizeof (long));
+    sd->power = calloc(sd->step + 1, sizeof (float));
+    sd->energy_run = calloc(sd->step + 1, sizeof (float));
+
+    if (sd->plan == NULL || sd->pattern == NULL || sd->block == NULL ||
+            sd->work == NULL || sd->position == NULL ||
+            sd->power == NULL || sd->energy_run == NULL) {
+        sync_detect_destroy(sd);
+        return NULL;
+    }
+
+    for (int i = 0; i < length; i++) {
+        sd->pattern[i] = pattern[i];
+        sd->energy += crealf(pattern[i]) * crealf(pattern[i]) +
+                      cimagf(pattern[i]) * cimagf(pattern[i]);
+    }
+
+    /*
+     * Correlation is multiplication by the conjugate
+     * spectrum, which only needs doing once
+     */
+    fft_execute(sd->plan, sd->pattern);
+
+    for (int i = 0; i < sd->nfft; i++) {
+        sd->pattern[i] = conjf(sd->pattern[i]);
+    }
+
+    for (int i = 0; i < sd->fill; i++) {
+        sd->position[i] = -1;
+    }
+
+    return sd;
+}
+
+void sync_detect_destroy(struct sync_detect *sd) {
+    if (sd == NULL)
+        return;
+
+    fft_plan_destroy(sd->plan);
+    free(sd->pattern);
+    free(sd->block);
+    free(sd->work);
+    free(sd->position);
+    free(sd->power);
+    free(sd->energy_run);
+    free(sd);
+}
+
+/*
+ * Correlate one full block and report the peaks
+ */
+static int sync_detect_block(struct sync_detect *sd, struct sync_event events[], int max) {
+    const int nfft = sd->nfft;
+    const int valid = sd->step + 1;
+    complex float *c = sd->work;
+    float *power = sd->power;
+    float *energy = sd->energy_run;
+    float mean = 0.0f;
+    int count = 0;
+
+    memcpy(c, sd->block, nfft * sizeof (complex float));
+
+    fft_execute(sd->plan, c);
+
+    for (int i = 0; i < nfft; i++) {
+        float ar = crealf(c[i]), ai = cimagf(c[i]);
+        float br = crealf(sd->pattern[i]), bi = cimagf(sd->pattern[i]);
+
+        c[i] = (ar * br - ai * bi) + (ar * bi + ai * br) * I;
+    }
+
+    ifft_execute(sd->plan, c);
+
+    /*
+     * Only the first step + 1 outputs have the whole sync
+     * word inside the block, the rest wrap around.
+     * The received energy under the word at each lag is
+     * a running sum, for the normalized strength.
+     */
+    float run = 0.0f;
+
+    for (int k = 0; k < sd->length; k++) {
+        run += crealf(sd->block[k]) * crealf(sd->block[k]) +
+               cimagf(sd->block[k]) * cimagf(sd->block[k]);
+    }
+
+    for (int n = 0; n < valid; n++) {
+        float cr = crealf(c[n]) / nfft;
+        float ci = cimagf(c[n]) / nfft;
+
+        power[n] = cr * cr + ci * ci;
+        energy[n] = run;
+        mean += power[n];
+
+        if ((n + sd->length) < nfft) {
+            complex float in = sd->block[n + sd->length];
+            complex float out = sd->block[n];
+
+            run += (crealf(in) * crealf(in) + cimagf(in) * cimagf(in)) -
+                   (crealf(out) * crealf(out) + cimagf(out) * cimagf(out));
+        }
+    }
+
+    mean /= valid;
+
+    /*
+     * The last lag is the first of the next block, and
+     * the one before it is that lag's left neighbour
+     */
+    float before = sd->edge;
+
+    sd->edge = power[valid - 2];
+
+    if (mean <= 0.0f)
+        return 0;
+
+    for (int n = 0; n < (valid - 1) && count < max; n++) {
+        if (sd->position[n] < 0 || power[n] < (sd->threshold * mean))
+            continue;
+
+        if (((n > 0) ? power[n - 1] : before) > power[n] || power[n + 1] >= power[n])
+            continue;
+
+        float strength = sqrtf(power[n] / (sd->energy * energy[n] + 1e-20f));
+
+        if (strength < SYNC_STRENGTH)
+            continue;
+
+        float theta = atan2f(cimagf(c[n]), crealf(c[n]));
+        int ambiguity = (int) lrintf(theta / (M_PI / 2.0)) & 0x3;
+
+        events[count].offset = sd->position[n];
+        events[count].ambiguity = ambiguity;
+        events[count].phase = theta;
+        events[count].strength = strength;
+        events[count].ratio = power[n] / mean;
+        count++;
+    }
+
+    return count;
+}
+
+/*
+ * Queue count symbols, with the sample offset of each,
+ * correlating every time a block fills up.
+ *
+ * Returns the number of events, up to max
+ */
+int sync_detect_process(struct sync_detect *sd, const complex float symbols[],
+        const long position[], int count, struct sync_event events[], int max) {
+    int found = 0;
+    int keep = sd->length;
+
+    for (int i = 0; i < count; i++) {
+        sd->block[sd->fill] = symbols[i];
+        sd->position[sd->fill] = position[i];
+
+        if (++sd->fill == sd->nfft) {
+            found += sync_detect_block(sd, &events[found], max - found);
+
+            memmove(sd->block, &sd->block[sd->nfft - keep], keep * sizeof (complex float));
+            memmove(sd->position, &sd->position[sd->nfft - keep], keep * sizeof (long));
+            sd->fill = keep;
+        }
+    }
+
+    return found;
+}
@@ -0,0 +1,63 @@
+/*
+ * sync_detect.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <complex.h>
+
+#include "algorithms/fft.h"
+
+#define SYNC_CFAR       12.0f   // peak power over block mean power
+#define SYNC_STRENGTH   0.5f    // least normalized correlation
+#define SYNC_EVENTS     8       // most events reported per frame
+
+/*
+ * A detected sync word
+ */
+struct sync_event {
+    long offset;        // sample of the first sync symbol
+    int ambiguity;      // received = pattern * j^ambiguity
+    float phase;        // radians, received = pattern * e^(j phase)
+    float strength;     // normalized correlation, 0 to 1
+    float ratio;        // peak over CFAR noise estimate
+};
+
+/*
+ * Overlap-save FFT correlator. Each block holds the last
+ * length symbols of the previous block and step new
+ * ones, giving step + 1 correlation outputs per FFT. The
+ * last is only a peak if the lag after it is lower, so it
+ * is decided as the first output of the next block.
+ */
+struct sync_detect {
+    int length;             // sync word symbols
+    int nfft;
+    int step;               // new symbols per block
+    float threshold;
+    float energy;           // pattern energy
+    float edge;             // power at the lag before the block
+
+    struct fft_plan *plan;
+    complex float *pattern; // conjugate spectrum of the sync word
+    complex float *block;   // symbols, then correlation
+    complex float *work;
+    long *position;         // sample offset of each block symbol
+    float *power;           // correlation power per lag
+    float *energy_run;      // received energy per lag
+    int fill;
+};
+
+struct sync_detect *sync_detect_create(const complex float [], int, float);
+void sync_detect_destroy(struct sync_detect *);
+int sync_detect_process(struct sync_detect *, const complex float [], const long [], int,
+        struct sync_event [], int);
+
+#ifdef __cplusplus
+}
+#endif
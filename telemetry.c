@@ -0,0 +1,137 @@
+/*
+ * telemetry.c
+ *
+ * Link quality, from numbers the receiver has already
+ * worked out. The Costas loop adds each symbol's decision
+ * error and phase detector error as it goes, and once a
+ * frame they are folded into running means and published.
+ *
+ * The snapshot is a sequence lock. The receiver makes the
+ * count odd, stores the words, then makes it even again,
+ * and a reader copies the words until it sees the same
+ * even count before and after. A monitor thread can then
+ * poll hundreds of channels without a lock or a syscall.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "telemetry.h"
+
+void telemetry_init(struct telemetry *t) {
+    memset(&t->stats, 0, sizeof (struct link_stats));
+
+    t->count = 0;
+    t->error_power = 0.0f;
+    t->point_power = 0.0f;
+    t->pd_sum = 0.0f;
+    t->pd_power = 0.0f;
+    t->last_timing = 0.0f;
+
+    atomic_init(&t->timing, 0.0f);
+    atomic_init(&t->sequence, 0);
+
+    for (size_t i = 0; i < TELEMETRY_WORDS; i++) {
+        atomic_init(&t->words[i], 0);
+    }
+}
+
+static float running(float mean, float x, bool first) {
+    return first ? x : (mean + TELEMETRY_GAIN * (x - mean));
+}
+
+static void telemetry_publish(struct telemetry *t) {
+    uint64_t words[TELEMETRY_WORDS] = { 0 };
+    unsigned int seq = atomic_load_explicit(&t->sequence, memory_order_relaxed);
+
+    memcpy(words, &t->stats, sizeof (struct link_stats));
+
+    atomic_store_explicit(&t->sequence, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    for (size_t i = 0; i < TELEMETRY_WORDS; i++) {
+        atomic_store_explicit(&t->words[i], words[i], memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&t->sequence, seq + 2, memory_order_release);
+}
+
+/*
+ * Packets decoded this frame, and the error and
+ * dropped totals
+ */
+void telemetry_packets(struct telemetry *t, long decoded, long crc_errors, long header_errors,
+        long dropped) {
+    struct link_stats *s = &t->stats;
+
+    s->packets += decoded;
+    s->crc_errors = crc_errors;
+    s->header_errors = header_errors;
+    s->dropped = dropped;
+
+    if ((s->packets + s->crc_errors) > 0)
+        s->crc_pass = (float) s->packets / (s->packets + s->crc_errors);
+}
+
+/*
+ * Fold the symbols of the frame into the running
+ * means along with the loop state, and publish them
+ */
+void telemetry_frame(struct telemetry *t, float frequency, float level, bool locked) {
+    struct link_stats *s = &t->stats;
+    float timing = atomic_load_explicit(&t->timing, memory_order_relaxed);
+    bool first = (s->frames == 0);
+
+    if (t->count > 0) {
+        float error = t->error_power / t->count;
+        float point = t->point_power / t->count;
+        float mean = t->pd_sum / t->count;
+        float ratio = (error > 0.0f) ? (point / error) : 1e6f;
+
+        s->evm = running(s->evm, 100.0f * sqrtf(error / ((point > 0.0f) ? point : 1.0f)), first);
+        s->snr = running(s->snr, 10.0f * log10f(ratio), first);
+        s->phase_var = running(s->phase_var, (t->pd_power / t->count) - (mean * mean), first);
+    }
+
+    float jump = first ? 0.0f : (timing - t->last_timing);
+
+    s->timing_jitter = sqrtf(running(s->timing_jitter * s->timing_jitter, jump * jump, first));
+    t->last_timing = timing;
+
+    s->frames++;
+    s->symbols += t->count;
+    s->frequency = frequency;
+    s->level = level;
+    s->timing = timing;
+    s->locked = locked;
+
+    t->count = 0;
+    t->error_power = 0.0f;
+    t->point_power = 0.0f;
+    t->pd_sum = 0.0f;
+    t->pd_power = 0.0f;
+
+    telemetry_publish(t);
+}
+
+/*
+ * A consistent copy of the last snapshot,
+ * from any thread
+ */
+void telemetry_read(struct telemetry *t, struct link_stats *stats) {
+    uint64_t words[TELEMETRY_WORDS];
+    unsigned int before, after;
+
+    do {
+        before = atomic_load_explicit(&t->sequence, memory_order_acquire);
+
+        for (size_t i = 0; i < TELEMETRY_WORDS; i++) {
+            words[i] = atomic_load_explicit(&t->words[i], memory_order_relaxed);
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&t->sequence, memory_order_relaxed);
+    } while ((before & 0x1) || before != after);
+
+    memcpy(stats, words, sizeof (struct link_stats));
+}
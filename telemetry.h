@@ -0,0 +1,98 @@
+/*
+ * telemetry.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <complex.h>
+
+#define TELEMETRY_GAIN  0.1f    // running mean per frame
+
+/*
+ * Link quality of one channel, as running means
+ * over the last few frames
+ */
+struct link_stats {
+    unsigned long frames;
+    unsigned long symbols;
+
+    float evm;              // percent, rms decision error over rms point
+    float snr;              // dB, from the decision error
+    float phase_var;        // phase detector error variance
+    float frequency;        // Hz, Costas loop
+    float level;            // mean symbol amplitude
+    float timing;           // samples
+    float timing_jitter;    // rms change frame to frame, samples
+    bool locked;
+
+    unsigned long packets;
+    unsigned long crc_errors;
+    unsigned long header_errors;
+    unsigned long dropped;  // packets the frame had no room for
+    float crc_pass;         // packets over packets and CRC errors
+};
+
+#define TELEMETRY_WORDS ((sizeof (struct link_stats) + sizeof (uint64_t) - 1) / sizeof (uint64_t))
+
+/*
+ * The receive thread adds up each frame and publishes a
+ * snapshot under a sequence count, odd while it is being
+ * written, so a monitor reads it with no lock, and never
+ * holds up the receiver.
+ */
+struct telemetry {
+    // Receive thread only
+
+    unsigned long count;        // symbols this frame
+    float error_power;          // sums over the frame
+    float point_power;
+    float pd_sum;
+    float pd_power;
+
+    float last_timing;
+    struct link_stats stats;
+
+    _Atomic float timing;       // from the timing stage, which may be another thread
+
+    // Published
+
+    atomic_uint sequence;
+    _Atomic uint64_t words[TELEMETRY_WORDS];
+};
+
+void telemetry_init(struct telemetry *);
+void telemetry_frame(struct telemetry *, float, float, bool);
+void telemetry_packets(struct telemetry *, long, long, long, long);
+void telemetry_read(struct telemetry *, struct link_stats *);
+
+static inline void telemetry_timing(struct telemetry *t, float offset) {
+    atomic_store_explicit(&t->timing, offset, memory_order_relaxed);
+}
+
+/*
+ * Add one symbol, its decision error and
+ * point, and the phase detector error
+ */
+static inline void telemetry_symbol(struct telemetry *t, complex float error,
+        complex float point, float pd) {
+    float er = crealf(error), ei = cimagf(error);
+    float pr = crealf(point), pi = cimagf(point);
+
+    t->count++;
+    t->error_power += (er * er) + (ei * ei);
+    t->point_power += (pr * pr) + (pi * pi);
+    t->pd_sum += pd;
+    t->pd_power += pd * pd;
+}
+
+#ifdef __cplusplus
+}
+#endif
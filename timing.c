@@ -0,0 +1,192 @@
+/*
+ * timing.c
+ *
+ * Feed-forward symbol timing, after Oerder and Meyr
+ *
+ * The squared magnitude of the filtered signal has a spectral
+ * line at the symbol rate, whose phase is where in the symbol
+ * the eye is open. The line is one DFT bin, so it is the
+ * power at each sample phase, summed over the frame, times
+ * a table of cycles rotations. That sum has no dependency
+ * from one symbol to the next, so the compiler vectorizes it,
+ * and any block can be estimated on its own.
+ *
+ * No data decisions are needed, and it wants at least
+ * four samples per symbol, which every profile has.
+ *
+ * The offset is fractional. The symbols are taken at the
+ * nearest sample, or between samples by a cubic Lagrange
+ * interpolator, whose four taps are the same for the whole
+ * frame as the offset is.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "qpsk.h"
+#include "timing.h"
+
+/*
+ * Returns NULL on error
+ */
+struct timing *timing_create(int cycles, int frame_size) {
+    if (cycles < 2 || frame_size < (cycles * 2) || (frame_size % cycles) != 0)
+        return NULL;
+
+    struct timing *t = calloc(1, sizeof (struct timing));
+
+    if (t == NULL)
+        return NULL;
+
+    t->cycles = cycles;
+    t->frame_size = frame_size;
+    t->guard = cycles + 2;
+    t->interpolate = true;
+
+    t->line_table = malloc(cycles * sizeof (complex float));
+    t->power = calloc(cycles, sizeof (float));
+    t->buffer = calloc(t->guard + (frame_size * 2), sizeof (complex float));
+
+    if (t->line_table == NULL || t->power == NULL || t->buffer == NULL) {
+        timing_destroy(t);
+        return NULL;
+    }
+
+    for (int p = 0; p < cycles; p++) {
+        t->line_table[p] = cmplxconj(TAU * p / cycles);
+    }
+
+    return t;
+}
+
+void timing_destroy(struct timing *t) {
+    if (t == NULL)
+        return;
+
+    free(t->line_table);
+    free(t->power);
+    free(t->buffer);
+    free(t);
+}
+
+/*
+ * Add a frame of filtered samples to the spectral line
+ *
+ * Returns the timing offset in samples, unwrapped, so
+ * it stays within half a symbol either side of 0 to cycles
+ */
+float timing_estimate(struct timing *t, const complex float in[]) {
+    const int cycles = t->cycles;
+    complex float line = 0.0f;
+
+    for (int p = 0; p < cycles; p++) {
+        t->power[p] = 0.0f;
+    }
+
+    for (int i = 0; i < t->frame_size; i += cycles) {
+        for (int p = 0; p < cycles; p++) {
+            float re = crealf(in[i + p]);
+            float im = cimagf(in[i + p]);
+
+            t->power[p] += (re * re) + (im * im);
+        }
+    }
+
+    for (int p = 0; p < cycles; p++) {
+        line += t->line_table[p] * t->power[p];
+    }
+
+    t->line = (t->frames > 0) ? (t->line + TIMING_GAIN * (line - t->line)) : line;
+
+    /*
+     * The eye is open where the line peaks, at -arg / 2pi
+     * of a symbol. Follow it round from the last offset,
+     * and only slip a symbol once it is well past the end.
+     */
+    float offset = -cargf(t->line) * cycles / TAU;
+
+    if (t->frames > 0) {
+        float diff = offset - t->offset;
+
+        offset = t->offset + (diff - cycles * rintf(diff / cycles));
+    } else if (offset < 0.0f) {
+        offset += cycles;
+    }
+
+    if (offset < (cycles * -0.5f))
+        offset += cycles;
+    else if (offset >= (cycles * 1.5f))
+        offset -= cycles;
+
+    t->offset = offset;
+
+    return offset;
+}
+
+/*
+ * Estimate the timing on a frame of filtered samples, and
+ * put out the frame_size / cycles symbols of the previous
+ * frame, zero before there was one.
+ *
+ * Returns the offset the symbols were taken at
+ */
+float timing_process(struct timing *t, const complex float in[], complex float out[]) {
+    const int frame_size = t->frame_size;
+
+    memmove(t->buffer, &t->buffer[frame_size], (t->guard + frame_size) * sizeof (complex float));
+    memcpy(&t->buffer[t->guard + frame_size], in, frame_size * sizeof (complex float));
+
+    float offset = timing_estimate(t, in);
+
+    t->frames++;
+
+    return timing_sample(t, offset, out);
+}
+
+/*
+ * Put out the symbols of the previous frame again, at
+ * another offset, such as a timing hypothesis a little
+ * either side of the estimate. The offset is kept within
+ * half a symbol of 0 to cycles.
+ *
+ * Returns the offset the symbols were taken at
+ */
+float timing_sample(const struct timing *t, float offset, complex float out[]) {
+    const int cycles = t->cycles;
+    const int symbols = t->frame_size / cycles;
+
+    offset = fminf(fmaxf(offset, (cycles * -0.5f)), (cycles * 1.5f));
+
+    float start = t->guard + offset;
+    int k = (int) floorf(start);
+    const complex float *x = &t->buffer[k];
+
+    if (!t->interpolate) {
+        int n = (int) lrintf(start) - k;
+
+        for (int i = 0; i < symbols; i++) {
+            out[i] = x[(i * cycles) + n];
+        }
+
+        return k - t->guard + n;
+    }
+
+    /*
+     * Lagrange taps for the samples either side,
+     * at mu past x[0]
+     */
+    float mu = start - k;
+    float c0 = -mu * (mu - 1.0f) * (mu - 2.0f) / 6.0f;
+    float c1 = (mu + 1.0f) * (mu - 1.0f) * (mu - 2.0f) / 2.0f;
+    float c2 = -(mu + 1.0f) * mu * (mu - 2.0f) / 2.0f;
+    float c3 = (mu + 1.0f) * mu * (mu - 1.0f) / 6.0f;
+
+    for (int i = 0; i < symbols; i++) {
+        const complex float *s = &x[(i * cycles) - 1];
+
+        out[i] = (s[0] * c0) + (s[1] * c1) + (s[2] * c2) + (s[3] * c3);
+    }
+
+    return offset;
+}
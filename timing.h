@@ -0,0 +1,44 @@
+/*
+ * timing.h
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <complex.h>
+
+#define TIMING_GAIN     0.25f   // spectral line smoothing between frames
+
+/*
+ * Oerder-Meyr symbol timing. The samples are kept for one
+ * frame, and the symbols put out are those of the previous
+ * frame, sampled at the estimate made through both.
+ */
+struct timing {
+    int cycles;             // samples per symbol
+    int frame_size;
+    int guard;              // samples kept before the previous frame
+    bool interpolate;       // cubic between samples, else the nearest
+
+    complex float *line_table;  // e^(-j 2 pi p / cycles)
+    float *power;           // |x|^2 per sample phase, last frame
+    complex float *buffer;  // guard, previous frame, current frame
+    complex float line;     // smoothed spectral line
+    float offset;           // samples, unwrapped
+    int frames;
+};
+
+struct timing *timing_create(int, int);
+void timing_destroy(struct timing *);
+float timing_estimate(struct timing *, const complex float []);
+float timing_process(struct timing *, const complex float [], complex float []);
+float timing_sample(const struct timing *, float, complex float []);
+
+#ifdef __cplusplus
+}
+#endif